@@ -35,6 +35,11 @@ extern unsigned long cpufreq_scale_max_freq_capacity(int cpu);
 #define arch_scale_cpu_capacity scale_cpu_capacity
 extern unsigned long scale_cpu_capacity(struct sched_domain *sd, int cpu);
 
+#define arch_scale_thermal_pressure scale_thermal_pressure
+extern unsigned long scale_thermal_pressure(int cpu);
+extern void arch_set_thermal_pressure(const struct cpumask *cpus,
+				      unsigned long th_pressure);
+
 #include <asm-generic/topology.h>
 
 #endif /* _ASM_ARM_TOPOLOGY_H */
@@ -25,6 +25,8 @@
 #include <asm/topology.h>
 #include <asm/smp_plat.h>
 
+#include <trace/events/sched.h>
+
 /*
  * cpu power table
  * This per cpu data structure describes the relative capacity of each core.
@@ -61,6 +63,34 @@ unsigned long scale_cpu_capacity(struct sched_domain *sd, int cpu)
 #endif
 }
 
+/*
+ * Fraction of the capacity, out of SCHED_CAPACITY_SCALE, that a cpu can't
+ * reach because its frequency is capped below the cpufreq policy maximum
+ * by someone else than cpufreq, e.g. thermal throttling through PM QoS.
+ */
+static DEFINE_PER_CPU(unsigned long, thermal_pressure);
+
+void arch_set_thermal_pressure(const struct cpumask *cpus,
+			       unsigned long th_pressure)
+{
+	int cpu;
+
+	th_pressure = min_t(unsigned long, th_pressure, SCHED_CAPACITY_SCALE);
+
+	for_each_cpu(cpu, cpus) {
+		WRITE_ONCE(per_cpu(thermal_pressure, cpu), th_pressure);
+		trace_sched_thermal_pressure(cpu, th_pressure);
+	}
+}
+
+/* Capacity lost to thermal pressure, in units of scale_cpu_capacity() */
+unsigned long scale_thermal_pressure(int cpu)
+{
+	unsigned long th_pressure = READ_ONCE(per_cpu(thermal_pressure, cpu));
+
+	return scale_cpu_capacity(NULL, cpu) * th_pressure >> SCHED_CAPACITY_SHIFT;
+}
+
 static int __init get_cpu_for_node(struct device_node *node)
 {
 	struct device_node *cpu_node;
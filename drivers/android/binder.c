@@ -56,7 +56,9 @@
 #include <linux/file.h>
 #include <linux/freezer.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
+#include <linux/log2.h>
 #include <linux/miscdevice.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
@@ -67,6 +69,7 @@
 #include <linux/sched.h>
 #include <linux/seq_file.h>
 #include <linux/uaccess.h>
+#include <linux/percpu.h>
 #include <linux/pid_namespace.h>
 #include <linux/security.h>
 #include <linux/spinlock.h>
@@ -147,6 +150,12 @@ module_param_named(debug_mask, binder_debug_mask, uint, 0644);
 static char *binder_devices_param = CONFIG_ANDROID_BINDER_DEVICES;
 module_param_named(devices, binder_devices_param, charp, S_IRUGO);
 
+static bool binder_latency_stats = true;
+module_param_named(latency_stats, binder_latency_stats, bool, 0644);
+
+static uint binder_slow_txn_us = 100000;
+module_param_named(slow_txn_us, binder_slow_txn_us, uint, 0644);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -200,7 +209,7 @@ enum binder_stat_types {
 };
 
 struct binder_stats {
-	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t br[_IOC_NR(BR_FROZEN_REPLY) + 1];
 	atomic_t bc[_IOC_NR(BC_REPLY_SG) + 1];
 	atomic_t obj_created[BINDER_STAT_COUNT];
 	atomic_t obj_deleted[BINDER_STAT_COUNT];
@@ -218,6 +227,49 @@ static inline void binder_stats_created(enum binder_stat_types type)
 	atomic_inc(&binder_stats.obj_created[type]);
 }
 
+/*
+ * Transaction latency histograms. Bucket 0 counts samples below 1us,
+ * bucket i (i > 0) samples in [2^(i-1), 2^i) us and the last bucket
+ * everything above.
+ */
+#define BINDER_LAT_BUCKETS	20
+
+enum binder_lat_type {
+	BINDER_LAT_QUEUE,	/* binder_transaction() to target dequeue */
+	BINDER_LAT_SERVICE,	/* target dequeue to BC_REPLY */
+	BINDER_LAT_COUNT
+};
+
+static const char * const binder_lat_type_strings[] = {
+	"queue",
+	"service",
+};
+
+/* per-cpu, updated with this_cpu ops only */
+struct binder_lat_hist {
+	u64 buckets[BINDER_LAT_COUNT][BINDER_LAT_BUCKETS];
+	u64 total_us[BINDER_LAT_COUNT];
+};
+
+static DEFINE_PER_CPU(struct binder_lat_hist, binder_lat_global);
+
+/* per-node, shared between cpus and updated atomically */
+struct binder_node_lat {
+	atomic_t buckets[BINDER_LAT_COUNT][BINDER_LAT_BUCKETS];
+	atomic64_t total_us[BINDER_LAT_COUNT];
+	atomic_t max_us;
+	atomic_t slow;
+};
+
+#define BINDER_LAT_TOP_NODES	16
+
+static inline int binder_lat_bucket(u64 us)
+{
+	if (!us)
+		return 0;
+	return min_t(int, ilog2(us) + 1, BINDER_LAT_BUCKETS - 1);
+}
+
 struct binder_transaction_log_entry {
 	int debug_id;
 	int debug_id_done;
@@ -365,6 +417,8 @@ struct binder_error {
  *                        (invariant after initialized)
  * @async_todo:           list of async work items
  *                        (protected by @proc->inner_lock)
+ * @lat:                  transaction latency histograms
+ *                        (atomics, no lock needed)
  *
  * Bookkeeping structure for binder nodes.
  */
@@ -406,6 +460,7 @@ struct binder_node {
 	};
 	bool has_async_transaction;
 	struct list_head async_todo;
+	struct binder_node_lat lat;
 };
 
 struct binder_ref_death {
@@ -540,6 +595,22 @@ struct binder_priority {
  * @alloc:                binder allocator bookkeeping
  * @context:              binder_context for this proc
  *                        (invariant after initialized)
+ * @lat:                  per-cpu transaction latency histograms
+ *                        (this_cpu ops, no lock needed)
+ * @outstanding_txns:     number of transactions queued to or being
+ *                        handled by this process
+ *                        (protected by @inner_lock)
+ * @is_frozen:            process is frozen and unable to service
+ *                        binder transactions
+ *                        (protected by @inner_lock)
+ * @sync_recv:            process received sync transactions since last
+ *                        frozen
+ *                        (protected by @inner_lock)
+ * @async_recv:           process received async transactions since last
+ *                        frozen
+ *                        (protected by @inner_lock)
+ * @freeze_wait:          waitqueue of BINDER_FREEZE callers waiting for
+ *                        @outstanding_txns to drop to zero
  * @inner_lock:           can nest under outer_lock and/or node lock
  * @outer_lock:           no nesting under innor or node lock
  *                        Lock order: 1) outer, 2) node, 3) inner
@@ -572,6 +643,12 @@ struct binder_proc {
 	struct dentry *debugfs_entry;
 	struct binder_alloc alloc;
 	struct binder_context *context;
+	struct binder_lat_hist __percpu *lat;
+	int outstanding_txns;
+	bool is_frozen;
+	bool sync_recv;
+	bool async_recv;
+	wait_queue_head_t freeze_wait;
 	spinlock_t inner_lock;
 	spinlock_t outer_lock;
 };
@@ -661,6 +738,14 @@ struct binder_transaction {
 	bool    set_priority_called;
 	kuid_t	sender_euid;
 	binder_uintptr_t security_ctx;
+	/**
+	 * @start_ts:    time binder_transaction() queued the transaction
+	 * @dequeue_ts:  time the target thread picked it up
+	 * @lat_node:    ptr of the target node, to account the reply
+	 */
+	ktime_t start_ts;
+	ktime_t dequeue_ts;
+	binder_uintptr_t lat_node;
 	/**
 	 * @lock:  protects @from, @to_proc, and @to_thread
 	 *
@@ -1620,6 +1705,85 @@ static void binder_put_node(struct binder_node *node)
 	binder_dec_node_tmpref(node);
 }
 
+static void binder_lat_add(struct binder_proc *proc, struct binder_node *node,
+			   enum binder_lat_type type, u64 us)
+{
+	int b = binder_lat_bucket(us);
+
+	this_cpu_inc(binder_lat_global.buckets[type][b]);
+	this_cpu_add(binder_lat_global.total_us[type], us);
+	if (proc->lat) {
+		this_cpu_inc(proc->lat->buckets[type][b]);
+		this_cpu_add(proc->lat->total_us[type], us);
+	}
+	if (node) {
+		atomic_inc(&node->lat.buckets[type][b]);
+		atomic64_add(us, &node->lat.total_us[type]);
+	}
+}
+
+/**
+ * binder_lat_dequeue() - account the queueing delay of a transaction
+ * @proc:	receiving binder_proc
+ * @t:		transaction just handed to a thread of @proc
+ *
+ * For synchronous transactions, also remember when the target started
+ * working on it so that binder_lat_reply() can account the service time.
+ */
+static void binder_lat_dequeue(struct binder_proc *proc,
+			       struct binder_transaction *t)
+{
+	struct binder_node *node = t->buffer->target_node;
+	ktime_t now;
+
+	if (!ktime_to_ns(t->start_ts))
+		return;
+
+	now = ktime_get();
+	binder_lat_add(proc, node, BINDER_LAT_QUEUE,
+		       ktime_us_delta(now, t->start_ts));
+	if (!(t->flags & TF_ONE_WAY)) {
+		t->dequeue_ts = now;
+		t->lat_node = node->ptr;
+	}
+}
+
+/**
+ * binder_lat_reply() - account the service time of a transaction
+ * @proc:	replying binder_proc
+ * @t:		transaction being replied to
+ *
+ * Must be called without any proc lock held.
+ */
+static void binder_lat_reply(struct binder_proc *proc,
+			     struct binder_transaction *t)
+{
+	struct binder_node *node;
+	int max, old;
+	u64 us;
+
+	if (!ktime_to_ns(t->dequeue_ts))
+		return;
+
+	us = ktime_us_delta(ktime_get(), t->dequeue_ts);
+	node = binder_get_node(proc, t->lat_node);
+	binder_lat_add(proc, node, BINDER_LAT_SERVICE, us);
+	if (!node)
+		return;
+
+	us = min_t(u64, us, INT_MAX);
+	max = atomic_read(&node->lat.max_us);
+	while (us > max) {
+		old = atomic_cmpxchg(&node->lat.max_us, max, us);
+		if (old == max)
+			break;
+		max = old;
+	}
+	if (us >= binder_slow_txn_us)
+		atomic_inc(&node->lat.slow);
+	binder_put_node(node);
+}
+
 static struct binder_ref *binder_get_ref_olocked(struct binder_proc *proc,
 						 u32 desc, bool need_strong_ref)
 {
@@ -2127,6 +2291,12 @@ static void binder_free_transaction(struct binder_transaction *t)
 
 	if (target_proc) {
 		binder_inner_proc_lock(target_proc);
+		target_proc->outstanding_txns--;
+		if (target_proc->outstanding_txns < 0)
+			pr_warn("%s: Unexpected outstanding_txns %d\n",
+				__func__, target_proc->outstanding_txns);
+		if (!target_proc->outstanding_txns && target_proc->is_frozen)
+			wake_up_interruptible_all(&target_proc->freeze_wait);
 		if (t->buffer)
 			t->buffer->transaction = NULL;
 		binder_inner_proc_unlock(target_proc);
@@ -2798,12 +2968,16 @@ static int binder_fixup_parent(struct binder_transaction *t,
  * If the @thread parameter is not NULL, the transaction is always queued
  * to the waitlist of that specific thread.
  *
- * Return:	true if the transactions was successfully queued
- *		false if the target process or thread is dead
+ * A synchronous transaction to a frozen process is rejected, a one-way
+ * transaction is queued and delivered once the process is unfrozen.
+ *
+ * Return:	0 if the transaction was successfully queued
+ *		BR_DEAD_REPLY if the target process or thread is dead
+ *		BR_FROZEN_REPLY if the target process is frozen
  */
-static bool binder_proc_transaction(struct binder_transaction *t,
-				    struct binder_proc *proc,
-				    struct binder_thread *thread)
+static uint32_t binder_proc_transaction(struct binder_transaction *t,
+					struct binder_proc *proc,
+					struct binder_thread *thread)
 {
 	struct binder_node *node = t->buffer->target_node;
 	struct binder_priority node_prio;
@@ -2826,10 +3000,18 @@ static bool binder_proc_transaction(struct binder_transaction *t,
 
 	binder_inner_proc_lock(proc);
 
-	if (proc->is_dead || (thread && thread->is_dead)) {
+	if (proc->is_frozen) {
+		proc->sync_recv |= !oneway;
+		proc->async_recv |= oneway;
+	}
+
+	if ((proc->is_frozen && !oneway) || proc->is_dead ||
+	    (thread && thread->is_dead)) {
+		bool frozen = proc->is_frozen;
+
 		binder_inner_proc_unlock(proc);
 		binder_node_unlock(node);
-		return false;
+		return frozen ? BR_FROZEN_REPLY : BR_DEAD_REPLY;
 	}
 
 	if (!thread && !pending_async)
@@ -2848,10 +3030,11 @@ static bool binder_proc_transaction(struct binder_transaction *t,
 	if (!pending_async)
 		binder_wakeup_thread_ilocked(proc, thread, !oneway /* sync */);
 
+	proc->outstanding_txns++;
 	binder_inner_proc_unlock(proc);
 	binder_node_unlock(node);
 
-	return true;
+	return 0;
 }
 
 /**
@@ -3113,6 +3296,8 @@ static void binder_transaction(struct binder_proc *proc,
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
 	t->debug_id = t_debug_id;
+	if (!reply && binder_latency_stats)
+		t->start_ts = ktime_get();
 
 	if (reply)
 		binder_debug(BINDER_DEBUG_TRANSACTION,
@@ -3407,15 +3592,18 @@ static void binder_transaction(struct binder_proc *proc,
 		binder_enqueue_thread_work(thread, tcomplete);
 		binder_inner_proc_lock(target_proc);
 		if (target_thread->is_dead) {
+			return_error = BR_DEAD_REPLY;
 			binder_inner_proc_unlock(target_proc);
 			goto err_dead_proc_or_thread;
 		}
 		BUG_ON(t->buffer->async_transaction != 0);
 		binder_pop_transaction_ilocked(target_thread, in_reply_to);
 		binder_enqueue_thread_work_ilocked(target_thread, &t->work);
+		target_proc->outstanding_txns++;
 		binder_inner_proc_unlock(target_proc);
 		wake_up_interruptible_sync(&target_thread->wait);
 		binder_restore_priority(current, in_reply_to->saved_priority);
+		binder_lat_reply(proc, in_reply_to);
 		binder_free_transaction(in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
@@ -3432,7 +3620,9 @@ static void binder_transaction(struct binder_proc *proc,
 		t->from_parent = thread->transaction_stack;
 		thread->transaction_stack = t;
 		binder_inner_proc_unlock(proc);
-		if (!binder_proc_transaction(t, target_proc, target_thread)) {
+		return_error = binder_proc_transaction(t, target_proc,
+						       target_thread);
+		if (return_error) {
 			binder_inner_proc_lock(proc);
 			binder_pop_transaction_ilocked(thread, t);
 			binder_inner_proc_unlock(proc);
@@ -3442,7 +3632,8 @@ static void binder_transaction(struct binder_proc *proc,
 		BUG_ON(target_node == NULL);
 		BUG_ON(t->buffer->async_transaction != 1);
 		binder_enqueue_thread_work(thread, tcomplete);
-		if (!binder_proc_transaction(t, target_proc, NULL))
+		return_error = binder_proc_transaction(t, target_proc, NULL);
+		if (return_error)
 			goto err_dead_proc_or_thread;
 	}
 	if (target_thread)
@@ -3459,7 +3650,6 @@ static void binder_transaction(struct binder_proc *proc,
 	return;
 
 err_dead_proc_or_thread:
-	return_error = BR_DEAD_REPLY;
 	return_error_line = __LINE__;
 	binder_dequeue_work(proc, tcomplete);
 err_translate_failed:
@@ -4392,6 +4582,8 @@ retry:
 		ptr += trsize;
 		
 		trace_binder_transaction_received(t);
+		if (cmd != BR_REPLY)
+			binder_lat_dequeue(proc, t);
 		binder_stat_br(proc, thread, cmd);
 		binder_debug(BINDER_DEBUG_TRANSACTION,
 			     "%d:%d %s %d %d:%d, cmd %d size %zd-%zd ptr %016llx-%016llx\n",
@@ -4563,6 +4755,7 @@ static void binder_free_proc(struct binder_proc *proc)
 	BUG_ON(!list_empty(&proc->delivered_death));
 	binder_alloc_deferred_release(&proc->alloc);
 	put_task_struct(proc->tsk);
+	free_percpu(proc->lat);
 	binder_stats_deleted(BINDER_STAT_PROC);
 	kfree(proc);
 }
@@ -4616,6 +4809,7 @@ static int binder_thread_release(struct binder_proc *proc,
 			     (t->to_thread == thread) ? "in" : "out");
 
 		if (t->to_thread == thread) {
+			thread->proc->outstanding_txns--;
 			t->to_proc = NULL;
 			t->to_thread = NULL;
 			if (t->buffer) {
@@ -4826,6 +5020,148 @@ static int binder_ioctl_get_node_debug_info(struct binder_proc *proc,
 	return 0;
 }
 
+/*
+ * A process still has work pending if transactions are queued to it or
+ * one of its threads is in the middle of handling a synchronous call.
+ */
+static bool binder_txns_pending_ilocked(struct binder_proc *proc)
+{
+	struct rb_node *n;
+	struct binder_thread *thread;
+
+	if (proc->outstanding_txns > 0)
+		return true;
+
+	for (n = rb_first(&proc->threads); n; n = rb_next(n)) {
+		thread = rb_entry(n, struct binder_thread, rb_node);
+		if (thread->transaction_stack &&
+		    thread->transaction_stack->from != thread)
+			return true;
+	}
+	return false;
+}
+
+static int binder_ioctl_freeze_proc(struct binder_freeze_info *info,
+				    struct binder_proc *target_proc)
+{
+	long ret = 0;
+
+	binder_inner_proc_lock(target_proc);
+	target_proc->sync_recv = false;
+	target_proc->async_recv = false;
+	target_proc->is_frozen = !!info->enable;
+	binder_inner_proc_unlock(target_proc);
+
+	if (!info->enable)
+		return 0;
+
+	/*
+	 * New transactions are rejected or queued from here on; give the
+	 * ones already delivered a chance to complete.
+	 */
+	if (info->timeout_ms > 0)
+		ret = wait_event_interruptible_timeout(
+			target_proc->freeze_wait,
+			!target_proc->outstanding_txns,
+			msecs_to_jiffies(info->timeout_ms));
+
+	if (ret >= 0) {
+		binder_inner_proc_lock(target_proc);
+		if (binder_txns_pending_ilocked(target_proc))
+			ret = -EAGAIN;
+		binder_inner_proc_unlock(target_proc);
+	}
+
+	if (ret < 0) {
+		binder_inner_proc_lock(target_proc);
+		target_proc->is_frozen = false;
+		binder_inner_proc_unlock(target_proc);
+		return ret;
+	}
+
+	return 0;
+}
+
+static int binder_ioctl_freeze(struct binder_freeze_info *info)
+{
+	struct binder_proc **target_procs, *target_proc;
+	int target_procs_count = 0, i = 0;
+	int ret = 0;
+
+	/* a process has one binder_proc per binder device it opened */
+	mutex_lock(&binder_procs_lock);
+	hlist_for_each_entry(target_proc, &binder_procs, proc_node) {
+		if (target_proc->pid == info->pid)
+			target_procs_count++;
+	}
+
+	if (target_procs_count == 0) {
+		mutex_unlock(&binder_procs_lock);
+		return -EINVAL;
+	}
+
+	target_procs = kcalloc(target_procs_count, sizeof(*target_procs),
+			       GFP_KERNEL);
+	if (!target_procs) {
+		mutex_unlock(&binder_procs_lock);
+		return -ENOMEM;
+	}
+
+	hlist_for_each_entry(target_proc, &binder_procs, proc_node) {
+		if (target_proc->pid != info->pid)
+			continue;
+
+		binder_inner_proc_lock(target_proc);
+		target_proc->tmp_ref++;
+		binder_inner_proc_unlock(target_proc);
+
+		target_procs[i++] = target_proc;
+	}
+	mutex_unlock(&binder_procs_lock);
+
+	for (i = 0; i < target_procs_count; i++) {
+		if (ret >= 0)
+			ret = binder_ioctl_freeze_proc(info, target_procs[i]);
+	}
+
+	for (i = 0; i < target_procs_count; i++)
+		binder_proc_dec_tmpref(target_procs[i]);
+
+	kfree(target_procs);
+
+	return ret;
+}
+
+static int binder_ioctl_get_freezer_info(
+				struct binder_frozen_status_info *info)
+{
+	struct binder_proc *target_proc;
+	bool found = false;
+	__u32 txns_pending;
+
+	info->sync_recv = 0;
+	info->async_recv = 0;
+
+	mutex_lock(&binder_procs_lock);
+	hlist_for_each_entry(target_proc, &binder_procs, proc_node) {
+		if (target_proc->pid == info->pid) {
+			found = true;
+			binder_inner_proc_lock(target_proc);
+			txns_pending = binder_txns_pending_ilocked(target_proc);
+			info->sync_recv |= target_proc->sync_recv |
+					(txns_pending << 1);
+			info->async_recv |= target_proc->async_recv;
+			binder_inner_proc_unlock(target_proc);
+		}
+	}
+	mutex_unlock(&binder_procs_lock);
+
+	if (!found)
+		return -EINVAL;
+
+	return 0;
+}
+
 static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	int ret;
@@ -4926,6 +5262,37 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		}
 		break;
 	}
+	case BINDER_FREEZE: {
+		struct binder_freeze_info info;
+
+		if (copy_from_user(&info, ubuf, sizeof(info))) {
+			ret = -EFAULT;
+			goto err;
+		}
+
+		ret = binder_ioctl_freeze(&info);
+		if (ret < 0)
+			goto err;
+		break;
+	}
+	case BINDER_GET_FROZEN_INFO: {
+		struct binder_frozen_status_info info;
+
+		if (copy_from_user(&info, ubuf, sizeof(info))) {
+			ret = -EFAULT;
+			goto err;
+		}
+
+		ret = binder_ioctl_get_freezer_info(&info);
+		if (ret < 0)
+			goto err;
+
+		if (copy_to_user(ubuf, &info, sizeof(info))) {
+			ret = -EFAULT;
+			goto err;
+		}
+		break;
+	}
 	default:
 		ret = -EINVAL;
 		goto err;
@@ -5049,11 +5416,14 @@ static int binder_open(struct inode *nodp, struct file *filp)
 				  miscdev);
 	proc->context = &binder_dev->context;
 	binder_alloc_init(&proc->alloc);
+	/* latency accounting is best effort, go on without it */
+	proc->lat = alloc_percpu(struct binder_lat_hist);
 
 	binder_stats_created(BINDER_STAT_PROC);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	INIT_LIST_HEAD(&proc->waiting_threads);
+	init_waitqueue_head(&proc->freeze_wait);
 	filp->private_data = proc;
 
 	mutex_lock(&binder_procs_lock);
@@ -5215,6 +5585,9 @@ static void binder_deferred_release(struct binder_proc *proc)
 	proc->tmp_ref++;
 
 	proc->is_dead = true;
+	proc->is_frozen = false;
+	proc->sync_recv = false;
+	proc->async_recv = false;
 	threads = 0;
 	active_transactions = 0;
 	while ((n = rb_first(&proc->threads))) {
@@ -5652,7 +6025,8 @@ static const char * const binder_return_strings[] = {
 	"BR_FINISHED",
 	"BR_DEAD_BINDER",
 	"BR_CLEAR_DEATH_NOTIFICATION_DONE",
-	"BR_FAILED_REPLY"
+	"BR_FAILED_REPLY",
+	"BR_FROZEN_REPLY"
 };
 
 static const char * const binder_command_strings[] = {
@@ -5780,6 +6154,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  buffers: %d\n", count);
 
 	binder_alloc_print_pages(m, &proc->alloc);
+	binder_alloc_print_stats(m, &proc->alloc);
 
 	count = 0;
 	binder_inner_proc_lock(proc);
@@ -5794,6 +6169,221 @@ static void print_binder_proc_stats(struct seq_file *m,
 }
 
 
+static int binder_lat_pct(u64 *buckets, u64 count, int pct)
+{
+	u64 want = div64_u64(count * pct + 99, 100);
+	u64 sum = 0;
+	int b;
+
+	for (b = 0; b < BINDER_LAT_BUCKETS - 1; b++) {
+		sum += buckets[b];
+		if (sum >= want)
+			break;
+	}
+	return b;
+}
+
+static void print_binder_lat(struct seq_file *m, const char *prefix,
+			     u64 buckets[BINDER_LAT_COUNT][BINDER_LAT_BUCKETS],
+			     u64 *total_us)
+{
+	int type, b;
+
+	for (type = 0; type < BINDER_LAT_COUNT; type++) {
+		u64 count = 0;
+		int p50, p99;
+
+		for (b = 0; b < BINDER_LAT_BUCKETS; b++)
+			count += buckets[type][b];
+		if (!count)
+			continue;
+
+		p50 = binder_lat_pct(buckets[type], count, 50);
+		p99 = binder_lat_pct(buckets[type], count, 99);
+		seq_printf(m, "%s%s: count %llu avg %lluus p50 <%luus p99 <%luus\n",
+			   prefix, binder_lat_type_strings[type], count,
+			   div64_u64(total_us[type], count),
+			   1UL << p50, 1UL << p99);
+		seq_printf(m, "%s ", prefix);
+		for (b = 0; b < BINDER_LAT_BUCKETS; b++) {
+			if (!buckets[type][b])
+				continue;
+			if (b == BINDER_LAT_BUCKETS - 1)
+				seq_printf(m, " >=%luus:%llu", 1UL << (b - 1),
+					   buckets[type][b]);
+			else
+				seq_printf(m, " <%luus:%llu", 1UL << b,
+					   buckets[type][b]);
+		}
+		seq_puts(m, "\n");
+	}
+}
+
+static void print_binder_lat_percpu(struct seq_file *m, const char *prefix,
+				    struct binder_lat_hist __percpu *lat)
+{
+	struct binder_lat_hist *sum;
+	int cpu, type, b;
+
+	sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct binder_lat_hist *h = per_cpu_ptr(lat, cpu);
+
+		for (type = 0; type < BINDER_LAT_COUNT; type++) {
+			for (b = 0; b < BINDER_LAT_BUCKETS; b++)
+				sum->buckets[type][b] += h->buckets[type][b];
+			sum->total_us[type] += h->total_us[type];
+		}
+	}
+	print_binder_lat(m, prefix, sum->buckets, sum->total_us);
+	kfree(sum);
+}
+
+static void print_binder_node_lat(struct seq_file *m,
+				  struct binder_node *node,
+				  struct binder_lat_hist *buf)
+{
+	u64 count = 0;
+	int type, b;
+
+	for (type = 0; type < BINDER_LAT_COUNT; type++) {
+		for (b = 0; b < BINDER_LAT_BUCKETS; b++) {
+			buf->buckets[type][b] =
+				atomic_read(&node->lat.buckets[type][b]);
+			count += buf->buckets[type][b];
+		}
+		buf->total_us[type] = atomic64_read(&node->lat.total_us[type]);
+	}
+	if (!count)
+		return;
+
+	seq_printf(m, "  node %d u%016llx: max %dus slow %d\n",
+		   node->debug_id, (u64)node->ptr,
+		   atomic_read(&node->lat.max_us),
+		   atomic_read(&node->lat.slow));
+	print_binder_lat(m, "    ", buf->buckets, buf->total_us);
+}
+
+static void print_binder_proc_lat(struct seq_file *m, struct binder_proc *proc)
+{
+	struct binder_lat_hist *buf;
+	struct rb_node *n;
+
+	if (!proc->lat)
+		return;
+
+	seq_puts(m, "latency:\n");
+	print_binder_lat_percpu(m, "  ", proc->lat);
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (!buf)
+		return;
+	binder_inner_proc_lock(proc);
+	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n))
+		print_binder_node_lat(m, rb_entry(n, struct binder_node,
+						  rb_node), buf);
+	binder_inner_proc_unlock(proc);
+	kfree(buf);
+}
+
+struct binder_lat_top {
+	int pid;
+	int node_debug_id;
+	binder_uintptr_t ptr;
+	char comm[TASK_COMM_LEN];
+	int slow;
+	int max_us;
+	u64 count;
+	u64 total_us;
+};
+
+static bool binder_lat_top_before(struct binder_lat_top *a,
+				  struct binder_lat_top *b)
+{
+	if (a->slow != b->slow)
+		return a->slow > b->slow;
+	return a->max_us > b->max_us;
+}
+
+/* Keeps @top sorted, slowest interface first */
+static void binder_lat_top_insert(struct binder_lat_top *top, int *nr,
+				  struct binder_lat_top *e)
+{
+	int i = *nr;
+
+	if (i == BINDER_LAT_TOP_NODES) {
+		if (!binder_lat_top_before(e, &top[i - 1]))
+			return;
+		i--;
+	} else {
+		(*nr)++;
+	}
+	while (i > 0 && binder_lat_top_before(e, &top[i - 1])) {
+		top[i] = top[i - 1];
+		i--;
+	}
+	top[i] = *e;
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_lat_top *top;
+	struct binder_proc *proc;
+	int nr = 0, i, b;
+
+	seq_puts(m, "binder latency:\n");
+	print_binder_lat_percpu(m, "", &binder_lat_global);
+
+	top = kcalloc(BINDER_LAT_TOP_NODES, sizeof(*top), GFP_KERNEL);
+	if (!top)
+		return -ENOMEM;
+
+	mutex_lock(&binder_procs_lock);
+	hlist_for_each_entry(proc, &binder_procs, proc_node) {
+		struct rb_node *n;
+
+		binder_inner_proc_lock(proc);
+		for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+			struct binder_node *node = rb_entry(n,
+						struct binder_node, rb_node);
+			struct binder_lat_top e;
+
+			e.max_us = atomic_read(&node->lat.max_us);
+			if (!e.max_us)
+				continue;
+			e.pid = proc->pid;
+			e.node_debug_id = node->debug_id;
+			e.ptr = node->ptr;
+			get_task_comm(e.comm, proc->tsk);
+			e.slow = atomic_read(&node->lat.slow);
+			e.count = 0;
+			for (b = 0; b < BINDER_LAT_BUCKETS; b++)
+				e.count += atomic_read(
+				    &node->lat.buckets[BINDER_LAT_SERVICE][b]);
+			e.total_us = atomic64_read(
+				    &node->lat.total_us[BINDER_LAT_SERVICE]);
+			binder_lat_top_insert(top, &nr, &e);
+		}
+		binder_inner_proc_unlock(proc);
+	}
+	mutex_unlock(&binder_procs_lock);
+
+	seq_printf(m, "slowest nodes (service >= %uus):\n", binder_slow_txn_us);
+	for (i = 0; i < nr; i++)
+		seq_printf(m, "  %d:%s node %d u%016llx: slow %d max %dus calls %llu avg %lluus\n",
+			   top[i].pid, top[i].comm, top[i].node_debug_id,
+			   (u64)top[i].ptr, top[i].slow, top[i].max_us,
+			   top[i].count,
+			   top[i].count ?
+			   div64_u64(top[i].total_us, top[i].count) : 0);
+	kfree(top);
+
+	return 0;
+}
+
 static int binder_state_show(struct seq_file *m, void *unused)
 {
 	struct binder_proc *proc;
@@ -5872,6 +6462,7 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 		if (itr->pid == pid) {
 			seq_puts(m, "binder proc state:\n");
 			print_binder_proc(m, itr, 1);
+			print_binder_proc_lat(m, itr);
 		}
 	}
 	mutex_unlock(&binder_procs_lock);
@@ -5941,6 +6532,7 @@ BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
 BINDER_DEBUG_ENTRY(transaction_log);
+BINDER_DEBUG_ENTRY(latency);
 
 static int __init init_binder_device(const char *name)
 {
@@ -6018,6 +6610,11 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    &binder_transaction_log_failed,
 				    &binder_transaction_log_fops);
+		debugfs_create_file("latency",
+				    0444,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 	}
 
 	/*
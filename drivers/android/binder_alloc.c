@@ -28,6 +28,8 @@
 #include <linux/slab.h>
 #include <linux/sched.h>
 #include <linux/list_lru.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
 #include "binder_alloc.h"
 #include "binder_trace.h"
 
@@ -45,6 +47,16 @@ static uint32_t binder_alloc_debug_mask;
 module_param_named(debug_mask, binder_alloc_debug_mask,
 		   uint, S_IWUSR | S_IRUGO);
 
+/*
+ * Size in KB of the head of every binder mapping that is populated as soon
+ * as it is mmapped and kept resident, so that the common small transaction
+ * does not allocate and map pages synchronously. Applies to new mappings.
+ */
+static uint32_t binder_alloc_warm_kb = 8;
+module_param_named(warm_kb, binder_alloc_warm_kb, uint, 0644);
+
+#define BINDER_ALLOC_WARM_RETRY_DELAY	HZ
+
 #define binder_alloc_debug(mask, x...) \
 	do { \
 		if (binder_alloc_debug_mask & mask) \
@@ -87,6 +99,15 @@ static void binder_insert_free_buffer(struct binder_alloc *alloc,
 		     "%d: add free buffer, size %zd, at %pK\n",
 		      alloc->pid, new_buffer_size, new_buffer);
 
+	if (new_buffer_size < BINDER_ALLOC_CLASS_MAX) {
+		unsigned int class = new_buffer_size >> BINDER_ALLOC_CLASS_SHIFT;
+
+		/* LIFO, so the next allocation reuses still-mapped pages */
+		list_add(&new_buffer->free_entry, &alloc->free_classes[class]);
+		__set_bit(class, alloc->free_class_map);
+		return;
+	}
+
 	while (*p) {
 		parent = *p;
 		buffer = rb_entry(parent, struct binder_buffer, rb_node);
@@ -103,6 +124,138 @@ static void binder_insert_free_buffer(struct binder_alloc *alloc,
 	rb_insert_color(&new_buffer->rb_node, &alloc->free_buffers);
 }
 
+/*
+ * Must be called before the size of @buffer changes, i.e. before a
+ * neighbour is split off or merged in, since the size selects the list.
+ */
+static void binder_remove_free_buffer(struct binder_alloc *alloc,
+				      struct binder_buffer *buffer)
+{
+	size_t buffer_size = binder_alloc_buffer_size(alloc, buffer);
+	unsigned int class;
+
+	BUG_ON(!buffer->free);
+
+	if (buffer_size >= BINDER_ALLOC_CLASS_MAX) {
+		rb_erase(&buffer->rb_node, &alloc->free_buffers);
+		return;
+	}
+
+	class = buffer_size >> BINDER_ALLOC_CLASS_SHIFT;
+	list_del(&buffer->free_entry);
+	if (list_empty(&alloc->free_classes[class]))
+		__clear_bit(class, alloc->free_class_map);
+}
+
+/*
+ * Find a free buffer of at least @size bytes. *@fast tells whether it came
+ * off the head of a size-class list, or took a search of a class list or
+ * the rb tree; the caller accounts it once the buffer is really used.
+ */
+static struct binder_buffer *
+binder_alloc_find_free_buffer(struct binder_alloc *alloc, size_t size,
+			      bool *fast)
+{
+	struct rb_node *n = alloc->free_buffers.rb_node;
+	struct binder_buffer *buffer;
+	struct binder_buffer *best_fit = NULL;
+	size_t buffer_size, best_fit_size = 0;
+
+	*fast = true;
+	if (size < BINDER_ALLOC_CLASS_MAX) {
+		unsigned int class = size >> BINDER_ALLOC_CLASS_SHIFT;
+		unsigned int next;
+
+		/*
+		 * Buffers in the same class may still be a little too
+		 * small, so only the head is tried first to stay O(1). Any
+		 * buffer in a higher class is large enough.
+		 */
+		buffer = list_first_entry_or_null(&alloc->free_classes[class],
+						  struct binder_buffer,
+						  free_entry);
+		if (buffer && binder_alloc_buffer_size(alloc, buffer) >= size)
+			return buffer;
+
+		next = find_next_bit(alloc->free_class_map,
+				     BINDER_ALLOC_CLASSES, class + 1);
+		if (next < BINDER_ALLOC_CLASSES)
+			return list_first_entry(&alloc->free_classes[next],
+						struct binder_buffer,
+						free_entry);
+
+		/*
+		 * Nothing larger below BINDER_ALLOC_CLASS_MAX: best fit over
+		 * the rest of our own class before splitting a large buffer
+		 * or failing.
+		 */
+		*fast = false;
+		list_for_each_entry(buffer, &alloc->free_classes[class],
+				    free_entry) {
+			buffer_size = binder_alloc_buffer_size(alloc, buffer);
+			if (buffer_size >= size &&
+			    (!best_fit || buffer_size < best_fit_size)) {
+				best_fit = buffer;
+				best_fit_size = buffer_size;
+			}
+		}
+		if (best_fit)
+			return best_fit;
+	}
+
+	*fast = false;
+	while (n) {
+		buffer = rb_entry(n, struct binder_buffer, rb_node);
+		BUG_ON(!buffer->free);
+		buffer_size = binder_alloc_buffer_size(alloc, buffer);
+
+		if (size < buffer_size) {
+			best_fit = buffer;
+			n = n->rb_left;
+		} else if (size > buffer_size)
+			n = n->rb_right;
+		else {
+			best_fit = buffer;
+			break;
+		}
+	}
+	return best_fit;
+}
+
+static void binder_alloc_free_space(struct binder_alloc *alloc,
+				    size_t *free_buffers,
+				    size_t *total_free_size,
+				    size_t *largest_free_size)
+{
+	struct binder_buffer *buffer;
+	struct rb_node *n;
+	size_t buffer_size;
+	int class;
+
+	*free_buffers = 0;
+	*total_free_size = 0;
+	*largest_free_size = 0;
+
+	for (n = rb_first(&alloc->free_buffers); n != NULL; n = rb_next(n)) {
+		buffer = rb_entry(n, struct binder_buffer, rb_node);
+		buffer_size = binder_alloc_buffer_size(alloc, buffer);
+		(*free_buffers)++;
+		*total_free_size += buffer_size;
+		if (buffer_size > *largest_free_size)
+			*largest_free_size = buffer_size;
+	}
+	for_each_set_bit(class, alloc->free_class_map, BINDER_ALLOC_CLASSES) {
+		list_for_each_entry(buffer, &alloc->free_classes[class],
+				    free_entry) {
+			buffer_size = binder_alloc_buffer_size(alloc, buffer);
+			(*free_buffers)++;
+			*total_free_size += buffer_size;
+			if (buffer_size > *largest_free_size)
+				*largest_free_size = buffer_size;
+		}
+	}
+}
+
 static void binder_insert_allocated_buffer_locked(
 		struct binder_alloc *alloc, struct binder_buffer *new_buffer)
 {
@@ -240,7 +393,7 @@ static int binder_update_page_range(struct binder_alloc *alloc, int allocate,
 			trace_binder_alloc_lru_start(alloc, index);
 
 			on_lru = list_lru_del(&binder_alloc_lru, &page->lru);
-			WARN_ON(!on_lru);
+			WARN_ON(!on_lru && index >= alloc->warm_pages);
 
 			trace_binder_alloc_lru_end(alloc, index);
 			continue;
@@ -301,6 +454,10 @@ free_range:
 		index = (page_addr - alloc->buffer) / PAGE_SIZE;
 		page = &alloc->pages[index];
 
+		/* warm pages stay mapped and off the lru */
+		if (index < alloc->warm_pages)
+			continue;
+
 		trace_binder_free_lru_start(alloc, index);
 
 		ret = list_lru_add(&binder_alloc_lru, &page->lru);
@@ -326,19 +483,44 @@ err_no_vma:
 	return vma ? -ENOMEM : -ESRCH;
 }
 
+static void binder_alloc_warm_work(struct work_struct *work)
+{
+	struct binder_alloc *alloc = container_of(to_delayed_work(work),
+						  struct binder_alloc,
+						  warm_work);
+	int ret;
+
+	mutex_lock(&alloc->mutex);
+	ret = binder_update_page_range(alloc, 1, alloc->buffer,
+				       alloc->buffer +
+				       alloc->warm_pages * PAGE_SIZE);
+	mutex_unlock(&alloc->mutex);
+
+	binder_alloc_debug(BINDER_DEBUG_BUFFER_ALLOC,
+			   "%d: warm %zd pages: %d\n",
+			   alloc->pid, alloc->warm_pages, ret);
+
+	/*
+	 * Pages populated before the failure are kept, so a retry only
+	 * has to fill the rest. -ESRCH means the mapping is going away.
+	 */
+	if (ret == -ENOMEM)
+		queue_delayed_work(system_unbound_wq, &alloc->warm_work,
+				   BINDER_ALLOC_WARM_RETRY_DELAY);
+}
+
 struct binder_buffer *binder_alloc_new_buf_locked(struct binder_alloc *alloc,
 						  size_t data_size,
 						  size_t offsets_size,
 						  size_t extra_buffers_size,
 						  int is_async)
 {
-	struct rb_node *n = alloc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
 	size_t buffer_size;
-	struct rb_node *best_fit = NULL;
 	void *has_page_addr;
 	void *end_page_addr;
 	size_t size, data_offsets_size;
+	bool fast;
 	int ret;
 
 	if (alloc->vma == NULL) {
@@ -374,28 +556,15 @@ struct binder_buffer *binder_alloc_new_buf_locked(struct binder_alloc *alloc,
 	/* Pad 0-size buffers so they get assigned unique addresses */
 	size = max(size, sizeof(void *));
 
-	while (n) {
-		buffer = rb_entry(n, struct binder_buffer, rb_node);
-		BUG_ON(!buffer->free);
-		buffer_size = binder_alloc_buffer_size(alloc, buffer);
-
-		if (size < buffer_size) {
-			best_fit = n;
-			n = n->rb_left;
-		} else if (size > buffer_size)
-			n = n->rb_right;
-		else {
-			best_fit = n;
-			break;
-		}
-	}
-	if (best_fit == NULL) {
+	buffer = binder_alloc_find_free_buffer(alloc, size, &fast);
+	if (buffer == NULL) {
+		struct rb_node *n;
 		size_t allocated_buffers = 0;
 		size_t largest_alloc_size = 0;
 		size_t total_alloc_size = 0;
-		size_t free_buffers = 0;
-		size_t largest_free_size = 0;
-		size_t total_free_size = 0;
+		size_t free_buffers;
+		size_t largest_free_size;
+		size_t total_free_size;
 
 		for (n = rb_first(&alloc->allocated_buffers); n != NULL;
 		     n = rb_next(n)) {
@@ -406,26 +575,17 @@ struct binder_buffer *binder_alloc_new_buf_locked(struct binder_alloc *alloc,
 			if (buffer_size > largest_alloc_size)
 				largest_alloc_size = buffer_size;
 		}
-		for (n = rb_first(&alloc->free_buffers); n != NULL;
-		     n = rb_next(n)) {
-			buffer = rb_entry(n, struct binder_buffer, rb_node);
-			buffer_size = binder_alloc_buffer_size(alloc, buffer);
-			free_buffers++;
-			total_free_size += buffer_size;
-			if (buffer_size > largest_free_size)
-				largest_free_size = buffer_size;
-		}
+		binder_alloc_free_space(alloc, &free_buffers, &total_free_size,
+					&largest_free_size);
 		pr_err("%d: binder_alloc_buf size %zd failed, no address space\n",
 			alloc->pid, size);
 		pr_err("allocated: %zd (num: %zd largest: %zd), free: %zd (num: %zd largest: %zd)\n",
 		       total_alloc_size, allocated_buffers, largest_alloc_size,
 		       total_free_size, free_buffers, largest_free_size);
+		alloc->stats.failed_allocs++;
 		return ERR_PTR(-ENOSPC);
 	}
-	if (n == NULL) {
-		buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
-		buffer_size = binder_alloc_buffer_size(alloc, buffer);
-	}
+	buffer_size = binder_alloc_buffer_size(alloc, buffer);
 
 	binder_alloc_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "%d: binder_alloc_buf size %zd got buffer %pK size %zd\n",
@@ -433,7 +593,6 @@ struct binder_buffer *binder_alloc_new_buf_locked(struct binder_alloc *alloc,
 
 	has_page_addr =
 		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK);
-	WARN_ON(n && buffer_size != size);
 	end_page_addr =
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data + size);
 	if (end_page_addr > has_page_addr)
@@ -443,6 +602,7 @@ struct binder_buffer *binder_alloc_new_buf_locked(struct binder_alloc *alloc,
 	if (ret)
 		return ERR_PTR(ret);
 
+	binder_remove_free_buffer(alloc, buffer);
 	if (buffer_size != size) {
 		struct binder_buffer *new_buffer;
 
@@ -450,6 +610,7 @@ struct binder_buffer *binder_alloc_new_buf_locked(struct binder_alloc *alloc,
 		if (!new_buffer) {
 			pr_err("%s: %d failed to alloc new buffer struct\n",
 			       __func__, alloc->pid);
+			binder_insert_free_buffer(alloc, buffer);
 			goto err_alloc_buf_struct_failed;
 		}
 		new_buffer->data = (u8 *)buffer->data + size;
@@ -458,7 +619,11 @@ struct binder_buffer *binder_alloc_new_buf_locked(struct binder_alloc *alloc,
 		binder_insert_free_buffer(alloc, new_buffer);
 	}
 
-	rb_erase(best_fit, &alloc->free_buffers);
+	if (fast)
+		alloc->stats.fast_allocs++;
+	else
+		alloc->stats.slow_allocs++;
+
 	buffer->free = 0;
 	buffer->allow_user_free = 0;
 	binder_insert_allocated_buffer_locked(alloc, buffer);
@@ -506,10 +671,17 @@ struct binder_buffer *binder_alloc_new_buf(struct binder_alloc *alloc,
 					   int is_async)
 {
 	struct binder_buffer *buffer;
+	u64 start, delta;
 
 	mutex_lock(&alloc->mutex);
+	start = local_clock();
 	buffer = binder_alloc_new_buf_locked(alloc, data_size, offsets_size,
 					     extra_buffers_size, is_async);
+	delta = local_clock() - start;
+	alloc->stats.alloc_count++;
+	alloc->stats.alloc_ns += delta;
+	if (delta > alloc->stats.alloc_ns_max)
+		alloc->stats.alloc_ns_max = delta;
 	mutex_unlock(&alloc->mutex);
 	return buffer;
 }
@@ -609,7 +781,7 @@ static void binder_free_buf_locked(struct binder_alloc *alloc,
 		struct binder_buffer *next = binder_buffer_next(buffer);
 
 		if (next->free) {
-			rb_erase(&next->rb_node, &alloc->free_buffers);
+			binder_remove_free_buffer(alloc, next);
 			binder_delete_free_buffer(alloc, next);
 		}
 	}
@@ -617,8 +789,8 @@ static void binder_free_buf_locked(struct binder_alloc *alloc,
 		struct binder_buffer *prev = binder_buffer_prev(buffer);
 
 		if (prev->free) {
+			binder_remove_free_buffer(alloc, prev);
 			binder_delete_free_buffer(alloc, buffer);
-			rb_erase(&prev->rb_node, &alloc->free_buffers);
 			buffer = prev;
 		}
 	}
@@ -712,12 +884,23 @@ int binder_alloc_mmap_handler(struct binder_alloc *alloc,
 	buffer->free = 1;
 	binder_insert_free_buffer(alloc, buffer);
 	alloc->free_async_space = alloc->buffer_size / 2;
+	alloc->warm_pages = min_t(size_t,
+				  ((size_t)binder_alloc_warm_kb << 10) >>
+				  PAGE_SHIFT,
+				  alloc->buffer_size / PAGE_SIZE);
 	barrier();
 	alloc->vma = vma;
 	alloc->vma_vm_mm = vma->vm_mm;
 	/* Same as mmgrab() in later kernel versions */
 	atomic_inc(&alloc->vma_vm_mm->mm_count);
 
+	/*
+	 * The caller holds mmap_sem for writing, which populating the
+	 * pages needs for reading, so do it from a worker.
+	 */
+	if (alloc->warm_pages)
+		queue_delayed_work(system_unbound_wq, &alloc->warm_work, 0);
+
 	return 0;
 
 err_alloc_buf_struct_failed:
@@ -744,6 +927,8 @@ void binder_alloc_deferred_release(struct binder_alloc *alloc)
 
 	BUG_ON(alloc->vma);
 
+	cancel_delayed_work_sync(&alloc->warm_work);
+
 	buffers = 0;
 	mutex_lock(&alloc->mutex);
 	while ((n = rb_first(&alloc->allocated_buffers))) {
@@ -843,6 +1028,7 @@ void binder_alloc_print_pages(struct seq_file *m,
 	int active = 0;
 	int lru = 0;
 	int free = 0;
+	int warm = 0;
 
 	mutex_lock(&alloc->mutex);
 	for (i = 0; i < alloc->buffer_size / PAGE_SIZE; i++) {
@@ -853,10 +1039,56 @@ void binder_alloc_print_pages(struct seq_file *m,
 			active++;
 		else
 			lru++;
+		if (page->page_ptr && i < alloc->warm_pages)
+			warm++;
 	}
 	mutex_unlock(&alloc->mutex);
 	seq_printf(m, "  pages: %d:%d:%d\n", active, lru, free);
 	seq_printf(m, "  pages high watermark: %zu\n", alloc->pages_high);
+	seq_printf(m, "  pages warm: %d/%zu\n", warm, alloc->warm_pages);
+}
+
+/**
+ * binder_alloc_print_stats() - print allocator statistics
+ * @m:     seq_file for output via seq_printf()
+ * @alloc: binder_alloc for this proc
+ *
+ * Prints free space fragmentation, the occupancy of the size-class free
+ * lists and fast/slow path allocation counts and latency.
+ */
+void binder_alloc_print_stats(struct seq_file *m,
+			      struct binder_alloc *alloc)
+{
+	struct binder_alloc_stats *stats = &alloc->stats;
+	struct binder_buffer *buffer;
+	size_t free_buffers, total_free_size, largest_free_size;
+	int class;
+
+	mutex_lock(&alloc->mutex);
+	binder_alloc_free_space(alloc, &free_buffers, &total_free_size,
+				&largest_free_size);
+	seq_printf(m, "  free space: %zd (num: %zd largest: %zd) fragmentation: %zd%%\n",
+		   total_free_size, free_buffers, largest_free_size,
+		   total_free_size ?
+		   100 - largest_free_size * 100 / total_free_size : 0);
+	seq_puts(m, "  free classes:");
+	for_each_set_bit(class, alloc->free_class_map, BINDER_ALLOC_CLASSES) {
+		int count = 0;
+
+		list_for_each_entry(buffer, &alloc->free_classes[class],
+				    free_entry)
+			count++;
+		seq_printf(m, " %d:%d", class << BINDER_ALLOC_CLASS_SHIFT,
+			   count);
+	}
+	seq_puts(m, "\n");
+	seq_printf(m, "  allocs: fast %llu slow %llu failed %llu latency avg %llu max %llu ns\n",
+		   stats->fast_allocs, stats->slow_allocs,
+		   stats->failed_allocs,
+		   stats->alloc_count ?
+		   div64_u64(stats->alloc_ns, stats->alloc_count) : 0,
+		   stats->alloc_ns_max);
+	mutex_unlock(&alloc->mutex);
 }
 
 /**
@@ -1000,9 +1232,15 @@ static struct shrinker binder_shrinker = {
  */
 void binder_alloc_init(struct binder_alloc *alloc)
 {
+	int i;
+
 	alloc->pid = current->group_leader->pid;
 	mutex_init(&alloc->mutex);
 	INIT_LIST_HEAD(&alloc->buffers);
+	for (i = 0; i < BINDER_ALLOC_CLASSES; i++)
+		INIT_LIST_HEAD(&alloc->free_classes[i]);
+	bitmap_zero(alloc->free_class_map, BINDER_ALLOC_CLASSES);
+	INIT_DELAYED_WORK(&alloc->warm_work, binder_alloc_warm_work);
 }
 
 int binder_alloc_shrinker_init(void)
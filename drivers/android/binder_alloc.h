@@ -17,11 +17,13 @@
 
 #include <linux/rbtree.h>
 #include <linux/list.h>
+#include <linux/bitmap.h>
 #include <linux/mm.h>
 #include <linux/rtmutex.h>
 #include <linux/vmalloc.h>
 #include <linux/slab.h>
 #include <linux/list_lru.h>
+#include <linux/workqueue.h>
 
 extern struct list_lru binder_alloc_lru;
 struct binder_transaction;
@@ -30,6 +32,8 @@ struct binder_transaction;
  * struct binder_buffer - buffer used for binder transactions
  * @entry:              entry alloc->buffers
  * @rb_node:            node for allocated_buffers/free_buffers rb trees
+ * @free_entry:         entry in one of alloc->free_classes, used instead of
+ *                      @rb_node for free buffers below BINDER_ALLOC_CLASS_MAX
  * @free:               true if buffer is free
  * @allow_user_free:    describe the second member of struct blah,
  * @async_transaction:  describe the second member of struct blah,
@@ -45,8 +49,11 @@ struct binder_transaction;
  */
 struct binder_buffer {
 	struct list_head entry; /* free and allocated entries by address */
-	struct rb_node rb_node; /* free entry by size or allocated entry */
-				/* by address */
+	union {
+		struct rb_node rb_node; /* free entry by size or allocated */
+					/* entry by address */
+		struct list_head free_entry; /* small free entry by class */
+	};
 	unsigned free:1;
 	unsigned allow_user_free:1;
 	unsigned async_transaction:1;
@@ -73,6 +80,38 @@ struct binder_lru_page {
 	struct binder_alloc *alloc;
 };
 
+/*
+ * Free buffers smaller than BINDER_ALLOC_CLASS_MAX are kept on segregated
+ * lists, one per BINDER_ALLOC_CLASS_SHIFT sized class, instead of in the
+ * free_buffers rb tree. Small parcels dominate binder traffic, so most
+ * allocations and frees become a list operation plus a bitmap lookup.
+ */
+#define BINDER_ALLOC_CLASS_SHIFT	6
+#define BINDER_ALLOC_CLASS_MAX		4096
+#define BINDER_ALLOC_CLASSES \
+	(BINDER_ALLOC_CLASS_MAX >> BINDER_ALLOC_CLASS_SHIFT)
+
+/**
+ * struct binder_alloc_stats - allocator statistics for a proc
+ * @fast_allocs:   allocations served from the head of a size-class list
+ * @slow_allocs:   allocations that searched a size-class list or the
+ *                 free_buffers rb tree
+ * @failed_allocs: allocations that found no free buffer large enough
+ * @alloc_count:   calls to binder_alloc_new_buf()
+ * @alloc_ns:      total time spent allocating, in ns
+ * @alloc_ns_max:  longest single allocation, in ns
+ *
+ * Protected by binder_alloc->mutex
+ */
+struct binder_alloc_stats {
+	u64 fast_allocs;
+	u64 slow_allocs;
+	u64 failed_allocs;
+	u64 alloc_count;
+	u64 alloc_ns;
+	u64 alloc_ns_max;
+};
+
 /**
  * struct binder_alloc - per-binder proc state for binder allocator
  * @vma:                vm_area_struct passed to mmap_handler
@@ -84,7 +123,10 @@ struct binder_lru_page {
  * @user_buffer_offset: offset between user and kernel VAs for buffer
  * @buffers:            list of all buffers for this proc
  * @free_buffers:       rb tree of buffers available for allocation
- *                      sorted by size
+ *                      sorted by size (BINDER_ALLOC_CLASS_MAX and larger)
+ * @free_classes:       lists of free buffers smaller than
+ *                      BINDER_ALLOC_CLASS_MAX, indexed by size class
+ * @free_class_map:     bitmap of non-empty @free_classes
  * @allocated_buffers:  rb tree of allocated buffers sorted by address
  * @free_async_space:   VA space available for async buffers. This is
  *                      initialized at mmap time to 1/2 the full VA space
@@ -92,6 +134,12 @@ struct binder_lru_page {
  * @buffer_size:        size of address space specified via mmap
  * @pid:                pid for associated binder_proc (invariant after init)
  * @pages_high:         high watermark of offset in @pages
+ * @warm_pages:         number of pages at the start of the mapping that are
+ *                      populated ahead of time and never handed to the
+ *                      shrinker (invariant after mmap)
+ * @warm_work:          populates the first @warm_pages pages, retried
+ *                      while memory is short
+ * @stats:              allocation statistics
  *
  * Bookkeeping structure for per-proc address space management for binder
  * buffers. It is normally initialized during binder_init() and binder_mmap()
@@ -106,6 +154,8 @@ struct binder_alloc {
 	ptrdiff_t user_buffer_offset;
 	struct list_head buffers;
 	struct rb_root free_buffers;
+	struct list_head free_classes[BINDER_ALLOC_CLASSES];
+	DECLARE_BITMAP(free_class_map, BINDER_ALLOC_CLASSES);
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 	struct binder_lru_page *pages;
@@ -113,6 +163,9 @@ struct binder_alloc {
 	uint32_t buffer_free;
 	int pid;
 	size_t pages_high;
+	size_t warm_pages;
+	struct delayed_work warm_work;
+	struct binder_alloc_stats stats;
 };
 
 #ifdef CONFIG_ANDROID_BINDER_IPC_SELFTEST
@@ -144,6 +197,8 @@ extern void binder_alloc_print_allocated(struct seq_file *m,
 					 struct binder_alloc *alloc);
 void binder_alloc_print_pages(struct seq_file *m,
 			      struct binder_alloc *alloc);
+void binder_alloc_print_stats(struct seq_file *m,
+			      struct binder_alloc *alloc);
 
 /**
  * binder_alloc_get_free_async_space() - get free space available for async
@@ -146,7 +146,7 @@ static void binder_selftest_free_buf(struct binder_alloc *alloc,
 	for (i = 0; i < BUFFER_NUM; i++)
 		binder_alloc_free_buf(alloc, buffers[seq[i]]);
 
-	for (i = 0; i < end / PAGE_SIZE; i++) {
+	for (i = alloc->warm_pages; i < end / PAGE_SIZE; i++) {
 		/**
 		 * Error message on a free page can be false positive
 		 * if binder shrinker ran during binder_alloc_free_buf
@@ -171,7 +171,7 @@ static void binder_selftest_free_page(struct binder_alloc *alloc)
 			      NULL, count);
 	}
 
-	for (i = 0; i < (alloc->buffer_size / PAGE_SIZE); i++) {
+	for (i = alloc->warm_pages; i < (alloc->buffer_size / PAGE_SIZE); i++) {
 		if (alloc->pages[i].page_ptr) {
 			pr_err("expect free but is %s at page index %d\n",
 			       list_empty(&alloc->pages[i].lru) ?
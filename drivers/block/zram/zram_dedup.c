@@ -0,0 +1,188 @@
+/*
+ * Compressed RAM block device - deduplication of compressed pages
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/* One bucket per 64 pages of disk, bounded to keep the array small */
+#define ZRAM_HASH_SHIFT		6
+#define ZRAM_HASH_SIZE_MIN	(1 << 8)
+#define ZRAM_HASH_SIZE_MAX	(1 << 16)
+
+u32 zram_dedup_checksum(const unsigned char *mem, size_t len)
+{
+	return jhash(mem, len, 0);
+}
+
+static struct zram_hash *zram_dedup_hash(struct zram_meta *meta, u32 checksum)
+{
+	return &meta->hash[checksum & (meta->hash_size - 1)];
+}
+
+static bool zram_dedup_match(struct zram_meta *meta, struct zram_entry *entry,
+			const unsigned char *mem, size_t len)
+{
+	unsigned char *cmem;
+	bool match;
+
+	if (entry->len != len)
+		return false;
+
+	cmem = zs_map_object(meta->mem_pool, entry->handle, ZS_MM_RO);
+	match = !memcmp(cmem, mem, len);
+	zs_unmap_object(meta->mem_pool, entry->handle);
+
+	return match;
+}
+
+/*
+ * Look for an already stored object with the same compressed contents.
+ * On success the entry is returned with an extra reference held for the
+ * caller's slot.
+ */
+struct zram_entry *zram_dedup_find(struct zram_meta *meta,
+			const unsigned char *mem, size_t len, u32 checksum)
+{
+	struct zram_hash *hash = zram_dedup_hash(meta, checksum);
+	struct zram_entry *entry;
+	struct rb_node *rb_node;
+
+	spin_lock(&hash->lock);
+	rb_node = hash->rb_root.rb_node;
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (checksum == entry->checksum)
+			break;
+		rb_node = checksum < entry->checksum ?
+				rb_node->rb_left : rb_node->rb_right;
+	}
+
+	if (!rb_node)
+		goto miss;
+
+	/* equal checksums may hang off either side, rewind to the first */
+	while (rb_prev(rb_node)) {
+		entry = rb_entry(rb_prev(rb_node), struct zram_entry, rb_node);
+		if (entry->checksum != checksum)
+			break;
+		rb_node = rb_prev(rb_node);
+	}
+
+	for (; rb_node; rb_node = rb_next(rb_node)) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (entry->checksum != checksum)
+			break;
+
+		if (zram_dedup_match(meta, entry, mem, len)) {
+			entry->refcount++;
+			spin_unlock(&hash->lock);
+			return entry;
+		}
+	}
+miss:
+	spin_unlock(&hash->lock);
+	return NULL;
+}
+
+/*
+ * Wrap a freshly stored zsmalloc object so later writes can share it.
+ * Returns NULL if the entry cannot be allocated; the caller then keeps
+ * the bare handle.
+ */
+struct zram_entry *zram_dedup_insert(struct zram_meta *meta,
+			unsigned long handle, size_t len, u32 checksum)
+{
+	struct zram_hash *hash = zram_dedup_hash(meta, checksum);
+	struct zram_entry *entry, *cur;
+	struct rb_node **rb_node, *parent = NULL;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO | __GFP_NOWARN);
+	if (!entry)
+		return NULL;
+
+	entry->handle = handle;
+	entry->len = len;
+	entry->checksum = checksum;
+	entry->refcount = 1;
+
+	spin_lock(&hash->lock);
+	rb_node = &hash->rb_root.rb_node;
+	while (*rb_node) {
+		parent = *rb_node;
+		cur = rb_entry(parent, struct zram_entry, rb_node);
+		if (checksum < cur->checksum)
+			rb_node = &parent->rb_left;
+		else
+			rb_node = &parent->rb_right;
+	}
+	rb_link_node(&entry->rb_node, parent, rb_node);
+	rb_insert_color(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+
+	return entry;
+}
+
+/*
+ * Drop a slot's reference. Returns true if this was the last one, in
+ * which case the zsmalloc object and the entry have been freed.
+ */
+bool zram_dedup_put(struct zram_meta *meta, struct zram_entry *entry)
+{
+	struct zram_hash *hash = zram_dedup_hash(meta, entry->checksum);
+
+	spin_lock(&hash->lock);
+	if (--entry->refcount) {
+		spin_unlock(&hash->lock);
+		return false;
+	}
+	rb_erase(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+
+	zs_free(meta->mem_pool, entry->handle);
+	kfree(entry);
+	return true;
+}
+
+int zram_dedup_init(struct zram_meta *meta, size_t num_pages)
+{
+	size_t i;
+
+	meta->hash_size = clamp_t(size_t, num_pages >> ZRAM_HASH_SHIFT,
+				ZRAM_HASH_SIZE_MIN, ZRAM_HASH_SIZE_MAX);
+	meta->hash_size = roundup_pow_of_two(meta->hash_size);
+	meta->hash = vzalloc(meta->hash_size * sizeof(struct zram_hash));
+	if (!meta->hash) {
+		pr_err("Error allocating zram entry hash\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < meta->hash_size; i++) {
+		spin_lock_init(&meta->hash[i].lock);
+		meta->hash[i].rb_root = RB_ROOT;
+	}
+
+	return 0;
+}
+
+void zram_dedup_fini(struct zram_meta *meta)
+{
+	vfree(meta->hash);
+	meta->hash = NULL;
+	meta->hash_size = 0;
+}
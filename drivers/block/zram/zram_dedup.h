@@ -0,0 +1,80 @@
+/*
+ * Compressed RAM block device - deduplication of compressed pages
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+
+struct zram_meta;
+
+/*
+ * A compressed object that may be shared by several slots. Slots that
+ * point to one of these carry ZRAM_DEDUP and keep the entry, not the
+ * zsmalloc handle, in their table handle field.
+ */
+struct zram_entry {
+	struct rb_node rb_node;
+	u32 len;
+	u32 checksum;
+	unsigned long refcount;
+	unsigned long handle;
+};
+
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
+#ifdef CONFIG_ZRAM_DEDUP
+u32 zram_dedup_checksum(const unsigned char *mem, size_t len);
+struct zram_entry *zram_dedup_find(struct zram_meta *meta,
+			const unsigned char *mem, size_t len, u32 checksum);
+struct zram_entry *zram_dedup_insert(struct zram_meta *meta,
+			unsigned long handle, size_t len, u32 checksum);
+bool zram_dedup_put(struct zram_meta *meta, struct zram_entry *entry);
+
+int zram_dedup_init(struct zram_meta *meta, size_t num_pages);
+void zram_dedup_fini(struct zram_meta *meta);
+#else
+static inline u32 zram_dedup_checksum(const unsigned char *mem, size_t len)
+{
+	return 0;
+}
+
+static inline struct zram_entry *zram_dedup_find(struct zram_meta *meta,
+			const unsigned char *mem, size_t len, u32 checksum)
+{
+	return NULL;
+}
+
+static inline struct zram_entry *zram_dedup_insert(struct zram_meta *meta,
+			unsigned long handle, size_t len, u32 checksum)
+{
+	return NULL;
+}
+
+static inline bool zram_dedup_put(struct zram_meta *meta,
+			struct zram_entry *entry)
+{
+	return true;
+}
+
+static inline int zram_dedup_init(struct zram_meta *meta, size_t num_pages)
+{
+	return 0;
+}
+
+static inline void zram_dedup_fini(struct zram_meta *meta) {}
+#endif
+
+#endif /* _ZRAM_DEDUP_H_ */
@@ -30,6 +30,10 @@
 #include <linux/err.h>
 #include <linux/idr.h>
 #include <linux/sysfs.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/debugfs.h>
 
 #include "zram_drv.h"
 
@@ -74,7 +78,21 @@ static inline struct zram *dev_to_zram(struct device *dev)
 	return (struct zram *)dev_to_disk(dev)->private_data;
 }
 
-/* flag operations require table entry bit_spin_lock() being held */
+/*
+ * Every slot is protected by a bit spinlock embedded in its own value
+ * word, so I/O to different slots never contends on a shared lock.
+ */
+static void zram_slot_lock(struct zram_meta *meta, u32 index)
+{
+	bit_spin_lock(ZRAM_LOCK, &meta->table[index].value);
+}
+
+static void zram_slot_unlock(struct zram_meta *meta, u32 index)
+{
+	bit_spin_unlock(ZRAM_LOCK, &meta->table[index].value);
+}
+
+/* flag operations require the slot lock being held */
 static int zram_test_flag(struct zram_meta *meta, u32 index,
 			enum zram_pageflags flag)
 {
@@ -106,6 +124,16 @@ static void zram_set_obj_size(struct zram_meta *meta,
 	meta->table[index].value = (flags << ZRAM_FLAG_SHIFT) | size;
 }
 
+/* the slot was read or written, caller holds the slot lock */
+static void zram_accessed(struct zram_meta *meta, u32 index)
+{
+	zram_clear_flag(meta, index, ZRAM_IDLE);
+	zram_clear_flag(meta, index, ZRAM_RECOMP_AGED);
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+	meta->table[index].ac_time = ktime_get_boottime();
+#endif
+}
+
 static inline bool is_partial_io(struct bio_vec *bvec)
 {
 	return bvec->bv_len != PAGE_SIZE;
@@ -172,21 +200,6 @@ static bool page_zero_filled(void *ptr)
 	return true;
 }
 
-static void handle_zero_page(struct bio_vec *bvec)
-{
-	struct page *page = bvec->bv_page;
-	void *user_mem;
-
-	user_mem = kmap_atomic(page);
-	if (is_partial_io(bvec))
-		memset(user_mem + bvec->bv_offset, 0, bvec->bv_len);
-	else
-		clear_page(user_mem);
-	kunmap_atomic(user_mem);
-
-	flush_dcache_page(page);
-}
-
 static ssize_t initstate_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -293,73 +306,757 @@ static ssize_t mem_used_max_store(struct device *dev,
 	if (err || val != 0)
 		return -EINVAL;
 
-	down_read(&zram->init_lock);
-	if (init_done(zram)) {
-		struct zram_meta *meta = zram->meta;
-		atomic_long_set(&zram->stats.max_used_pages,
-				zs_get_total_pages(meta->mem_pool));
+	down_read(&zram->init_lock);
+	if (init_done(zram)) {
+		struct zram_meta *meta = zram->meta;
+		atomic_long_set(&zram->stats.max_used_pages,
+				zs_get_total_pages(meta->mem_pool));
+	}
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t max_comp_streams_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	deprecated_attr_warn("max_comp_streams");
+	return scnprintf(buf, PAGE_SIZE, "%d\n", num_online_cpus());
+}
+
+static ssize_t max_comp_streams_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	/*
+	 * Compression streams are per-CPU and follow CPU hotplug,
+	 * there is nothing left to tune here.
+	 */
+	deprecated_attr_warn("max_comp_streams");
+	return len;
+}
+
+static ssize_t comp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	size_t sz;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	sz = zcomp_available_show(zram->compressor, buf);
+	up_read(&zram->init_lock);
+
+	return sz;
+}
+
+static ssize_t comp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	size_t sz;
+
+	if (!zcomp_available_algorithm(buf))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change algorithm for initialized device\n");
+		return -EBUSY;
+	}
+	strlcpy(zram->compressor, buf, sizeof(zram->compressor));
+
+	/* ignore trailing newline */
+	sz = strlen(zram->compressor);
+	if (sz > 0 && zram->compressor[sz - 1] == '\n')
+		zram->compressor[sz - 1] = 0x00;
+
+	up_write(&zram->init_lock);
+	return len;
+}
+
+#ifdef CONFIG_ZRAM_DEDUP
+static ssize_t use_dedup_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	bool val;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	val = zram->use_dedup;
+	up_read(&zram->init_lock);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", (int)val);
+}
+
+static ssize_t use_dedup_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int val;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (kstrtoint(buf, 10, &val) || (val != 0 && val != 1))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change dedup usage for initialized device\n");
+		return -EBUSY;
+	}
+	zram->use_dedup = val;
+	up_write(&zram->init_lock);
+	return len;
+}
+
+static DEVICE_ATTR_RW(use_dedup);
+#endif
+
+static ssize_t compact_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_meta *meta;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		up_read(&zram->init_lock);
+		return -EINVAL;
+	}
+
+	meta = zram->meta;
+	zs_compact(meta->mem_pool);
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
+/*
+ * Mark every stored slot ZRAM_IDLE. Reads and writes clear the mark, so
+ * the slots still marked on the next "all" were not accessed in between.
+ */
+static ssize_t idle_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_meta *meta;
+	unsigned long nr_pages, index;
+
+	if (!sysfs_streq(buf, "all"))
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		up_read(&zram->init_lock);
+		return -EINVAL;
+	}
+
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		zram_slot_lock(meta, index);
+		if ((meta->table[index].handle ||
+				zram_test_flag(meta, index, ZRAM_ZERO)) &&
+				!zram_test_flag(meta, index, ZRAM_WB))
+			zram_set_flag(meta, index, ZRAM_IDLE);
+		zram_slot_unlock(meta, index);
+		cond_resched();
+	}
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t io_stat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	ret = scnprintf(buf, PAGE_SIZE,
+			"%8llu %8llu %8llu %8llu\n",
+			(u64)atomic64_read(&zram->stats.failed_reads),
+			(u64)atomic64_read(&zram->stats.failed_writes),
+			(u64)atomic64_read(&zram->stats.invalid_io),
+			(u64)atomic64_read(&zram->stats.notify_free));
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
+static ssize_t mm_stat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zs_pool_stats pool_stats;
+	u64 orig_size, mem_used = 0;
+	long max_used;
+	ssize_t ret;
+
+	memset(&pool_stats, 0x00, sizeof(struct zs_pool_stats));
+
+	down_read(&zram->init_lock);
+	if (init_done(zram)) {
+		mem_used = zs_get_total_pages(zram->meta->mem_pool);
+		zs_pool_stats(zram->meta->mem_pool, &pool_stats);
+	}
+
+	orig_size = atomic64_read(&zram->stats.pages_stored);
+	max_used = atomic_long_read(&zram->stats.max_used_pages);
+
+	ret = scnprintf(buf, PAGE_SIZE,
+			"%8llu %8llu %8llu %8lu %8ld %8llu %8lu %8llu %8llu\n",
+			orig_size << PAGE_SHIFT,
+			(u64)atomic64_read(&zram->stats.compr_data_size),
+			mem_used << PAGE_SHIFT,
+			zram->limit_pages << PAGE_SHIFT,
+			max_used << PAGE_SHIFT,
+			(u64)atomic64_read(&zram->stats.zero_pages),
+			pool_stats.pages_compacted,
+			(u64)atomic64_read(&zram->stats.dup_data_size),
+			(u64)atomic64_read(&zram->stats.meta_data_size));
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
+static DEVICE_ATTR_RO(io_stat);
+static DEVICE_ATTR_RO(mm_stat);
+ZRAM_ATTR_RO(num_reads);
+ZRAM_ATTR_RO(num_writes);
+ZRAM_ATTR_RO(failed_reads);
+ZRAM_ATTR_RO(failed_writes);
+ZRAM_ATTR_RO(invalid_io);
+ZRAM_ATTR_RO(notify_free);
+ZRAM_ATTR_RO(zero_pages);
+ZRAM_ATTR_RO(compr_data_size);
+
+static void zram_free_page(struct zram *zram, size_t index);
+static int zram_decompress_page(struct zram *zram, char *mem, u32 index);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static void reset_bdev(struct zram *zram)
+{
+	struct block_device *bdev;
+
+	if (!zram->backing_dev)
+		return;
+
+	bdev = zram->bdev;
+	if (zram->old_block_size)
+		set_blocksize(bdev, zram->old_block_size);
+	blkdev_put(bdev, FMODE_READ|FMODE_WRITE|FMODE_EXCL);
+	/* hope filp_close flush all of IO */
+	filp_close(zram->backing_dev, NULL);
+	zram->backing_dev = NULL;
+	zram->old_block_size = 0;
+	zram->bdev = NULL;
+
+	vfree(zram->bitmap);
+	zram->bitmap = NULL;
+}
+
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct file *file;
+	char *p;
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	file = zram->backing_dev;
+	if (!file) {
+		up_read(&zram->init_lock);
+		return scnprintf(buf, PAGE_SIZE, "none\n");
+	}
+
+	p = file_path(file, buf, PAGE_SIZE - 1);
+	if (IS_ERR(p)) {
+		ret = PTR_ERR(p);
+		goto out;
+	}
+
+	ret = strlen(p);
+	memmove(buf, p, ret);
+	buf[ret++] = '\n';
+out:
+	up_read(&zram->init_lock);
+	return ret;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	char *file_name;
+	size_t sz;
+	struct file *backing_dev = NULL;
+	struct inode *inode;
+	struct address_space *mapping;
+	unsigned int old_block_size = 0;
+	unsigned long nr_pages, *bitmap = NULL;
+	struct block_device *bdev = NULL;
+	int err;
+	struct zram *zram = dev_to_zram(dev);
+
+	file_name = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!file_name)
+		return -ENOMEM;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		pr_info("Can't setup backing device for initialized device\n");
+		err = -EBUSY;
+		goto out;
+	}
+
+	strlcpy(file_name, buf, PATH_MAX);
+	/* ignore trailing newline */
+	sz = strlen(file_name);
+	if (sz > 0 && file_name[sz - 1] == '\n')
+		file_name[sz - 1] = 0x00;
+
+	backing_dev = filp_open(file_name, O_RDWR|O_LARGEFILE, 0);
+	if (IS_ERR(backing_dev)) {
+		err = PTR_ERR(backing_dev);
+		backing_dev = NULL;
+		goto out;
+	}
+
+	mapping = backing_dev->f_mapping;
+	inode = mapping->host;
+
+	/* Support only block device in this moment */
+	if (!S_ISBLK(inode->i_mode)) {
+		err = -ENOTBLK;
+		goto out;
+	}
+
+	bdev = bdgrab(I_BDEV(inode));
+	err = blkdev_get(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (err < 0) {
+		bdev = NULL;
+		goto out;
+	}
+
+	nr_pages = i_size_read(inode) >> PAGE_SHIFT;
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	old_block_size = block_size(bdev);
+	err = set_blocksize(bdev, PAGE_SIZE);
+	if (err)
+		goto out;
+
+	reset_bdev(zram);
+
+	zram->old_block_size = old_block_size;
+	zram->bdev = bdev;
+	zram->backing_dev = backing_dev;
+	zram->bitmap = bitmap;
+	zram->nr_pages = nr_pages;
+	up_write(&zram->init_lock);
+
+	pr_info("setup backing device %s\n", file_name);
+	kfree(file_name);
+
+	return len;
+out:
+	vfree(bitmap);
+
+	if (bdev)
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+
+	if (backing_dev)
+		filp_close(backing_dev, NULL);
+
+	up_write(&zram->init_lock);
+
+	kfree(file_name);
+
+	return err;
+}
+
+/*
+ * Grab a free block on the backing device, 0 means the device is full.
+ * Bit 0 is never handed out so that a zero handle still means "empty".
+ */
+static unsigned long alloc_block_bdev(struct zram *zram)
+{
+	unsigned long blk_idx = 1;
+retry:
+	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_pages, blk_idx);
+	if (blk_idx >= zram->nr_pages)
+		return 0;
+
+	if (test_and_set_bit(blk_idx, zram->bitmap))
+		goto retry;
+
+	atomic64_inc(&zram->stats.bd_count);
+	return blk_idx;
+}
+
+static void free_block_bdev(struct zram *zram, unsigned long blk_idx)
+{
+	int was_set;
+
+	was_set = test_and_clear_bit(blk_idx, zram->bitmap);
+	WARN_ON_ONCE(!was_set);
+	atomic64_dec(&zram->stats.bd_count);
+}
+
+struct zram_work {
+	struct work_struct work;
+	struct zram *zram;
+	unsigned long entry;
+	struct page *page;
+	int error;
+};
+
+static void zram_sync_read(struct work_struct *work)
+{
+	struct zram_work *zw = container_of(work, struct zram_work, work);
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio) {
+		zw->error = -ENOMEM;
+		return;
+	}
+
+	bio->bi_iter.bi_sector = zw->entry * (PAGE_SIZE >> SECTOR_SHIFT);
+	bio->bi_bdev = zw->zram->bdev;
+	bio_add_page(bio, zw->page, PAGE_SIZE, 0);
+	zw->error = submit_bio_wait(READ, bio);
+	bio_put(bio);
+}
+
+/*
+ * Block layer want one ->make_request_fn to be active at a time so if we
+ * submit a bio to the backing device and wait for it from our own
+ * make_request context, it is never dispatched. To avoid the deadlock,
+ * do the read from worker thread context.
+ */
+static int read_from_bdev(struct zram *zram, char *mem, unsigned long entry)
+{
+	struct zram_work work;
+	void *src;
+
+	work.page = alloc_page(GFP_NOIO);
+	if (!work.page)
+		return -ENOMEM;
+
+	work.zram = zram;
+	work.entry = entry;
+	work.error = 0;
+
+	INIT_WORK_ONSTACK(&work.work, zram_sync_read);
+	queue_work(system_unbound_wq, &work.work);
+	flush_work(&work.work);
+	destroy_work_on_stack(&work.work);
+
+	if (!work.error) {
+		src = kmap_atomic(work.page);
+		memcpy(mem, src, PAGE_SIZE);
+		kunmap_atomic(src);
+		atomic64_inc(&zram->stats.bd_reads);
+	}
+	__free_page(work.page);
+
+	return work.error;
+}
+
+static int write_to_bdev(struct zram *zram, struct page *page,
+			unsigned long blk_idx)
+{
+	struct bio *bio;
+	int ret;
+
+	bio = bio_alloc(GFP_KERNEL, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_iter.bi_sector = blk_idx * (PAGE_SIZE >> SECTOR_SHIFT);
+	bio->bi_bdev = zram->bdev;
+	bio_add_page(bio, page, PAGE_SIZE, 0);
+	ret = submit_bio_wait(WRITE | REQ_SYNC, bio);
+	bio_put(bio);
+
+	if (!ret)
+		atomic64_inc(&zram->stats.bd_writes);
+	return ret;
+}
+
+#define ZRAM_WB_HUGE	BIT(0)
+#define ZRAM_WB_IDLE	BIT(1)
+
+/*
+ * Move every slot selected by the mode out of zsmalloc and onto the
+ * backing device: "huge" for slots stored uncompressed, "idle" for slots
+ * still marked through the idle attribute. Slots are written one at a
+ * time and only committed if nobody rewrote or freed them while the
+ * write was in flight.
+ */
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_meta *meta;
+	unsigned long nr_pages, index;
+	unsigned long blk_idx = 0;
+	unsigned long mode;
+	struct page *page;
+	ssize_t ret;
+
+	if (sysfs_streq(buf, "huge"))
+		mode = ZRAM_WB_HUGE;
+	else if (sysfs_streq(buf, "idle"))
+		mode = ZRAM_WB_IDLE;
+	else
+		return -EINVAL;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		ret = -EINVAL;
+		goto release_init_lock;
+	}
+
+	if (!zram->backing_dev) {
+		ret = -ENODEV;
+		goto release_init_lock;
+	}
+
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	ret = len;
+	for (index = 0; index < nr_pages; index++) {
+		int err;
+
+		if (!blk_idx) {
+			blk_idx = alloc_block_bdev(zram);
+			if (!blk_idx) {
+				ret = -ENOSPC;
+				break;
+			}
+		}
+
+		zram_slot_lock(meta, index);
+		if (!meta->table[index].handle ||
+				zram_test_flag(meta, index, ZRAM_WB) ||
+				zram_test_flag(meta, index, ZRAM_PP_SLOT)) {
+			zram_slot_unlock(meta, index);
+			continue;
+		}
+		if (!((mode & ZRAM_WB_HUGE) &&
+				zram_test_flag(meta, index, ZRAM_HUGE)) &&
+		    !((mode & ZRAM_WB_IDLE) &&
+				zram_test_flag(meta, index, ZRAM_IDLE))) {
+			zram_slot_unlock(meta, index);
+			continue;
+		}
+		/* zram_free_page() clears it if the slot changes under us */
+		zram_set_flag(meta, index, ZRAM_PP_SLOT);
+		zram_slot_unlock(meta, index);
+
+		err = zram_decompress_page(zram, page_address(page), index);
+		if (!err)
+			err = write_to_bdev(zram, page, blk_idx);
+
+		zram_slot_lock(meta, index);
+		if (err || !zram_test_flag(meta, index, ZRAM_PP_SLOT)) {
+			zram_clear_flag(meta, index, ZRAM_PP_SLOT);
+			zram_slot_unlock(meta, index);
+			if (err)
+				ret = err;
+			continue;
+		}
+
+		zram_free_page(zram, index);
+		zram_set_flag(meta, index, ZRAM_WB);
+		meta->table[index].handle = blk_idx;
+		blk_idx = 0;
+		atomic64_inc(&zram->stats.pages_stored);
+		zram_slot_unlock(meta, index);
 	}
+
+	if (blk_idx)
+		free_block_bdev(zram, blk_idx);
+
+release_init_lock:
 	up_read(&zram->init_lock);
+	__free_page(page);
 
-	return len;
+	return ret;
 }
 
-static ssize_t max_comp_streams_show(struct device *dev,
+static ssize_t bd_stat_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
-	int val;
 	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret;
 
 	down_read(&zram->init_lock);
-	val = zram->max_comp_streams;
+	ret = scnprintf(buf, PAGE_SIZE,
+			"%8llu %8llu %8llu\n",
+			(u64)atomic64_read(&zram->stats.bd_count),
+			(u64)atomic64_read(&zram->stats.bd_reads),
+			(u64)atomic64_read(&zram->stats.bd_writes));
 	up_read(&zram->init_lock);
 
-	return scnprintf(buf, PAGE_SIZE, "%d\n", val);
+	return ret;
 }
 
-static ssize_t max_comp_streams_store(struct device *dev,
-		struct device_attribute *attr, const char *buf, size_t len)
+static DEVICE_ATTR_RW(backing_dev);
+static DEVICE_ATTR_WO(writeback);
+static DEVICE_ATTR_RO(bd_stat);
+#else
+static inline void reset_bdev(struct zram *zram) {};
+static inline void free_block_bdev(struct zram *zram, unsigned long blk_idx) {};
+
+static int read_from_bdev(struct zram *zram, char *mem, unsigned long entry)
 {
-	int num;
-	struct zram *zram = dev_to_zram(dev);
-	int ret;
+	return -EIO;
+}
+#endif
 
-	ret = kstrtoint(buf, 0, &num);
-	if (ret < 0)
-		return ret;
-	if (num < 1)
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+
+static struct dentry *zram_debugfs_root;
+
+static void zram_debugfs_create(void)
+{
+	zram_debugfs_root = debugfs_create_dir("zram", NULL);
+}
+
+static void zram_debugfs_destroy(void)
+{
+	debugfs_remove_recursive(zram_debugfs_root);
+}
+
+/*
+ * One line per stored slot: index, time of the last access since boot,
+ * compressed size in bytes (0 when nothing is held in memory) and the
+ * flags, 's' zero filled, 'w' on the backing device, 'h' huge,
+ * 'i' idle, 'd' deduplicated and 'r' recompressed. *ppos is the next
+ * slot index rather than a byte offset, so the dump can be read in
+ * chunks of any size.
+ */
+static ssize_t read_block_state(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	char *kbuf;
+	ssize_t index, written = 0;
+	struct zram *zram = file->private_data;
+	struct zram_meta *meta;
+	unsigned long nr_pages;
+	struct timespec64 ts;
+
+	kbuf = vmalloc(count);
+	if (!kbuf)
+		return -ENOMEM;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		up_read(&zram->init_lock);
+		vfree(kbuf);
 		return -EINVAL;
+	}
 
-	down_write(&zram->init_lock);
-	if (init_done(zram)) {
-		if (!zcomp_set_max_streams(zram->comp, num)) {
-			pr_info("Cannot change max compression streams\n");
-			ret = -EINVAL;
-			goto out;
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = *ppos; index < nr_pages; index++) {
+		int copied;
+
+		zram_slot_lock(meta, index);
+		if (!meta->table[index].handle &&
+				!zram_test_flag(meta, index, ZRAM_ZERO))
+			goto next;
+
+		ts = ktime_to_timespec64(meta->table[index].ac_time);
+		copied = snprintf(kbuf + written, count,
+			"%12zd %12lld.%06lu %5zu %c%c%c%c%c%c\n",
+			index, (s64)ts.tv_sec,
+			ts.tv_nsec / NSEC_PER_USEC,
+			zram_get_obj_size(meta, index),
+			zram_test_flag(meta, index, ZRAM_ZERO) ? 's' : '.',
+			zram_test_flag(meta, index, ZRAM_WB) ? 'w' : '.',
+			zram_test_flag(meta, index, ZRAM_HUGE) ? 'h' : '.',
+			zram_test_flag(meta, index, ZRAM_IDLE) ? 'i' : '.',
+			zram_test_flag(meta, index, ZRAM_DEDUP) ? 'd' : '.',
+			zram_test_flag(meta, index, ZRAM_RECOMP) ? 'r' : '.');
+
+		if (count <= copied) {
+			zram_slot_unlock(meta, index);
+			break;
 		}
+		written += copied;
+		count -= copied;
+next:
+		zram_slot_unlock(meta, index);
+		*ppos += 1;
 	}
 
-	zram->max_comp_streams = num;
-	ret = len;
-out:
-	up_write(&zram->init_lock);
-	return ret;
+	up_read(&zram->init_lock);
+	if (copy_to_user(buf, kbuf, written))
+		written = -EFAULT;
+	vfree(kbuf);
+
+	return written;
 }
 
-static ssize_t comp_algorithm_show(struct device *dev,
+static const struct file_operations proc_zram_block_state_op = {
+	.open = simple_open,
+	.read = read_block_state,
+	.llseek = default_llseek,
+};
+
+static void zram_debugfs_register(struct zram *zram)
+{
+	if (!zram_debugfs_root)
+		return;
+
+	zram->debugfs_dir = debugfs_create_dir(zram->disk->disk_name,
+						zram_debugfs_root);
+	debugfs_create_file("block_state", 0400, zram->debugfs_dir,
+				zram, &proc_zram_block_state_op);
+}
+
+static void zram_debugfs_unregister(struct zram *zram)
+{
+	debugfs_remove_recursive(zram->debugfs_dir);
+}
+#else
+static void zram_debugfs_create(void) {};
+static void zram_debugfs_destroy(void) {};
+static void zram_debugfs_register(struct zram *zram) {};
+static void zram_debugfs_unregister(struct zram *zram) {};
+#endif
+
+#ifdef CONFIG_ZRAM_MULTI_COMP
+#define ZRAM_RECOMP_IDLE	BIT(0)
+#define ZRAM_RECOMP_HUGE	BIT(1)
+
+static ssize_t recomp_algorithm_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
 	size_t sz;
 	struct zram *zram = dev_to_zram(dev);
 
 	down_read(&zram->init_lock);
-	sz = zcomp_available_show(zram->compressor, buf);
+	sz = zcomp_available_show(zram->recomp_algorithm, buf);
 	up_read(&zram->init_lock);
 
 	return sz;
 }
 
-static ssize_t comp_algorithm_store(struct device *dev,
+static ssize_t recomp_algorithm_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
 	struct zram *zram = dev_to_zram(dev);
@@ -374,37 +1071,80 @@ static ssize_t comp_algorithm_store(struct device *dev,
 		pr_info("Can't change algorithm for initialized device\n");
 		return -EBUSY;
 	}
-	strlcpy(zram->compressor, buf, sizeof(zram->compressor));
+	strlcpy(zram->recomp_algorithm, buf, sizeof(zram->recomp_algorithm));
 
 	/* ignore trailing newline */
-	sz = strlen(zram->compressor);
-	if (sz > 0 && zram->compressor[sz - 1] == '\n')
-		zram->compressor[sz - 1] = 0x00;
+	sz = strlen(zram->recomp_algorithm);
+	if (sz > 0 && zram->recomp_algorithm[sz - 1] == '\n')
+		zram->recomp_algorithm[sz - 1] = 0x00;
 
 	up_write(&zram->init_lock);
 	return len;
 }
 
-static ssize_t compact_store(struct device *dev,
+static ssize_t recomp_interval_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n",
+			READ_ONCE(zram->recomp_interval));
+}
+
+static ssize_t recomp_interval_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
 	struct zram *zram = dev_to_zram(dev);
-	struct zram_meta *meta;
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &val);
+	if (ret)
+		return ret;
 
 	down_read(&zram->init_lock);
-	if (!init_done(zram)) {
-		up_read(&zram->init_lock);
+	WRITE_ONCE(zram->recomp_interval, val);
+	/* let a sleeping thread pick up the new period */
+	if (init_done(zram) && zram->recomp)
+		wake_up(&zram->recomp_wait);
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
+/*
+ * Queue a recompression pass for the background thread: "idle" for
+ * slots untouched since the previous pass, "huge" for slots the primary
+ * algorithm could not compress.
+ */
+static ssize_t recompress_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned long mode;
+	ssize_t ret = len;
+
+	if (sysfs_streq(buf, "idle"))
+		mode = ZRAM_RECOMP_IDLE;
+	else if (sysfs_streq(buf, "huge"))
+		mode = ZRAM_RECOMP_HUGE;
+	else
 		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram) || !zram->recomp) {
+		ret = -EINVAL;
+		goto out;
 	}
 
-	meta = zram->meta;
-	zs_compact(meta->mem_pool);
+	set_bit(__ffs(mode), &zram->recomp_mode);
+	wake_up(&zram->recomp_wait);
+out:
 	up_read(&zram->init_lock);
-
-	return len;
+	return ret;
 }
 
-static ssize_t io_stat_show(struct device *dev,
+static ssize_t recomp_stat_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
 	struct zram *zram = dev_to_zram(dev);
@@ -412,72 +1152,228 @@ static ssize_t io_stat_show(struct device *dev,
 
 	down_read(&zram->init_lock);
 	ret = scnprintf(buf, PAGE_SIZE,
-			"%8llu %8llu %8llu %8llu\n",
-			(u64)atomic64_read(&zram->stats.failed_reads),
-			(u64)atomic64_read(&zram->stats.failed_writes),
-			(u64)atomic64_read(&zram->stats.invalid_io),
-			(u64)atomic64_read(&zram->stats.notify_free));
+			"%8llu %8llu\n",
+			(u64)atomic64_read(&zram->stats.num_recompressed),
+			(u64)atomic64_read(&zram->stats.recomp_saved));
 	up_read(&zram->init_lock);
 
 	return ret;
 }
 
-static ssize_t mm_stat_show(struct device *dev,
-		struct device_attribute *attr, char *buf)
+/*
+ * Recompress one slot with the secondary algorithm. The slot is only
+ * replaced if the new object is smaller and nobody rewrote or freed the
+ * slot meanwhile, which zram_free_page() signals by dropping
+ * ZRAM_PP_SLOT.
+ */
+static int zram_recompress_slot(struct zram *zram, u32 index, void *mem)
 {
-	struct zram *zram = dev_to_zram(dev);
-	struct zs_pool_stats pool_stats;
-	u64 orig_size, mem_used = 0;
-	long max_used;
-	ssize_t ret;
+	struct zram_meta *meta = zram->meta;
+	struct zcomp_strm *zstrm;
+	unsigned long handle;
+	size_t old_clen, clen;
+	unsigned char *cmem;
+	int ret;
 
-	memset(&pool_stats, 0x00, sizeof(struct zs_pool_stats));
+	old_clen = zram_get_obj_size(meta, index);
 
-	down_read(&zram->init_lock);
-	if (init_done(zram)) {
-		mem_used = zs_get_total_pages(zram->meta->mem_pool);
-		zs_pool_stats(zram->meta->mem_pool, &pool_stats);
+	ret = zram_decompress_page(zram, mem, index);
+	if (ret)
+		goto out_clear;
+
+	zstrm = zcomp_stream_get(zram->recomp);
+	ret = zcomp_compress(zram->recomp, zstrm, mem, &clen);
+	if (ret || clen >= old_clen || clen > max_zpage_size) {
+		zcomp_stream_put(zram->recomp, zstrm);
+		zram_slot_lock(meta, index);
+		if (!ret && zram_test_flag(meta, index, ZRAM_PP_SLOT))
+			zram_set_flag(meta, index, ZRAM_INCOMPRESSIBLE);
+		zram_clear_flag(meta, index, ZRAM_PP_SLOT);
+		zram_slot_unlock(meta, index);
+		return ret;
 	}
 
-	orig_size = atomic64_read(&zram->stats.pages_stored);
-	max_used = atomic_long_read(&zram->stats.max_used_pages);
+	handle = zs_malloc(meta->mem_pool, clen);
+	if (!handle) {
+		zcomp_stream_put(zram->recomp, zstrm);
+		ret = -ENOMEM;
+		goto out_clear;
+	}
 
-	ret = scnprintf(buf, PAGE_SIZE,
-			"%8llu %8llu %8llu %8lu %8ld %8llu %8lu\n",
-			orig_size << PAGE_SHIFT,
-			(u64)atomic64_read(&zram->stats.compr_data_size),
-			mem_used << PAGE_SHIFT,
-			zram->limit_pages << PAGE_SHIFT,
-			max_used << PAGE_SHIFT,
-			(u64)atomic64_read(&zram->stats.zero_pages),
-			pool_stats.pages_compacted);
-	up_read(&zram->init_lock);
+	cmem = zs_map_object(meta->mem_pool, handle, ZS_MM_WO);
+	memcpy(cmem, zstrm->buffer, clen);
+	zs_unmap_object(meta->mem_pool, handle);
+	zcomp_stream_put(zram->recomp, zstrm);
+
+	zram_slot_lock(meta, index);
+	if (!zram_test_flag(meta, index, ZRAM_PP_SLOT)) {
+		zram_slot_unlock(meta, index);
+		zs_free(meta->mem_pool, handle);
+		return 0;
+	}
+
+	zram_free_page(zram, index);
+	meta->table[index].handle = handle;
+	zram_set_obj_size(meta, index, clen);
+	zram_set_flag(meta, index, ZRAM_RECOMP);
+	zram_slot_unlock(meta, index);
+
+	atomic64_add(clen, &zram->stats.compr_data_size);
+	atomic64_inc(&zram->stats.pages_stored);
+	atomic64_inc(&zram->stats.num_recompressed);
+	atomic64_add(old_clen - clen, &zram->stats.recomp_saved);
+	return 0;
 
+out_clear:
+	zram_slot_lock(meta, index);
+	zram_clear_flag(meta, index, ZRAM_PP_SLOT);
+	zram_slot_unlock(meta, index);
 	return ret;
 }
 
-static DEVICE_ATTR_RO(io_stat);
-static DEVICE_ATTR_RO(mm_stat);
-ZRAM_ATTR_RO(num_reads);
-ZRAM_ATTR_RO(num_writes);
-ZRAM_ATTR_RO(failed_reads);
-ZRAM_ATTR_RO(failed_writes);
-ZRAM_ATTR_RO(invalid_io);
-ZRAM_ATTR_RO(notify_free);
-ZRAM_ATTR_RO(zero_pages);
-ZRAM_ATTR_RO(compr_data_size);
+/*
+ * One clock sweep over the device. In idle mode a slot that is still
+ * ZRAM_RECOMP_AGED from the previous sweep is recompressed, and every
+ * other stored slot is marked ZRAM_RECOMP_AGED for the next one; reads
+ * and rewrites clear the mark again. ZRAM_IDLE belongs to the idle and
+ * writeback attributes and is left alone here.
+ */
+static void zram_recompress(struct zram *zram, unsigned long mode, void *mem)
+{
+	struct zram_meta *meta = zram->meta;
+	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
+	unsigned long index;
+
+	for (index = 0; index < nr_pages; index++) {
+		bool candidate;
+
+		if (kthread_should_stop())
+			break;
+
+		zram_slot_lock(meta, index);
+		if (!meta->table[index].handle ||
+				zram_test_flag(meta, index, ZRAM_WB) ||
+				zram_test_flag(meta, index, ZRAM_PP_SLOT) ||
+				zram_test_flag(meta, index, ZRAM_DEDUP) ||
+				zram_test_flag(meta, index, ZRAM_RECOMP) ||
+				zram_test_flag(meta, index, ZRAM_INCOMPRESSIBLE)) {
+			zram_slot_unlock(meta, index);
+			continue;
+		}
+
+		candidate = ((mode & ZRAM_RECOMP_HUGE) &&
+				zram_test_flag(meta, index, ZRAM_HUGE)) ||
+			    ((mode & ZRAM_RECOMP_IDLE) &&
+				zram_test_flag(meta, index, ZRAM_RECOMP_AGED));
+		if (!candidate) {
+			if (mode & ZRAM_RECOMP_IDLE)
+				zram_set_flag(meta, index, ZRAM_RECOMP_AGED);
+			zram_slot_unlock(meta, index);
+			continue;
+		}
+
+		zram_set_flag(meta, index, ZRAM_PP_SLOT);
+		zram_slot_unlock(meta, index);
+
+		zram_recompress_slot(zram, index, mem);
+		cond_resched();
+	}
+}
+
+static int zram_recomp_thread(void *data)
+{
+	struct zram *zram = data;
+	unsigned long mode;
+	unsigned int interval;
+	long timeout;
+	void *mem;
+
+	mem = (void *)__get_free_page(GFP_KERNEL);
+	if (!mem)
+		return -ENOMEM;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		interval = READ_ONCE(zram->recomp_interval);
+		timeout = interval ? interval * HZ : MAX_SCHEDULE_TIMEOUT;
+
+		timeout = wait_event_freezable_timeout(zram->recomp_wait,
+				READ_ONCE(zram->recomp_mode) ||
+				interval != READ_ONCE(zram->recomp_interval) ||
+				kthread_should_stop(), timeout);
+		if (kthread_should_stop())
+			break;
+
+		mode = xchg(&zram->recomp_mode, 0);
+		/* the period expired without a request: age idle slots */
+		if (!timeout)
+			mode |= ZRAM_RECOMP_IDLE;
+		if (mode)
+			zram_recompress(zram, mode, mem);
+	}
+
+	free_page((unsigned long)mem);
+	return 0;
+}
+
+static int zram_recomp_init(struct zram *zram)
+{
+	struct zcomp *recomp;
+
+	if (!zram->recomp_algorithm[0])
+		return 0;
 
-static inline bool zram_meta_get(struct zram *zram)
+	recomp = zcomp_create(zram->recomp_algorithm);
+	if (IS_ERR(recomp)) {
+		pr_err("Cannot initialise %s recompressing backend\n",
+				zram->recomp_algorithm);
+		return PTR_ERR(recomp);
+	}
+
+	zram->recomp_mode = 0;
+	init_waitqueue_head(&zram->recomp_wait);
+	zram->recomp_thread = kthread_run(zram_recomp_thread, zram,
+					"%s_recomp", zram->disk->disk_name);
+	if (IS_ERR(zram->recomp_thread)) {
+		zcomp_destroy(recomp);
+		return PTR_ERR(zram->recomp_thread);
+	}
+	zram->recomp = recomp;
+
+	return 0;
+}
+
+static void zram_recomp_fini(struct zram *zram)
+{
+	if (!zram->recomp)
+		return;
+
+	kthread_stop(zram->recomp_thread);
+	zcomp_destroy(zram->recomp);
+	zram->recomp_thread = NULL;
+	zram->recomp = NULL;
+}
+
+static struct zcomp *zram_slot_comp(struct zram *zram, u32 index)
 {
-	if (atomic_inc_not_zero(&zram->refcount))
-		return true;
-	return false;
+	if (zram_test_flag(zram->meta, index, ZRAM_RECOMP))
+		return zram->recomp;
+	return zram->comp;
 }
 
-static inline void zram_meta_put(struct zram *zram)
+static DEVICE_ATTR_RW(recomp_algorithm);
+static DEVICE_ATTR_RW(recomp_interval);
+static DEVICE_ATTR_WO(recompress);
+static DEVICE_ATTR_RO(recomp_stat);
+#else
+static inline int zram_recomp_init(struct zram *zram) { return 0; }
+static inline void zram_recomp_fini(struct zram *zram) {}
+
+static struct zcomp *zram_slot_comp(struct zram *zram, u32 index)
 {
-	atomic_dec(&zram->refcount);
+	return zram->comp;
 }
+#endif
 
 static void zram_meta_free(struct zram_meta *meta, u64 disksize)
 {
@@ -488,21 +1384,29 @@ static void zram_meta_free(struct zram_meta *meta, u64 disksize)
 	for (index = 0; index < num_pages; index++) {
 		unsigned long handle = meta->table[index].handle;
 
-		if (!handle)
+		/* pages on the backing device go away with its bitmap */
+		if (!handle || zram_test_flag(meta, index, ZRAM_WB))
+			continue;
+
+		if (zram_test_flag(meta, index, ZRAM_DEDUP)) {
+			zram_dedup_put(meta, (struct zram_entry *)handle);
 			continue;
+		}
 
 		zs_free(meta->mem_pool, handle);
 	}
 
+	zram_dedup_fini(meta);
 	zs_destroy_pool(meta->mem_pool);
 	vfree(meta->table);
 	kfree(meta);
 }
 
-static struct zram_meta *zram_meta_alloc(char *pool_name, u64 disksize)
+static struct zram_meta *zram_meta_alloc(char *pool_name, u64 disksize,
+					bool use_dedup)
 {
 	size_t num_pages;
-	struct zram_meta *meta = kmalloc(sizeof(*meta), GFP_KERNEL);
+	struct zram_meta *meta = kzalloc(sizeof(*meta), GFP_KERNEL);
 
 	if (!meta)
 		return NULL;
@@ -520,6 +1424,11 @@ static struct zram_meta *zram_meta_alloc(char *pool_name, u64 disksize)
 		goto out_error;
 	}
 
+	if (use_dedup && zram_dedup_init(meta, num_pages)) {
+		zs_destroy_pool(meta->mem_pool);
+		goto out_error;
+	}
+
 	return meta;
 
 out_error:
@@ -530,7 +1439,7 @@ out_error:
 
 /*
  * To protect concurrent access to the same index entry,
- * caller should hold this table index entry's bit_spinlock to
+ * caller should hold this table index entry's slot lock to
  * indicate this index entry is accessing.
  */
 static void zram_free_page(struct zram *zram, size_t index)
@@ -538,6 +1447,23 @@ static void zram_free_page(struct zram *zram, size_t index)
 	struct zram_meta *meta = zram->meta;
 	unsigned long handle = meta->table[index].handle;
 
+	zram_clear_flag(meta, index, ZRAM_PP_SLOT);
+	zram_clear_flag(meta, index, ZRAM_IDLE);
+	zram_clear_flag(meta, index, ZRAM_RECOMP_AGED);
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+	meta->table[index].ac_time = ktime_set(0, 0);
+#endif
+	if (zram_test_flag(meta, index, ZRAM_WB)) {
+		zram_clear_flag(meta, index, ZRAM_WB);
+		free_block_bdev(zram, handle);
+		atomic64_dec(&zram->stats.pages_stored);
+		meta->table[index].handle = 0;
+		return;
+	}
+
+	zram_clear_flag(meta, index, ZRAM_HUGE);
+	zram_clear_flag(meta, index, ZRAM_RECOMP);
+	zram_clear_flag(meta, index, ZRAM_INCOMPRESSIBLE);
 	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
@@ -550,16 +1476,38 @@ static void zram_free_page(struct zram *zram, size_t index)
 		return;
 	}
 
-	zs_free(meta->mem_pool, handle);
-
-	atomic64_sub(zram_get_obj_size(meta, index),
-			&zram->stats.compr_data_size);
+	if (zram_test_flag(meta, index, ZRAM_DEDUP)) {
+		zram_clear_flag(meta, index, ZRAM_DEDUP);
+		if (zram_dedup_put(meta, (struct zram_entry *)handle)) {
+			atomic64_sub(zram_get_obj_size(meta, index),
+					&zram->stats.compr_data_size);
+			atomic64_sub(sizeof(struct zram_entry),
+					&zram->stats.meta_data_size);
+		} else {
+			atomic64_sub(zram_get_obj_size(meta, index),
+					&zram->stats.dup_data_size);
+		}
+	} else {
+		zs_free(meta->mem_pool, handle);
+		atomic64_sub(zram_get_obj_size(meta, index),
+				&zram->stats.compr_data_size);
+	}
 	atomic64_dec(&zram->stats.pages_stored);
 
 	meta->table[index].handle = 0;
 	zram_set_obj_size(meta, index, 0);
 }
 
+/* zsmalloc handle of a slot, caller holds the slot lock */
+static unsigned long zram_get_handle(struct zram_meta *meta, u32 index)
+{
+	unsigned long handle = meta->table[index].handle;
+
+	if (zram_test_flag(meta, index, ZRAM_DEDUP))
+		return ((struct zram_entry *)handle)->handle;
+	return handle;
+}
+
 static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 {
 	int ret = 0;
@@ -568,23 +1516,37 @@ static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 	unsigned long handle;
 	size_t size;
 
-	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+	/*
+	 * The slot lock is the only lock held on the read path, so
+	 * readers of different slots never contend.
+	 */
+	zram_slot_lock(meta, index);
+	/* writeback and recompression are not accesses, they own PP_SLOT */
+	if (!zram_test_flag(meta, index, ZRAM_PP_SLOT))
+		zram_accessed(meta, index);
 	handle = meta->table[index].handle;
 	size = zram_get_obj_size(meta, index);
 
 	if (!handle || zram_test_flag(meta, index, ZRAM_ZERO)) {
-		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		zram_slot_unlock(meta, index);
 		memset(mem, 0, PAGE_SIZE);
 		return 0;
 	}
 
+	if (zram_test_flag(meta, index, ZRAM_WB)) {
+		zram_slot_unlock(meta, index);
+		return read_from_bdev(zram, mem, handle);
+	}
+
+	handle = zram_get_handle(meta, index);
 	cmem = zs_map_object(meta->mem_pool, handle, ZS_MM_RO);
 	if (size == PAGE_SIZE)
 		memcpy(mem, cmem, PAGE_SIZE);
 	else
-		ret = zcomp_decompress(zram->comp, cmem, size, mem);
+		ret = zcomp_decompress(zram_slot_comp(zram, index), cmem,
+				size, mem);
 	zs_unmap_object(meta->mem_pool, handle);
-	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+	zram_slot_unlock(meta, index);
 
 	/* Should NEVER happen. Return bio error if it does. */
 	if (unlikely(ret)) {
@@ -601,23 +1563,17 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	int ret;
 	struct page *page;
 	unsigned char *user_mem, *uncmem = NULL;
-	struct zram_meta *meta = zram->meta;
 	page = bvec->bv_page;
 
-	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
-	if (unlikely(!meta->table[index].handle) ||
-			zram_test_flag(meta, index, ZRAM_ZERO)) {
-		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
-		handle_zero_page(bvec);
-		return 0;
-	}
-	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
-
 	if (is_partial_io(bvec))
 		/* Use  a temporary buffer to decompress the page */
 		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
 
-	user_mem = kmap_atomic(page);
+	/*
+	 * Not kmap_atomic(): pages on the backing device are read in
+	 * sleepable context by zram_decompress_page().
+	 */
+	user_mem = kmap(page);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
 
@@ -639,7 +1595,7 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	flush_dcache_page(page);
 	ret = 0;
 out_cleanup:
-	kunmap_atomic(user_mem);
+	kunmap(page);
 	if (is_partial_io(bvec))
 		kfree(uncmem);
 	return ret;
@@ -656,6 +1612,8 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	struct zram_meta *meta = zram->meta;
 	struct zcomp_strm *zstrm = NULL;
 	unsigned long alloced_pages;
+	struct zram_entry *entry = NULL;
+	u32 checksum = 0;
 
 	page = bvec->bv_page;
 	if (is_partial_io(bvec)) {
@@ -673,7 +1631,7 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			goto out;
 	}
 
-	zstrm = zcomp_strm_find(zram->comp);
+	zstrm = zcomp_stream_get(zram->comp);
 	user_mem = kmap_atomic(page);
 
 	if (is_partial_io(bvec)) {
@@ -689,10 +1647,11 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		if (user_mem)
 			kunmap_atomic(user_mem);
 		/* Free memory associated with this sector now. */
-		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		zram_slot_lock(meta, index);
 		zram_free_page(zram, index);
 		zram_set_flag(meta, index, ZRAM_ZERO);
-		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		zram_accessed(meta, index);
+		zram_slot_unlock(meta, index);
 
 		atomic64_inc(&zram->stats.zero_pages);
 		ret = 0;
@@ -717,6 +1676,32 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			src = uncmem;
 	}
 
+	/*
+	 * Identical pages compress to identical data, so compare the
+	 * compressed buffer against objects already stored. Huge pages
+	 * are not worth it: they are rarely shared.
+	 */
+	if (zram_dedup_enabled(meta) && clen != PAGE_SIZE) {
+		checksum = zram_dedup_checksum(src, clen);
+		entry = zram_dedup_find(meta, src, clen, checksum);
+		if (entry) {
+			zcomp_stream_put(zram->comp, zstrm);
+			zstrm = NULL;
+
+			zram_slot_lock(meta, index);
+			zram_free_page(zram, index);
+			meta->table[index].handle = (unsigned long)entry;
+			zram_set_obj_size(meta, index, clen);
+			zram_set_flag(meta, index, ZRAM_DEDUP);
+			zram_accessed(meta, index);
+			zram_slot_unlock(meta, index);
+
+			atomic64_add(clen, &zram->stats.dup_data_size);
+			atomic64_inc(&zram->stats.pages_stored);
+			goto out;
+		}
+	}
+
 	handle = zs_malloc(meta->mem_pool, clen);
 	if (!handle) {
 		pr_err("Error allocating memory for compressed page: %u, size=%zu\n",
@@ -744,27 +1729,43 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		memcpy(cmem, src, clen);
 	}
 
-	zcomp_strm_release(zram->comp, zstrm);
+	zcomp_stream_put(zram->comp, zstrm);
 	zstrm = NULL;
 	zs_unmap_object(meta->mem_pool, handle);
 
+	/* publish the object only once its contents are in place */
+	if (zram_dedup_enabled(meta) && clen != PAGE_SIZE) {
+		entry = zram_dedup_insert(meta, handle, clen, checksum);
+		if (entry)
+			atomic64_add(sizeof(*entry),
+					&zram->stats.meta_data_size);
+	}
+
 	/*
 	 * Free memory associated with this sector
 	 * before overwriting unused sectors.
 	 */
-	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+	zram_slot_lock(meta, index);
 	zram_free_page(zram, index);
 
-	meta->table[index].handle = handle;
+	if (entry) {
+		meta->table[index].handle = (unsigned long)entry;
+		zram_set_flag(meta, index, ZRAM_DEDUP);
+	} else {
+		meta->table[index].handle = handle;
+	}
 	zram_set_obj_size(meta, index, clen);
-	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+	if (clen == PAGE_SIZE)
+		zram_set_flag(meta, index, ZRAM_HUGE);
+	zram_accessed(meta, index);
+	zram_slot_unlock(meta, index);
 
 	/* Update stats */
 	atomic64_add(clen, &zram->stats.compr_data_size);
 	atomic64_inc(&zram->stats.pages_stored);
 out:
 	if (zstrm)
-		zcomp_strm_release(zram->comp, zstrm);
+		zcomp_stream_put(zram->comp, zstrm);
 	if (is_partial_io(bvec))
 		kfree(uncmem);
 	return ret;
@@ -800,9 +1801,9 @@ static void zram_bio_discard(struct zram *zram, u32 index,
 	}
 
 	while (n >= PAGE_SIZE) {
-		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		zram_slot_lock(meta, index);
 		zram_free_page(zram, index);
-		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		zram_slot_unlock(meta, index);
 		atomic64_inc(&zram->stats.notify_free);
 		index++;
 		n -= PAGE_SIZE;
@@ -898,22 +1899,17 @@ static blk_qc_t zram_make_request(struct request_queue *queue, struct bio *bio)
 {
 	struct zram *zram = queue->queuedata;
 
-	if (unlikely(!zram_meta_get(zram)))
-		goto error;
-
 	blk_queue_split(queue, &bio, queue->bio_split);
 
 	if (!valid_io_request(zram, bio->bi_iter.bi_sector,
 					bio->bi_iter.bi_size)) {
 		atomic64_inc(&zram->stats.invalid_io);
-		goto put_zram;
+		goto error;
 	}
 
 	__zram_make_request(zram, bio);
-	zram_meta_put(zram);
 	return BLK_QC_T_NONE;
-put_zram:
-	zram_meta_put(zram);
+
 error:
 	bio_io_error(bio);
 	return BLK_QC_T_NONE;
@@ -928,9 +1924,9 @@ static void zram_slot_free_notify(struct block_device *bdev,
 	zram = bdev->bd_disk->private_data;
 	meta = zram->meta;
 
-	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+	zram_slot_lock(meta, index);
 	zram_free_page(zram, index);
-	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+	zram_slot_unlock(meta, index);
 	atomic64_inc(&zram->stats.notify_free);
 }
 
@@ -943,13 +1939,11 @@ static int zram_rw_page(struct block_device *bdev, sector_t sector,
 	struct bio_vec bv;
 
 	zram = bdev->bd_disk->private_data;
-	if (unlikely(!zram_meta_get(zram)))
-		goto out;
 
 	if (!valid_io_request(zram, sector, PAGE_SIZE)) {
 		atomic64_inc(&zram->stats.invalid_io);
 		err = -EINVAL;
-		goto put_zram;
+		goto out;
 	}
 
 	index = sector >> SECTORS_PER_PAGE_SHIFT;
@@ -960,8 +1954,6 @@ static int zram_rw_page(struct block_device *bdev, sector_t sector,
 	bv.bv_offset = 0;
 
 	err = zram_bvec_rw(zram, &bv, index, offset, rw);
-put_zram:
-	zram_meta_put(zram);
 out:
 	/*
 	 * If I/O fails, just return error(ie, non-zero) without
@@ -995,21 +1987,16 @@ static void zram_reset_device(struct zram *zram)
 	comp = zram->comp;
 	disksize = zram->disksize;
 	/*
-	 * Refcount will go down to 0 eventually and r/w handler
-	 * cannot handle further I/O so it will bail out by
-	 * check zram_meta_get.
+	 * No I/O can be in flight: callers only reset a claimed device
+	 * without openers, after fsync_bdev(). So the I/O path does not
+	 * need a reference on zram_meta.
 	 */
-	zram_meta_put(zram);
-	/*
-	 * We want to free zram_meta in process context to avoid
-	 * deadlock between reclaim path and any other locks.
-	 */
-	wait_event(zram->io_done, atomic_read(&zram->refcount) == 0);
+	zram_recomp_fini(zram);
 
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 	zram->disksize = 0;
-	zram->max_comp_streams = 1;
+	reset_bdev(zram);
 
 	set_capacity(zram->disk, 0);
 	part_stat_set_all(&zram->disk->part0, 0);
@@ -1034,11 +2021,12 @@ static ssize_t disksize_store(struct device *dev,
 		return -EINVAL;
 
 	disksize = PAGE_ALIGN(disksize);
-	meta = zram_meta_alloc(zram->disk->disk_name, disksize);
+	meta = zram_meta_alloc(zram->disk->disk_name, disksize,
+				zram->use_dedup);
 	if (!meta)
 		return -ENOMEM;
 
-	comp = zcomp_create(zram->compressor, zram->max_comp_streams);
+	comp = zcomp_create(zram->compressor);
 	if (IS_ERR(comp)) {
 		pr_err("Cannot initialise %s compressing backend\n",
 				zram->compressor);
@@ -1053,11 +2041,16 @@ static ssize_t disksize_store(struct device *dev,
 		goto out_destroy_comp;
 	}
 
-	init_waitqueue_head(&zram->io_done);
-	atomic_set(&zram->refcount, 1);
 	zram->meta = meta;
 	zram->comp = comp;
 	zram->disksize = disksize;
+	err = zram_recomp_init(zram);
+	if (err) {
+		zram->meta = NULL;
+		zram->comp = NULL;
+		zram->disksize = 0;
+		goto out_destroy_comp;
+	}
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 	up_write(&zram->init_lock);
 
@@ -1146,6 +2139,7 @@ static const struct block_device_operations zram_devops = {
 };
 
 static DEVICE_ATTR_WO(compact);
+static DEVICE_ATTR_WO(idle);
 static DEVICE_ATTR_RW(disksize);
 static DEVICE_ATTR_RO(initstate);
 static DEVICE_ATTR_WO(reset);
@@ -1165,6 +2159,7 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_failed_reads.attr,
 	&dev_attr_failed_writes.attr,
 	&dev_attr_compact.attr,
+	&dev_attr_idle.attr,
 	&dev_attr_invalid_io.attr,
 	&dev_attr_notify_free.attr,
 	&dev_attr_zero_pages.attr,
@@ -1177,6 +2172,20 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_comp_algorithm.attr,
 	&dev_attr_io_stat.attr,
 	&dev_attr_mm_stat.attr,
+#ifdef CONFIG_ZRAM_DEDUP
+	&dev_attr_use_dedup.attr,
+#endif
+#ifdef CONFIG_ZRAM_MULTI_COMP
+	&dev_attr_recomp_algorithm.attr,
+	&dev_attr_recomp_interval.attr,
+	&dev_attr_recompress.attr,
+	&dev_attr_recomp_stat.attr,
+#endif
+#ifdef CONFIG_ZRAM_WRITEBACK
+	&dev_attr_backing_dev.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_bd_stat.attr,
+#endif
 	NULL,
 };
 
@@ -1271,10 +2280,10 @@ static int zram_add(void)
 
 	disk_to_dev(zram->disk)->groups = zram_disk_attr_groups;
 	add_disk(zram->disk);
+	zram_debugfs_register(zram);
 
 	strlcpy(zram->compressor, default_compressor, sizeof(zram->compressor));
 	zram->meta = NULL;
-	zram->max_comp_streams = 1;
 
 	pr_info("Added device: %s\n", zram->disk->disk_name);
 	return device_id;
@@ -1311,6 +2320,7 @@ static int zram_remove(struct zram *zram)
 	zram_reset_device(zram);
 	bdput(bdev);
 
+	zram_debugfs_unregister(zram);
 	pr_info("Removed device: %s\n", zram->disk->disk_name);
 
 	blk_cleanup_queue(zram->disk->queue);
@@ -1396,6 +2406,7 @@ static void destroy_devices(void)
 	idr_for_each(&zram_index_idr, &zram_remove_cb, NULL);
 	idr_destroy(&zram_index_idr);
 	unregister_blkdev(zram_major, "zram");
+	zram_debugfs_destroy();
 }
 
 static int __init zram_init(void)
@@ -1408,9 +2419,11 @@ static int __init zram_init(void)
 		return ret;
 	}
 
+	zram_debugfs_create();
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_err("Unable to get major number\n");
+		zram_debugfs_destroy();
 		class_unregister(&zram_control_class);
 		return -EBUSY;
 	}
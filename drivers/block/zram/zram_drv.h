@@ -15,10 +15,12 @@
 #ifndef _ZRAM_DRV_H_
 #define _ZRAM_DRV_H_
 
+#include <linux/ktime.h>
 #include <linux/spinlock.h>
 #include <linux/zsmalloc.h>
 
 #include "zcomp.h"
+#include "zram_dedup.h"
 
 /*-- Configurable parameters */
 
@@ -55,13 +57,21 @@ static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
  * The lower ZRAM_FLAG_SHIFT bits is for object size (excluding header),
  * the higher bits is for zram_pageflags.
  */
-#define ZRAM_FLAG_SHIFT 24
+#define ZRAM_FLAG_SHIFT (PAGE_SHIFT + 1)
 
 /* Flags for zram pages (table[page_no].value) */
 enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO = ZRAM_FLAG_SHIFT,
-	ZRAM_ACCESS,	/* page is now accessed */
+	ZRAM_LOCK,	/* slot lock, see zram_slot_lock() */
+	ZRAM_WB,	/* page is stored on backing_device */
+	ZRAM_PP_SLOT,	/* page is under writeback or recompression */
+	ZRAM_HUGE,	/* incompressible page */
+	ZRAM_DEDUP,	/* handle points to a shared struct zram_entry */
+	ZRAM_IDLE,	/* not accessed since the last idle mark */
+	ZRAM_RECOMP,	/* compressed with the secondary algorithm */
+	ZRAM_INCOMPRESSIBLE,	/* secondary algorithm did not help */
+	ZRAM_RECOMP_AGED,	/* not accessed since the last recompress sweep */
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -70,8 +80,15 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct zram_table_entry {
+	/*
+	 * zsmalloc handle, or the block index on the backing device
+	 * when ZRAM_WB is set
+	 */
 	unsigned long handle;
 	unsigned long value;
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+	ktime_t ac_time;	/* last read or write, 0 if never */
+#endif
 };
 
 struct zram_stats {
@@ -85,13 +102,32 @@ struct zram_stats {
 	atomic64_t zero_pages;		/* no. of zero filled pages */
 	atomic64_t pages_stored;	/* no. of pages currently stored */
 	atomic_long_t max_used_pages;	/* no. of maximum pages stored */
+	atomic64_t dup_data_size;	/* compressed size of pages duplicated */
+	atomic64_t meta_data_size;	/* size of zram_entries */
+#ifdef CONFIG_ZRAM_MULTI_COMP
+	atomic64_t num_recompressed;	/* no. of pages recompressed */
+	atomic64_t recomp_saved;	/* bytes saved by recompression */
+#endif
+#ifdef CONFIG_ZRAM_WRITEBACK
+	atomic64_t bd_count;		/* no. of pages in backing device */
+	atomic64_t bd_reads;		/* no. of reads from backing device */
+	atomic64_t bd_writes;		/* no. of writes to backing device */
+#endif
 };
 
 struct zram_meta {
 	struct zram_table_entry *table;
 	struct zs_pool *mem_pool;
+	/* dedup buckets of zram_entry, NULL if dedup is not in use */
+	struct zram_hash *hash;
+	size_t hash_size;
 };
 
+static inline bool zram_dedup_enabled(struct zram_meta *meta)
+{
+	return meta->hash != NULL;
+}
+
 struct zram {
 	struct zram_meta *meta;
 	struct zcomp *comp;
@@ -102,21 +138,40 @@ struct zram {
 	 * the number of pages zram can consume for storing compressed data
 	 */
 	unsigned long limit_pages;
-	int max_comp_streams;
 
 	struct zram_stats stats;
-	atomic_t refcount; /* refcount for zram_meta */
-	/* wait all IO under all of cpu are done */
-	wait_queue_head_t io_done;
 	/*
 	 * This is the limit on amount of *uncompressed* worth of data
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
 	char compressor[10];
+#ifdef CONFIG_ZRAM_MULTI_COMP
+	/* secondary, higher ratio algorithm for cold slots */
+	char recomp_algorithm[10];
+	struct zcomp *recomp;
+	struct task_struct *recomp_thread;
+	wait_queue_head_t recomp_wait;
+	/* ZRAM_RECOMP_* passes requested through sysfs */
+	unsigned long recomp_mode;
+	/* seconds between background aging passes, 0 disables them */
+	unsigned int recomp_interval;
+#endif
 	/*
 	 * zram is claimed so open request will be failed
 	 */
 	bool claim; /* Protected by bdev->bd_mutex */
+	bool use_dedup;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned int old_block_size;
+	/* allocation bitmap of backing device blocks, bit 0 is never used */
+	unsigned long *bitmap;
+	unsigned long nr_pages;
+#endif
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+	struct dentry *debugfs_dir;
+#endif
 };
 #endif
@@ -127,9 +127,14 @@ static void handle_update(struct work_struct *work);
  * "transition" list for kernel code that needs to handle
  * changes to devices when the CPU clock speed changes.
  * The mutex locks both lists.
+ *
+ * Fast switches skip the transition list, whose users may sleep or wake
+ * tasks; the "fast switch" list is called instead, from scheduler
+ * context with the runqueue lock held and interrupts disabled.
  */
 static BLOCKING_NOTIFIER_HEAD(cpufreq_policy_notifier_list);
 static struct srcu_notifier_head cpufreq_transition_notifier_list;
+static ATOMIC_NOTIFIER_HEAD(cpufreq_fast_switch_notifier_list);
 
 static bool init_cpufreq_transition_notifier_list_called;
 static int __init init_cpufreq_transition_notifier_list(void)
@@ -390,6 +395,21 @@ scale_freq_capacity(struct cpufreq_policy *policy, struct cpufreq_freqs *freqs)
 		per_cpu(max_freq_scale, cpu) = scale;
 }
 
+/* Track the frequency actually set, so that PELT stays frequency invariant */
+static void update_freq_scale(struct cpufreq_policy *policy,
+			      struct cpufreq_freqs *freqs)
+{
+#ifdef CONFIG_SMP
+	int cpu;
+#endif
+
+	scale_freq_capacity(policy, freqs);
+#ifdef CONFIG_SMP
+	for_each_cpu(cpu, policy->cpus)
+		trace_cpu_capacity(capacity_curr_of(cpu), cpu);
+#endif
+}
+
 unsigned long cpufreq_scale_freq_capacity(struct sched_domain *sd, int cpu)
 {
 	return per_cpu(freq_scale, cpu);
@@ -476,10 +496,6 @@ static void cpufreq_notify_post_transition(struct cpufreq_policy *policy,
 void cpufreq_freq_transition_begin(struct cpufreq_policy *policy,
 		struct cpufreq_freqs *freqs)
 {
-#if defined(CONFIG_SMP) && defined(DEFAULT_USE_ENERGY_AWARE)
-	int cpu;
-#endif
-
 	/*
 	 * Catch double invocations of _begin() which lead to self-deadlock.
 	 * ASYNC_NOTIFICATION drivers are left out because the cpufreq core
@@ -505,13 +521,6 @@ wait:
 	policy->transition_task = current;
 
 	spin_unlock(&policy->transition_lock);
-#ifdef DEFAULT_USE_ENERGY_AWARE
-	scale_freq_capacity(policy, freqs);
-#ifdef CONFIG_SMP
-	for_each_cpu(cpu, policy->cpus)
-		trace_cpu_capacity(capacity_curr_of(cpu), cpu);
-#endif
-#endif
 	cpufreq_notify_transition(policy, freqs, CPUFREQ_PRECHANGE);
 }
 EXPORT_SYMBOL_GPL(cpufreq_freq_transition_begin);
@@ -522,6 +531,9 @@ void cpufreq_freq_transition_end(struct cpufreq_policy *policy,
 	if (unlikely(WARN_ON(!policy->transition_ongoing)))
 		return;
 
+	if (!transition_failed)
+		update_freq_scale(policy, freqs);
+
 	cpufreq_notify_post_transition(policy, freqs, transition_failed);
 
 	policy->transition_ongoing = false;
@@ -564,6 +576,78 @@ unsigned int cpufreq_driver_resolve_freq(struct cpufreq_policy *policy,
 }
 EXPORT_SYMBOL_GPL(cpufreq_driver_resolve_freq);
 
+/**
+ * cpufreq_enable_fast_switch - Enable fast frequency switching for policy.
+ * @policy: cpufreq policy to enable fast frequency switching for.
+ *
+ * Governors calling this must be prepared for cpufreq_driver_fast_switch()
+ * to refuse a request and fall back to __cpufreq_driver_target() then.
+ */
+void cpufreq_enable_fast_switch(struct cpufreq_policy *policy)
+{
+	if (policy->fast_switch_possible && cpufreq_driver->fast_switch)
+		policy->fast_switch_enabled = true;
+}
+EXPORT_SYMBOL_GPL(cpufreq_enable_fast_switch);
+
+/**
+ * cpufreq_disable_fast_switch - Disable fast frequency switching for policy.
+ * @policy: cpufreq policy to disable fast frequency switching for.
+ */
+void cpufreq_disable_fast_switch(struct cpufreq_policy *policy)
+{
+	policy->fast_switch_enabled = false;
+}
+EXPORT_SYMBOL_GPL(cpufreq_disable_fast_switch);
+
+/**
+ * cpufreq_driver_fast_switch - Carry out a fast CPU frequency switch.
+ * @policy: cpufreq policy to switch the frequency for.
+ * @target_freq: New frequency to set (may be approximate).
+ *
+ * Carry out a fast frequency switch without sleeping. May be called from
+ * scheduler context, with interrupts disabled, on any CPU of @policy.
+ *
+ * The transition notifiers are not called for a fast switch. The
+ * frequency scale is updated here and CPUFREQ_FAST_SWITCH_NOTIFIER users,
+ * which must neither sleep nor wake tasks, get @policy with the new
+ * policy->cur.
+ *
+ * Return: The frequency actually set, or 0 if the driver could not switch
+ * from this context. In that case the caller has to use the regular
+ * __cpufreq_driver_target() path instead.
+ */
+unsigned int cpufreq_driver_fast_switch(struct cpufreq_policy *policy,
+					unsigned int target_freq)
+{
+	struct cpufreq_freqs freqs;
+
+	if (cpufreq_disabled())
+		return 0;
+
+	target_freq = clamp_val(target_freq, policy->min, policy->max);
+
+	freqs.new = cpufreq_driver->fast_switch(policy, target_freq);
+	if (!freqs.new)
+		return 0;
+
+	freqs.old = policy->cur;
+	if (freqs.new == freqs.old)
+		return freqs.new;
+
+	freqs.flags = cpufreq_driver->flags;
+	update_freq_scale(policy, &freqs);
+	for_each_cpu(freqs.cpu, policy->cpus)
+		trace_cpu_frequency(freqs.new, freqs.cpu);
+	policy->cur = freqs.new;
+
+	atomic_notifier_call_chain(&cpufreq_fast_switch_notifier_list,
+				   CPUFREQ_POSTCHANGE, policy);
+
+	return freqs.new;
+}
+EXPORT_SYMBOL_GPL(cpufreq_driver_fast_switch);
+
 /*********************************************************************
  *                          SYSFS INTERFACE                          *
  *********************************************************************/
@@ -1821,12 +1905,14 @@ EXPORT_SYMBOL_GPL(cpufreq_get_driver_data);
 /**
  *	cpufreq_register_notifier - register a driver with cpufreq
  *	@nb: notifier function to register
- *      @list: CPUFREQ_TRANSITION_NOTIFIER or CPUFREQ_POLICY_NOTIFIER
+ *      @list: CPUFREQ_TRANSITION_NOTIFIER, CPUFREQ_POLICY_NOTIFIER or
+ *             CPUFREQ_FAST_SWITCH_NOTIFIER
  *
- *	Add a driver to one of two lists: either a list of drivers that
+ *	Add a driver to one of three lists: a list of drivers that
  *      are notified about clock rate changes (once before and once after
- *      the transition), or a list of drivers that are notified about
- *      changes in cpufreq policy.
+ *      the transition), a list of drivers that are notified about
+ *      changes in cpufreq policy, or a list of drivers that are notified
+ *      about fast switches in atomic context.
  *
  *	This function may sleep, and has the same return conditions as
  *	blocking_notifier_chain_register.
@@ -1849,6 +1935,10 @@ int cpufreq_register_notifier(struct notifier_block *nb, unsigned int list)
 		ret = blocking_notifier_chain_register(
 				&cpufreq_policy_notifier_list, nb);
 		break;
+	case CPUFREQ_FAST_SWITCH_NOTIFIER:
+		ret = atomic_notifier_chain_register(
+				&cpufreq_fast_switch_notifier_list, nb);
+		break;
 	default:
 		ret = -EINVAL;
 	}
@@ -1860,7 +1950,8 @@ EXPORT_SYMBOL(cpufreq_register_notifier);
 /**
  *	cpufreq_unregister_notifier - unregister a driver with cpufreq
  *	@nb: notifier block to be unregistered
- *	@list: CPUFREQ_TRANSITION_NOTIFIER or CPUFREQ_POLICY_NOTIFIER
+ *	@list: CPUFREQ_TRANSITION_NOTIFIER, CPUFREQ_POLICY_NOTIFIER or
+ *	       CPUFREQ_FAST_SWITCH_NOTIFIER
  *
  *	Remove a driver from the CPU frequency notifier list.
  *
@@ -1883,6 +1974,10 @@ int cpufreq_unregister_notifier(struct notifier_block *nb, unsigned int list)
 		ret = blocking_notifier_chain_unregister(
 				&cpufreq_policy_notifier_list, nb);
 		break;
+	case CPUFREQ_FAST_SWITCH_NOTIFIER:
+		ret = atomic_notifier_chain_unregister(
+				&cpufreq_fast_switch_notifier_list, nb);
+		break;
 	default:
 		ret = -EINVAL;
 	}
@@ -44,11 +44,13 @@ static DEFINE_PER_CPU(struct cpufreq_power_stats *, cpufreq_power_stats);
 static int cpufreq_stats_update(struct cpufreq_stats *stats)
 {
 	unsigned long long cur_time = get_jiffies_64();
+	unsigned long flags;
 
-	spin_lock(&cpufreq_stats_lock);
+	/* Also reached from fast frequency switches with irqs disabled */
+	spin_lock_irqsave(&cpufreq_stats_lock, flags);
 	stats->time_in_state[stats->last_index] += cur_time - stats->last_time;
 	stats->last_time = cur_time;
-	spin_unlock(&cpufreq_stats_lock);
+	spin_unlock_irqrestore(&cpufreq_stats_lock, flags);
 	return 0;
 }
 
@@ -107,7 +109,7 @@ static ssize_t show_current_in_state(struct kobject *kobj,
 	unsigned int i, cpu;
 	struct cpufreq_power_stats *powerstats;
 
-	spin_lock(&cpufreq_stats_lock);
+	spin_lock_irq(&cpufreq_stats_lock);
 	for_each_possible_cpu(cpu) {
 		powerstats = per_cpu(cpufreq_power_stats, cpu);
 		if (!powerstats)
@@ -119,7 +121,7 @@ static ssize_t show_current_in_state(struct kobject *kobj,
 					powerstats->curr[i]);
 		len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
 	}
-	spin_unlock(&cpufreq_stats_lock);
+	spin_unlock_irq(&cpufreq_stats_lock);
 	return len;
 }
 
@@ -324,7 +326,7 @@ static void cpufreq_powerstats_create(unsigned int cpu,
 	}
 	powerstats->freq_table = powerstats->curr + count;
 
-	spin_lock(&cpufreq_stats_lock);
+	spin_lock_irq(&cpufreq_stats_lock);
 	i = 0;
 	cpufreq_for_each_valid_entry(pos, table)
 		powerstats->freq_table[i++] = pos->frequency;
@@ -342,7 +344,7 @@ static void cpufreq_powerstats_create(unsigned int cpu,
 		}
 	}
 	per_cpu(cpufreq_power_stats, cpu) = powerstats;
-	spin_unlock(&cpufreq_stats_lock);
+	spin_unlock_irq(&cpufreq_stats_lock);
 }
 
 static void cpufreq_stats_create_table(unsigned int cpu)
@@ -418,38 +420,26 @@ static int cpufreq_stat_notifier_policy(struct notifier_block *nb,
 	return ret;
 }
 
-static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
-		unsigned long val, void *data)
+static void cpufreq_stats_record_transition(struct cpufreq_policy *policy,
+					    unsigned int new_freq)
 {
-	struct cpufreq_freqs *freq = data;
-	struct cpufreq_policy *policy = cpufreq_cpu_get(freq->cpu);
-	struct cpufreq_stats *stats;
+	struct cpufreq_stats *stats = policy->stats;
 	int old_index, new_index;
 
-	if (!policy) {
-		pr_err("%s: No policy found\n", __func__);
-		return 0;
-	}
-
-	if (val != CPUFREQ_POSTCHANGE)
-		goto put_policy;
-
-	if (!policy->stats) {
+	if (!stats) {
 		pr_debug("%s: No stats found\n", __func__);
-		goto put_policy;
+		return;
 	}
 
-	stats = policy->stats;
-
 	old_index = stats->last_index;
-	new_index = freq_table_get_index(stats, freq->new);
+	new_index = freq_table_get_index(stats, new_freq);
 
 	/* We can't do stats->time_in_state[-1]= .. */
 	if (old_index == -1 || new_index == -1)
-		goto put_policy;
+		return;
 
 	if (old_index == new_index)
-		goto put_policy;
+		return;
 
 	cpufreq_stats_update(stats);
 
@@ -458,12 +448,36 @@ static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
 	stats->trans_table[old_index * stats->max_state + new_index]++;
 #endif
 	stats->total_trans++;
+}
+
+static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
+		unsigned long val, void *data)
+{
+	struct cpufreq_freqs *freq = data;
+	struct cpufreq_policy *policy = cpufreq_cpu_get(freq->cpu);
+
+	if (!policy) {
+		pr_err("%s: No policy found\n", __func__);
+		return 0;
+	}
+
+	if (val == CPUFREQ_POSTCHANGE)
+		cpufreq_stats_record_transition(policy, freq->new);
 
-put_policy:
 	cpufreq_cpu_put(policy);
 	return 0;
 }
 
+/* Called from scheduler context with interrupts disabled */
+static int cpufreq_stat_notifier_fast_switch(struct notifier_block *nb,
+		unsigned long val, void *data)
+{
+	struct cpufreq_policy *policy = data;
+
+	cpufreq_stats_record_transition(policy, policy->cur);
+	return 0;
+}
+
 static struct notifier_block notifier_policy_block = {
 	.notifier_call = cpufreq_stat_notifier_policy
 };
@@ -472,6 +486,10 @@ static struct notifier_block notifier_trans_block = {
 	.notifier_call = cpufreq_stat_notifier_trans
 };
 
+static struct notifier_block notifier_fast_switch_block = {
+	.notifier_call = cpufreq_stat_notifier_fast_switch
+};
+
 static int __init cpufreq_stats_init(void)
 {
 	int ret;
@@ -496,6 +514,18 @@ static int __init cpufreq_stats_init(void)
 		return ret;
 	}
 
+	ret = cpufreq_register_notifier(&notifier_fast_switch_block,
+				CPUFREQ_FAST_SWITCH_NOTIFIER);
+	if (ret) {
+		cpufreq_unregister_notifier(&notifier_trans_block,
+				CPUFREQ_TRANSITION_NOTIFIER);
+		cpufreq_unregister_notifier(&notifier_policy_block,
+				CPUFREQ_POLICY_NOTIFIER);
+		for_each_online_cpu(cpu)
+			cpufreq_stats_free_table(cpu);
+		return ret;
+	}
+
 	ret = sysfs_create_file(cpufreq_global_kobject,
 			&_attr_current_in_state.attr);
 	if (ret)
@@ -511,6 +541,8 @@ static void __exit cpufreq_stats_exit(void)
 			CPUFREQ_POLICY_NOTIFIER);
 	cpufreq_unregister_notifier(&notifier_trans_block,
 			CPUFREQ_TRANSITION_NOTIFIER);
+	cpufreq_unregister_notifier(&notifier_fast_switch_block,
+			CPUFREQ_FAST_SWITCH_NOTIFIER);
 	for_each_online_cpu(cpu)
 		cpufreq_stats_free_table(cpu);
 
@@ -18,6 +18,9 @@
 #include <linux/cpufreq.h>
 #include <linux/exynos-ss.h>
 #include <linux/pm_opp.h>
+#include <linux/sched.h>
+#include <linux/sched_energy.h>
+#include <linux/topology.h>
 
 #include <soc/samsung/cal-if.h>
 #include <soc/samsung/ect_parser.h>
@@ -280,6 +283,7 @@ static int exynos_cpufreq_driver_init(struct cpufreq_policy *policy)
 
 	policy->cur = get_freq(domain);
 	policy->cpuinfo.transition_latency = TRANSITION_LATENCY;
+	policy->fast_switch_possible = !!domain->fast_thread;
 	cpumask_copy(policy->cpus, &domain->cpus);
 
 	pr_info("CPUFREQ domain%d registered\n", domain->id);
@@ -310,6 +314,10 @@ static int __exynos_cpufreq_target(struct cpufreq_policy *policy,
 
 	mutex_lock(&domain->lock);
 
+	/* Wait for a fast switch in progress, see exynos_cpufreq_fast_switch() */
+	while (test_and_set_bit_lock(0, &domain->switching))
+		cpu_relax();
+
 	if (!domain->enabled)
 		goto out;
 
@@ -347,6 +355,7 @@ static int __exynos_cpufreq_target(struct cpufreq_policy *policy,
 	domain->old = target_freq;
 
 out:
+	clear_bit_unlock(0, &domain->switching);
 	mutex_unlock(&domain->lock);
 
 	return ret;
@@ -380,6 +389,157 @@ static int exynos_cpufreq_target(struct cpufreq_policy *policy,
 				min(policy_max, pm_qos_max), &freq);
 }
 
+static int freq_to_index(struct exynos_cpufreq_domain *domain,
+					unsigned int freq)
+{
+	int index;
+
+	for (index = 0; index < domain->table_size; index++)
+		if (domain->freq_table[index].frequency == freq)
+			return index;
+
+	return -EINVAL;
+}
+
+/*
+ * Scaling from old_index to index leaves the DVFS Manager alone only if
+ * every domain constrained by this one sees the same constraint frequency
+ * at both levels. The constraint tables never change after init_dm(), so
+ * they can be read without the DVFS Manager lock.
+ */
+static bool dm_constraints_unchanged(struct exynos_cpufreq_domain *domain,
+					int old_index, int index)
+{
+	struct exynos_cpufreq_dm *dm;
+
+	list_for_each_entry(dm, &domain->dm_list, list)
+		if (dm->c.freq_table[old_index].constraint_freq !=
+				dm->c.freq_table[index].constraint_freq)
+			return false;
+
+	return true;
+}
+
+/*
+ * Second half of a fast switch, in the domain's SCHED_FIFO worker. The
+ * ACPM IPC busy-waits for the reply, for up to IPC_TIMEOUT, and may spin
+ * on the channel tx_lock behind other DVFS users, so it is kept out of
+ * scheduler context. The switching bit taken by the fast switch is held
+ * until here, which keeps the slow path and further fast switches off
+ * the domain meanwhile.
+ */
+static void exynos_cpufreq_fast_work(struct kthread_work *work)
+{
+	struct exynos_cpufreq_domain *domain =
+		container_of(work, struct exynos_cpufreq_domain, fast_work);
+	unsigned int target_freq = domain->fast_target;
+	int ret;
+
+	exynos_ss_freq(domain->id, domain->old, target_freq, ESS_FLAG_IN);
+	ret = set_freq(domain, target_freq);
+	exynos_ss_freq(domain->id, domain->old, target_freq,
+					ret < 0 ? ret : ESS_FLAG_OUT);
+	if (!ret) {
+		domain->old = target_freq;
+		if (!list_empty(&domain->dm_list))
+			exynos_dm_update_cur_freq(domain->dm_type, target_freq);
+	}
+
+	clear_bit_unlock(0, &domain->switching);
+}
+
+static void exynos_cpufreq_fast_irq_work(struct irq_work *irq_work)
+{
+	struct exynos_cpufreq_domain *domain =
+		container_of(irq_work, struct exynos_cpufreq_domain,
+			     fast_irq_work);
+
+	queue_kthread_work(&domain->fast_worker, &domain->fast_work);
+}
+
+/*
+ * Fast frequency switch, called by schedutil from scheduler context with
+ * interrupts disabled, possibly from the tick. Only the lock-free checks
+ * are done here: PM QoS, the table index and the DVFS Manager constraint
+ * tables. The frequency change itself is handed to
+ * exynos_cpufreq_fast_work(), so nothing here waits on ACPM.
+ *
+ * Returns 0 and leaves the request to exynos_cpufreq_target() if a
+ * scaling is in progress or the new frequency changes any DVFS Manager
+ * constraint.
+ */
+static unsigned int exynos_cpufreq_fast_switch(struct cpufreq_policy *policy,
+					unsigned int target_freq)
+{
+	struct exynos_cpufreq_domain *domain = find_domain(policy->cpu);
+	unsigned int index;
+	int old_index;
+
+	if (!domain)
+		return 0;
+
+	target_freq = apply_pm_qos(domain, policy, target_freq);
+
+	if (cpufreq_frequency_table_target(policy, domain->freq_table,
+				target_freq, CPUFREQ_RELATION_L, &index))
+		return 0;
+
+	target_freq = index_to_freq(domain->freq_table, index);
+
+	if (test_and_set_bit_lock(0, &domain->switching))
+		return 0;
+
+	if (!domain->enabled) {
+		target_freq = 0;
+		goto out;
+	}
+
+	/* Target is same as current, skip scaling */
+	if (domain->old == target_freq)
+		goto out;
+
+	if (!list_empty(&domain->dm_list)) {
+		old_index = freq_to_index(domain, domain->old);
+		if (old_index < 0 ||
+		    !dm_constraints_unchanged(domain, old_index, index)) {
+			target_freq = 0;
+			goto out;
+		}
+	}
+
+	/* exynos_cpufreq_fast_work() drops the switching bit */
+	domain->fast_target = target_freq;
+	irq_work_queue(&domain->fast_irq_work);
+
+	return target_freq;
+
+out:
+	clear_bit_unlock(0, &domain->switching);
+
+	return target_freq;
+}
+
+static __init void init_fast_switch(struct exynos_cpufreq_domain *domain)
+{
+	struct sched_param param = { .sched_priority = MAX_USER_RT_PRIO / 2 };
+	struct task_struct *thread;
+
+	init_irq_work(&domain->fast_irq_work, exynos_cpufreq_fast_irq_work);
+	init_kthread_work(&domain->fast_work, exynos_cpufreq_fast_work);
+	init_kthread_worker(&domain->fast_worker);
+
+	thread = kthread_run(kthread_worker_fn, &domain->fast_worker,
+				"cpufreq_fast%d", domain->id);
+	if (IS_ERR(thread)) {
+		pr_err("failed to create fast switch thread of domain%d\n",
+				domain->id);
+		return;
+	}
+	sched_setscheduler_nocheck(thread, SCHED_FIFO, &param);
+
+	domain->fast_thread = thread;
+}
+
 static unsigned int exynos_cpufreq_get(unsigned int cpu)
 {
 	struct exynos_cpufreq_domain *domain = find_domain(cpu);
@@ -442,6 +602,7 @@ static struct cpufreq_driver exynos_driver = {
 	.init		= exynos_cpufreq_driver_init,
 	.verify		= exynos_cpufreq_verify,
 	.target		= exynos_cpufreq_target,
+	.fast_switch	= exynos_cpufreq_fast_switch,
 	.get		= exynos_cpufreq_get,
 	.suspend	= exynos_cpufreq_suspend,
 	.resume		= exynos_cpufreq_resume,
@@ -507,11 +668,29 @@ static int need_update_freq(struct exynos_cpufreq_domain *domain,
 	return 1;
 }
 
+/*
+ * PM QoS maximum, used by thermal throttling among others, caps the domain
+ * below policy->max without cpufreq knowing about it. Report the capacity
+ * lost that way to the scheduler as thermal pressure.
+ */
+static void update_thermal_pressure(struct exynos_cpufreq_domain *domain,
+				unsigned int policy_max, int qos_max)
+{
+	unsigned long th_pressure = 0;
+
+	if (qos_max >= 0 && policy_max && (unsigned int)qos_max < policy_max)
+		th_pressure = ((unsigned long)(policy_max - qos_max)
+				<< SCHED_CAPACITY_SHIFT) / policy_max;
+
+	arch_set_thermal_pressure(&domain->cpus, th_pressure);
+}
+
 static int exynos_cpufreq_pm_qos_callback(struct notifier_block *nb,
 					unsigned long val, void *v)
 {
 	int pm_qos_class = *((int *)v);
 	struct exynos_cpufreq_domain *domain;
+	struct cpufreq_policy *policy;
 	int ret;
 
 	pr_debug("update PM QoS class %d to %ld kHz\n", pm_qos_class, val);
@@ -520,6 +699,14 @@ static int exynos_cpufreq_pm_qos_callback(struct notifier_block *nb,
 	if (!domain)
 		return NOTIFY_BAD;
 
+	if (pm_qos_class == domain->pm_qos_max_class) {
+		policy = cpufreq_cpu_get(cpumask_first(&domain->cpus));
+		if (policy) {
+			update_thermal_pressure(domain, policy->max, (int)val);
+			cpufreq_cpu_put(policy);
+		}
+	}
+
 	ret = need_update_freq(domain, pm_qos_class, val);
 	if (ret < 0)
 		return NOTIFY_BAD;
@@ -634,6 +821,10 @@ static int exynos_cpufreq_policy_callback(struct notifier_block *nb,
 		update_boost_max_freq(domain, policy);
 		break;
 	case CPUFREQ_NOTIFY:
+		sched_energy_set_freq_limits(&domain->cpus,
+					policy->min, policy->max);
+		update_thermal_pressure(domain, policy->max,
+				pm_qos_request(domain->pm_qos_max_class));
 		break;
 	}
 
@@ -817,7 +1008,67 @@ static __init void init_sysfs(void)
 	return;
 }
 
-static __init int init_table(struct exynos_cpufreq_domain *domain)
+/*
+ * Register the energy model of the domain with the scheduler. The
+ * frequencies and the voltages of the ASV group of this part come from
+ * the ECT DVFS and ASV blocks through CAL, the dynamic power coefficient
+ * of the cluster from the ECT DTM_PWR_Coeff table, unless the domain
+ * node overrides it with dynamic-power-coefficient.
+ */
+static __init void init_energy_model(struct exynos_cpufreq_domain *domain,
+					struct device_node *dn,
+					unsigned long *table,
+					unsigned int *volt_table)
+{
+	struct ect_gen_param_table *pwr_coeff;
+	unsigned long *freqs;
+	unsigned int *volts;
+	unsigned int coeff = 0;
+	int cluster, index, nr = 0;
+	void *gen_block;
+
+	cluster = cpu_topology[cpumask_first(&domain->cpus)].cluster_id;
+
+	gen_block = ect_get_block("GEN");
+	if (gen_block) {
+		pwr_coeff = ect_gen_param_get_table(gen_block, "DTM_PWR_Coeff");
+		if (pwr_coeff && cluster < pwr_coeff->num_of_col *
+					    pwr_coeff->num_of_row)
+			coeff = pwr_coeff->parameter[cluster];
+	}
+	of_property_read_u32(dn, "dynamic-power-coefficient", &coeff);
+
+	if (!coeff) {
+		pr_info("No power coefficient for domain%d, no energy model\n",
+				domain->id);
+		return;
+	}
+
+	freqs = kcalloc(domain->table_size, sizeof(*freqs), GFP_KERNEL);
+	volts = kcalloc(domain->table_size, sizeof(*volts), GFP_KERNEL);
+	if (!freqs || !volts)
+		goto out;
+
+	for (index = 0; index < domain->table_size; index++) {
+		if (domain->freq_table[index].frequency == CPUFREQ_ENTRY_INVALID)
+			continue;
+
+		freqs[nr] = table[index];
+		volts[nr] = volt_table[index];
+		nr++;
+	}
+
+	if (sched_energy_add_domain(&domain->cpus, nr, freqs, volts, coeff))
+		pr_err("Failed to register energy model of domain%d\n",
+				domain->id);
+
+out:
+	kfree(volts);
+	kfree(freqs);
+}
+
+static __init int init_table(struct exynos_cpufreq_domain *domain,
+					struct device_node *dn)
 {
 	unsigned int index;
 	unsigned long *table;
@@ -870,6 +1121,8 @@ static __init int init_table(struct exynos_cpufreq_domain *domain)
 	domain->freq_table[index].driver_data = index;
 	domain->freq_table[index].frequency = CPUFREQ_TABLE_END;
 
+	init_energy_model(domain, dn, table, volt_table);
+
 	kfree(volt_table);
 
 free_table:
@@ -1153,7 +1406,7 @@ static __init int init_domain(struct exynos_cpufreq_domain *domain,
 init_table:
 	ufc_domain_init(domain);
 
-	ret = init_table(domain);
+	ret = init_table(domain, dn);
 	if (ret)
 		return ret;
 
@@ -1170,6 +1423,9 @@ init_table:
 	 */
 	init_dm(domain, dn);
 
+	/* Fast switching is optional as well, without it schedutil uses target */
+	init_fast_switch(domain);
+
 	pr_info("Complete to initialize cpufreq-domain%d\n", domain->id);
 
 	return ret;
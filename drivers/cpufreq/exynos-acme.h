@@ -10,6 +10,8 @@
 
 #include "exynos-ufc.h"
 #include <soc/samsung/exynos-dm.h>
+#include <linux/irq_work.h>
+#include <linux/kthread.h>
 #include <linux/pm_qos.h>
 
 struct exynos_cpufreq_dm {
@@ -37,6 +39,15 @@ struct exynos_cpufreq_domain {
 
 	/* frequency scaling */
 	bool				enabled;
+	/* bit 0 is held while the frequency is being switched */
+	unsigned long			switching;
+
+	/* fast switch, the ACPM IPC is deferred to fast_thread */
+	unsigned int			fast_target;
+	struct irq_work			fast_irq_work;
+	struct kthread_work		fast_work;
+	struct kthread_worker		fast_worker;
+	struct task_struct		*fast_thread;
 
 	unsigned int			table_size;
 	struct cpufreq_frequency_table	*freq_table;
@@ -95,6 +95,31 @@ static void exit_idle_state(struct cpuidle_profile_info *info,
 	info->usage[state].time += diff;
 }
 
+/*
+ * Check how well the idle state picked by the governor fit the residency
+ * that followed: it was too deep if the cpu woke up before the target
+ * residency of the state, and too shallow if the cpu stayed idle for the
+ * target residency of the next deeper state.
+ */
+static void check_state_selection(struct cpuidle_profile_info *info,
+					int state, ktime_t now)
+{
+	struct cpuidle_driver *drv = cpuidle_get_driver();
+	s64 residency;
+
+	if (!drv || state >= drv->state_count)
+		return;
+
+	residency = ktime_to_us(ktime_sub(now, info->last_entry_time));
+
+	if (residency < drv->states[state].target_residency)
+		info->usage[state].too_deep_count++;
+	else if (state + 1 < drv->state_count &&
+		 !drv->states[state + 1].disabled &&
+		 residency >= drv->states[state + 1].target_residency)
+		info->usage[state].too_shallow_count++;
+}
+
 /*
  * C2 subordinate state such as CPD and SICD can be entered by many cpus.
  * The variables which contains these idle states need to keep
@@ -158,6 +183,9 @@ void __cpuidle_profile_finish(int cpu, int earlywakeup)
 	int state = info->cur_state;
 	ktime_t now = ktime_get();
 
+	if (state_entered(state) && !earlywakeup)
+		check_state_selection(info, state, now);
+
 	exit_idle_state(info, state, now, earlywakeup);
 
 	spin_lock(&substate_lock);
@@ -250,6 +278,21 @@ static int total_idle_ratio(int cpu)
 	return calculate_percent(sum_idle_time(cpu));
 }
 
+/*
+ * Percentage of the entries that were neither too deep nor too shallow
+ * for the residency that followed. Early wakeups are not counted.
+ */
+static int selection_accuracy(struct cpuidle_profile_state_usage *usage)
+{
+	unsigned int entered = usage->entry_count - usage->early_wakeup_count;
+	unsigned int missed = usage->too_deep_count + usage->too_shallow_count;
+
+	if (!entered)
+		return 0;
+
+	return (entered - missed) * 100 / entered;
+}
+
 static void show_result(void)
 {
 	int i, idle_ip, bit, cpu;
@@ -277,12 +320,15 @@ static void show_result(void)
 
 	for (i = 0; i < state_count; i++) {
 		pr_info("[state%d]\n", i);
-		pr_info("#cpu   #entry   #early      #time    #ratio\n");
+		pr_info("#cpu   #entry   #early    #deep #shallow   #acc      #time    #ratio\n");
 		for_each_possible_cpu(cpu) {
 			info = &per_cpu(profile_info, cpu);
-			pr_info("cpu%d   %5u   %5u   %10lluus   %3u%%\n", cpu,
+			pr_info("cpu%d   %5u   %5u   %5u    %5u   %3u%%   %10lluus   %3u%%\n", cpu,
 				info->usage[i].entry_count,
 				info->usage[i].early_wakeup_count,
+				info->usage[i].too_deep_count,
+				info->usage[i].too_shallow_count,
+				selection_accuracy(&info->usage[i]),
 				info->usage[i].time,
 				calculate_percent(info->usage[i].time));
 		}
@@ -469,14 +515,17 @@ static ssize_t show_sysfs_result(struct kobject *kobj,
 		ret += snprintf(buf + ret, PAGE_SIZE - ret,
 			"[state%d]\n", i);
 		ret += snprintf(buf + ret, PAGE_SIZE - ret,
-			"#cpu   #entry   #early      #time    #ratio\n");
+			"#cpu   #entry   #early    #deep #shallow   #acc      #time    #ratio\n");
 		for_each_possible_cpu(cpu) {
 			info = &per_cpu(profile_info, cpu);
 			ret += snprintf(buf + ret, PAGE_SIZE - ret,
-				"cpu%d   %5u   %5u   %10lluus   %3u%%\n",
+				"cpu%d   %5u   %5u   %5u    %5u   %3u%%   %10lluus   %3u%%\n",
 				cpu,
 				info->usage[i].entry_count,
 				info->usage[i].early_wakeup_count,
+				info->usage[i].too_deep_count,
+				info->usage[i].too_shallow_count,
+				selection_accuracy(&info->usage[i]),
 				info->usage[i].time,
 				calculate_percent(info->usage[i].time));
 		}
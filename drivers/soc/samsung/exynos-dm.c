@@ -625,6 +625,21 @@ out:
 	return 0;
 }
 
+/*
+ * A DVFS driver that changes frequency without DM_CALL, because none of
+ * its constraint frequencies change (e.g. a cpufreq fast switch), reports
+ * the new frequency here. Otherwise the next DM_CALL compares its target
+ * with a stale current frequency and may skip the scaling or order the
+ * dependent domains wrongly. Lockless, callable from atomic context.
+ */
+void exynos_dm_update_cur_freq(enum exynos_dm_type dm_type, u32 freq)
+{
+	if (exynos_dm_index_validate(dm_type))
+		return;
+
+	WRITE_ONCE(exynos_dm->dm_data[dm_type].cur_freq, freq);
+}
+
 /*
  * Policy Updater
  *
@@ -20,6 +20,8 @@
 #include <linux/fs.h>
 #include <linux/list.h>
 #include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/sizes.h>
 #include <linux/slab.h>
 #include <linux/swap.h>
 #include "ion_priv.h"
@@ -47,6 +49,18 @@ static void ion_page_pool_free_pages(struct ion_page_pool *pool,
 	__free_pages(page, pool->order);
 }
 
+/* Expects pool->lock to be held */
+static void __ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
+{
+	if (PageHighMem(page)) {
+		list_add_tail(&page->lru, &pool->high_items);
+		pool->high_count++;
+	} else {
+		list_add_tail(&page->lru, &pool->low_items);
+		pool->low_count++;
+	}
+}
+
 static int ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
 {
 #ifdef CONFIG_DEBUG_LIST
@@ -57,13 +71,7 @@ static int ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
 		ion_clear_page_clean(page);
 
 	spin_lock(&pool->lock);
-	if (PageHighMem(page)) {
-		list_add_tail(&page->lru, &pool->high_items);
-		pool->high_count++;
-	} else {
-		list_add_tail(&page->lru, &pool->low_items);
-		pool->low_count++;
-	}
+	__ion_page_pool_add(pool, page);
 	spin_unlock(&pool->lock);
 	return 0;
 }
@@ -86,31 +94,149 @@ static struct page *ion_page_pool_remove(struct ion_page_pool *pool, bool high)
 	return page;
 }
 
+/*
+ * Moves up to pool->pcp_batch pages from the shared lists into the empty
+ * per-cpu cache with a single acquisition of pool->lock.
+ */
+static void ion_page_pool_refill_pcp(struct ion_page_pool *pool,
+				     struct ion_page_pool_pcp *pcp)
+{
+	spin_lock(&pool->lock);
+	while (pcp->count < pool->pcp_batch) {
+		struct page *page;
+
+		if (pool->high_count)
+			page = ion_page_pool_remove(pool, true);
+		else if (pool->low_count)
+			page = ion_page_pool_remove(pool, false);
+		else
+			break;
+		pcp->pages[pcp->count++] = page;
+	}
+	spin_unlock(&pool->lock);
+}
+
+/*
+ * Returns the @nr coldest pages of the per-cpu cache to the shared lists.
+ * Expects pcp->lock to be held.
+ */
+static void ion_page_pool_drain_pcp(struct ion_page_pool *pool,
+				    struct ion_page_pool_pcp *pcp, int nr)
+{
+	int i;
+
+	if (nr > pcp->count)
+		nr = pcp->count;
+	if (!nr)
+		return;
+
+	spin_lock(&pool->lock);
+	for (i = 0; i < nr; i++)
+		__ion_page_pool_add(pool, pcp->pages[i]);
+	spin_unlock(&pool->lock);
+
+	pcp->count -= nr;
+	memmove(pcp->pages, pcp->pages + nr, pcp->count * sizeof(pcp->pages[0]));
+}
+
+static void ion_page_pool_drain_all_pcp(struct ion_page_pool *pool)
+{
+	int cpu;
+
+	if (!pool->pcp)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct ion_page_pool_pcp *pcp = per_cpu_ptr(pool->pcp, cpu);
+
+		spin_lock(&pcp->lock);
+		ion_page_pool_drain_pcp(pool, pcp, pcp->count);
+		spin_unlock(&pcp->lock);
+	}
+}
+
+int ion_page_pool_pcp_count(struct ion_page_pool *pool)
+{
+	int cpu, count = 0;
+
+	if (!pool->pcp)
+		return 0;
+
+	for_each_possible_cpu(cpu)
+		count += READ_ONCE(per_cpu_ptr(pool->pcp, cpu)->count);
+
+	return count;
+}
+
 struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
 {
+	struct ion_page_pool_pcp *pcp;
 	struct page *page = NULL;
 
 	BUG_ON(!pool);
 
-	spin_lock(&pool->lock);
-	if (pool->high_count)
-		page = ion_page_pool_remove(pool, true);
-	else if (pool->low_count)
-		page = ion_page_pool_remove(pool, false);
-	spin_unlock(&pool->lock);
+	if (!pool->pcp) {
+		spin_lock(&pool->lock);
+		if (pool->high_count)
+			page = ion_page_pool_remove(pool, true);
+		else if (pool->low_count)
+			page = ion_page_pool_remove(pool, false);
+		spin_unlock(&pool->lock);
+
+		return page;
+	}
+
+	pcp = get_cpu_ptr(pool->pcp);
+	spin_lock(&pcp->lock);
+	if (!pcp->count)
+		ion_page_pool_refill_pcp(pool, pcp);
+	if (pcp->count)
+		page = pcp->pages[--pcp->count];
+	spin_unlock(&pcp->lock);
+	put_cpu_ptr(pool->pcp);
 
 	return page;
 }
 
 void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
 {
+	struct ion_page_pool_pcp *pcp;
 	int ret;
 
 	BUG_ON(pool->order != compound_order(page));
 
-	ret = ion_page_pool_add(pool, page);
-	if (ret)
-		ion_page_pool_free_pages(pool, page);
+	if (!pool->pcp) {
+		ret = ion_page_pool_add(pool, page);
+		if (ret)
+			ion_page_pool_free_pages(pool, page);
+		return;
+	}
+
+#ifdef CONFIG_DEBUG_LIST
+	BUG_ON(page->lru.next != LIST_POISON1 ||
+			page->lru.prev != LIST_POISON2);
+#endif
+	if (pool->cached)
+		ion_clear_page_clean(page);
+
+	pcp = get_cpu_ptr(pool->pcp);
+	spin_lock(&pcp->lock);
+	if (pcp->count >= pool->pcp_high)
+		ion_page_pool_drain_pcp(pool, pcp, pool->pcp_batch);
+	pcp->pages[pcp->count++] = page;
+	spin_unlock(&pcp->lock);
+	put_cpu_ptr(pool->pcp);
+}
+
+/*
+ * Adds a page prepared ahead of demand straight to the shared lists so that
+ * any cpu can pick it up.
+ */
+void ion_page_pool_fill(struct ion_page_pool *pool, struct page *page)
+{
+	BUG_ON(pool->order != compound_order(page));
+
+	ion_page_pool_add(pool, page);
 }
 
 void ion_page_pool_free_immediate(struct ion_page_pool *pool, struct page *page)
@@ -120,7 +246,7 @@ void ion_page_pool_free_immediate(struct ion_page_pool *pool, struct page *page)
 
 static int ion_page_pool_total(struct ion_page_pool *pool, bool high)
 {
-	int count = pool->low_count;
+	int count = pool->low_count + ion_page_pool_pcp_count(pool);
 
 	if (high)
 		count += pool->high_count;
@@ -142,6 +268,8 @@ int ion_page_pool_shrink(struct ion_page_pool *pool, gfp_t gfp_mask,
 	if (nr_to_scan == 0)
 		return ion_page_pool_total(pool, high);
 
+	ion_page_pool_drain_all_pcp(pool);
+
 	while (freed < nr_to_scan) {
 		struct page *page;
 
@@ -166,6 +294,8 @@ struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
 {
 	struct ion_page_pool *pool = kmalloc(sizeof(struct ion_page_pool),
 					     GFP_KERNEL);
+	int cpu;
+
 	if (!pool)
 		return NULL;
 	pool->high_count = 0;
@@ -177,11 +307,36 @@ struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
 	spin_lock_init(&pool->lock);
 	plist_node_init(&pool->list, order);
 
+	/*
+	 * Orders so large that a cache could not hold a couple of pages
+	 * within ION_PAGE_POOL_PCP_BYTES go to the shared lists directly.
+	 */
+	pool->pcp = NULL;
+	pool->pcp_high = min_t(int, ION_PAGE_POOL_PCP_BYTES >>
+					(PAGE_SHIFT + order),
+			       ION_PAGE_POOL_PCP_MAX);
+	pool->pcp_batch = pool->pcp_high / 2;
+	if (pool->pcp_batch) {
+		pool->pcp = alloc_percpu(struct ion_page_pool_pcp);
+		if (!pool->pcp) {
+			kfree(pool);
+			return NULL;
+		}
+		for_each_possible_cpu(cpu) {
+			struct ion_page_pool_pcp *pcp = per_cpu_ptr(pool->pcp,
+								    cpu);
+
+			spin_lock_init(&pcp->lock);
+			pcp->count = 0;
+		}
+	}
+
 	return pool;
 }
 
 void ion_page_pool_destroy(struct ion_page_pool *pool)
 {
+	free_percpu(pool->pcp);
 	kfree(pool);
 }
 
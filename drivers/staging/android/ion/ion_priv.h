@@ -462,17 +462,42 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
 #define ion_get_page_clean(page)	test_bit(PG_dcache_clean, &(page)->flags)
 #define ion_clear_page_clean(page)	clear_bit(PG_dcache_clean, &(page)->flags)
 
+/*
+ * Upper bound of pages held in each per-cpu cache of a pool. The actual
+ * capacity of a pool's cache is derived from its order so that a cache
+ * never holds more than ION_PAGE_POOL_PCP_BYTES.
+ */
+#define ION_PAGE_POOL_PCP_MAX		64
+#define ION_PAGE_POOL_PCP_BYTES		SZ_1M
+
+/**
+ * struct ion_page_pool_pcp - per-cpu page cache in front of a pool
+ * @lock:		protects this cache. Only the owning cpu takes it
+ *			except when the shrinker drains the cache.
+ * @count:		number of pages in @pages
+ * @pages:		stack of cached pages, hottest on top
+ */
+struct ion_page_pool_pcp {
+	spinlock_t lock;
+	int count;
+	struct page *pages[ION_PAGE_POOL_PCP_MAX];
+};
+
 /**
  * struct ion_page_pool - pagepool struct
  * @high_count:		number of highmem items in the pool
  * @low_count:		number of lowmem items in the pool
  * @high_items:		list of highmem items
  * @low_items:		list of lowmem items
- * @mutex:		lock protecting this struct and especially the count
+ * @lock:		lock protecting this struct and especially the count
  *			item list
  * @gfp_mask:		gfp_mask to use from alloc
  * @order:		order of pages in the pool
  * @list:		plist node for list of pools
+ * @pcp:		per-cpu caches, NULL if the order is too large
+ * @pcp_high:		number of pages that a per-cpu cache may hold
+ * @pcp_batch:		number of pages moved between a per-cpu cache and
+ *			the shared lists at once
  *
  * Allows you to keep a pool of pre allocated pages to use from your heap.
  * Keeping a pool of pages that is ready for dma, ie any cached mapping have
@@ -489,6 +514,9 @@ struct ion_page_pool {
 	unsigned int order;
 	bool cached;
 	struct plist_node list;
+	struct ion_page_pool_pcp __percpu *pcp;
+	int pcp_high;
+	int pcp_batch;
 };
 
 struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order);
@@ -496,6 +524,8 @@ void ion_page_pool_destroy(struct ion_page_pool *);
 void *ion_page_pool_alloc_pages(struct ion_page_pool *pool);
 struct page *ion_page_pool_alloc(struct ion_page_pool *);
 void ion_page_pool_free(struct ion_page_pool *, struct page *);
+void ion_page_pool_fill(struct ion_page_pool *, struct page *);
+int ion_page_pool_pcp_count(struct ion_page_pool *pool);
 void ion_page_pool_free_immediate(struct ion_page_pool *, struct page *);
 
 #ifdef CONFIG_ION_POOL_CACHE_POLICY
@@ -25,6 +25,7 @@
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/kthread.h>
+#include <linux/workqueue.h>
 #include <asm/tlbflush.h>
 #include "ion.h"
 #include "ion_priv.h"
@@ -37,6 +38,15 @@ static const int num_orders = ARRAY_SIZE(orders);
 static unsigned int fixed_max_order;
 static struct ion_system_heap *system_heap;
 
+/*
+ * Number of bytes that the prefill work keeps in each high order pool.
+ * Pages there are zeroed, and flushed for the uncached pools, so that
+ * the allocation path only has to take them off the pool. Off unless
+ * the platform sets it through ion_system_heap_prefill_kb, as it pins
+ * that much memory in every high order pool.
+ */
+static unsigned long prefill_bytes;
+
 static int order_to_index(unsigned int order)
 {
 	int i;
@@ -56,8 +66,63 @@ static inline unsigned int order_to_size(int order)
 struct ion_system_heap {
 	struct ion_heap heap;
 	struct ion_page_pool **pools;
+	struct work_struct prefill_work;
+	bool prefill_needed;
 };
 
+static int ion_page_pool_count(struct ion_page_pool *pool)
+{
+	return pool->high_count + pool->low_count +
+		ion_page_pool_pcp_count(pool);
+}
+
+static bool ion_page_pool_below_prefill(struct ion_page_pool *pool)
+{
+	unsigned long target = prefill_bytes >> (PAGE_SHIFT + pool->order);
+
+	return (unsigned long)ion_page_pool_count(pool) < target;
+}
+
+static void ion_system_heap_prefill(struct work_struct *work)
+{
+	struct ion_system_heap *heap = container_of(work,
+						    struct ion_system_heap,
+						    prefill_work);
+	int i;
+
+	for (i = 0; i < num_orders * 2; i++) {
+		struct ion_page_pool *pool = heap->pools[i];
+
+		if (!pool->order)
+			continue;
+
+		while (ion_page_pool_below_prefill(pool)) {
+			struct page *page = ion_page_pool_alloc_pages(pool);
+
+			/* no reclaim for high orders, try again next time */
+			if (!page)
+				return;
+
+			if (!pool->cached) {
+				__flush_dcache_area(page_address(page),
+						    PAGE_SIZE << pool->order);
+				ion_set_page_clean(page);
+			}
+			ion_page_pool_fill(pool, page);
+			cond_resched();
+		}
+	}
+}
+
+static void ion_system_heap_kick_prefill(struct ion_system_heap *heap)
+{
+	if (!READ_ONCE(heap->prefill_needed))
+		return;
+
+	WRITE_ONCE(heap->prefill_needed, false);
+	queue_work(system_unbound_wq, &heap->prefill_work);
+}
+
 static struct page *alloc_buffer_page(struct ion_system_heap *heap,
 				      struct ion_buffer *buffer,
 				      unsigned long order)
@@ -82,6 +147,10 @@ static struct page *alloc_buffer_page(struct ion_system_heap *heap,
 		page = ion_page_pool_alloc(pool);
 	}
 
+	if (order && prefill_bytes &&
+	    (!page || pool->high_count + pool->low_count == 0))
+		WRITE_ONCE(heap->prefill_needed, true);
+
 	if (!page)
 		page = ion_page_pool_alloc_pages(pool);
 
@@ -187,6 +256,7 @@ static int ion_system_heap_allocate(struct ion_heap *heap,
 	}
 
 	buffer->priv_virt = table;
+	ion_system_heap_kick_prefill(sys_heap);
 	return 0;
 
 free_table:
@@ -296,6 +366,10 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 		seq_printf(s, "%d order %u lowmem pages in cached pool = %lu total\n",
 			   pool->low_count, pool->order,
 			   (PAGE_SIZE << pool->order) * pool->low_count);
+		seq_printf(s, "%d order %u pages in cached per-cpu caches = %lu total\n",
+			   ion_page_pool_pcp_count(pool), pool->order,
+			   (PAGE_SIZE << pool->order) *
+			   ion_page_pool_pcp_count(pool));
 	}
 
 	for (i = num_orders; i < (num_orders * 2); i++) {
@@ -307,6 +381,10 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 		seq_printf(s, "%d order %u lowmem pages in uncached pool = %lu total\n",
 			   pool->low_count, pool->order,
 			   (PAGE_SIZE << pool->order) * pool->low_count);
+		seq_printf(s, "%d order %u pages in uncached per-cpu caches = %lu total\n",
+			   ion_page_pool_pcp_count(pool), pool->order,
+			   (PAGE_SIZE << pool->order) *
+			   ion_page_pool_pcp_count(pool));
 	}
 
 	return 0;
@@ -343,8 +421,7 @@ void show_ion_system_heap_pool_size(struct seq_file *s)
 
 	for (i = 0; i < num_orders * 2; i++) {
 		pool = system_heap->pools[i];
-		pool_size += (1 << pool->order) * pool->high_count;
-		pool_size += (1 << pool->order) * pool->low_count;
+		pool_size += (1 << pool->order) * ion_page_pool_count(pool);
 	}
 
 	if (s)
@@ -383,6 +460,33 @@ static struct kobj_attribute ion_system_heap_orders_attr =
 	__ATTR(ion_system_heap_orders, 0644,
 		ion_system_heap_orders_show, ion_system_heap_orders_store);
 
+static ssize_t ion_system_heap_prefill_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", prefill_bytes >> 10);
+}
+
+static ssize_t ion_system_heap_prefill_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t n)
+{
+	unsigned long kbytes;
+
+	if (kstrtoul(buf, 10, &kbytes))
+		return -EINVAL;
+
+	prefill_bytes = kbytes << 10;
+	if (prefill_bytes && system_heap) {
+		WRITE_ONCE(system_heap->prefill_needed, true);
+		ion_system_heap_kick_prefill(system_heap);
+	}
+	return n;
+}
+
+static struct kobj_attribute ion_system_heap_prefill_attr =
+	__ATTR(ion_system_heap_prefill_kb, 0644,
+		ion_system_heap_prefill_show, ion_system_heap_prefill_store);
+
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 {
 	struct ion_system_heap *heap;
@@ -413,9 +517,13 @@ struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 
 	heap->heap.debug_show = ion_system_heap_debug_show;
 	fixed_max_order = orders[0];
+	INIT_WORK(&heap->prefill_work, ion_system_heap_prefill);
 
 	if (sysfs_create_file(kernel_kobj, &ion_system_heap_orders_attr.attr))
 		pr_err("%s: Failed to create sysfs on ION system heap", __func__);
+	if (sysfs_create_file(kernel_kobj, &ion_system_heap_prefill_attr.attr))
+		pr_err("%s: Failed to create prefill sysfs on ION system heap",
+		       __func__);
 
 	if (!system_heap)
 		system_heap = heap;
@@ -440,6 +548,7 @@ void ion_system_heap_destroy(struct ion_heap *heap)
 							heap);
 	int i;
 
+	cancel_work_sync(&sys_heap->prefill_work);
 	for (i = 0; i < num_orders * 2; i++)
 		ion_page_pool_destroy(sys_heap->pools[i]);
 	kfree(sys_heap->pools);
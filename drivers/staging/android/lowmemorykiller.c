@@ -43,6 +43,11 @@
 #include <linux/profile.h>
 #include <linux/notifier.h>
 #include <linux/ratelimit.h>
+#include <linux/rculist.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <trace/events/sched.h>
+#include <trace/events/oom.h>
 
 
 #define CREATE_TRACE_POINTS
@@ -69,12 +74,218 @@ static int lmkd_cricount;
 
 static unsigned long lowmem_deathpending_timeout;
 
+/*
+ * The last task we killed, checked first by lowmem_death_pending()
+ * before it falls back to searching the whole index.
+ */
+static DEFINE_SPINLOCK(lowmem_victim_lock);
+static struct task_struct *lowmem_victim;
+
+static bool lowmem_victim_dying(void)
+{
+	struct task_struct *p;
+	bool dying = false;
+
+	spin_lock(&lowmem_victim_lock);
+	if (lowmem_victim &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		p = find_lock_task_mm(lowmem_victim);
+		if (p) {
+			dying = test_tsk_thread_flag(p, TIF_MEMDIE);
+			task_unlock(p);
+		}
+	}
+	spin_unlock(&lowmem_victim_lock);
+
+	return dying;
+}
+
+static void lowmem_set_victim(struct task_struct *p)
+{
+	get_task_struct(p);
+	spin_lock(&lowmem_victim_lock);
+	swap(lowmem_victim, p);
+	spin_unlock(&lowmem_victim_lock);
+	if (p)
+		put_task_struct(p);
+}
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			pr_info(x);			\
 	} while (0)
 
+/*
+ * Index of live processes bucketed by oom_score_adj, so that victim
+ * selection only visits the highest non-empty buckets instead of every
+ * process in the system. It is kept up to date from the fork, exit and
+ * oom_score_adj update tracepoints. Writers serialize on
+ * lowmem_adj_lock, which disables interrupts because the update hook
+ * runs under the irq-safe siglock. lowmem_scan() walks it under RCU:
+ * a signal_struct is unlinked when its last thread exits, which is a
+ * grace period before it can be freed.
+ */
+#define LOWMEM_ADJ_BUCKETS	(OOM_SCORE_ADJ_MAX - OOM_SCORE_ADJ_MIN + 1)
+
+static DEFINE_SPINLOCK(lowmem_adj_lock);
+static struct hlist_head lowmem_adj_buckets[LOWMEM_ADJ_BUCKETS];
+static DECLARE_BITMAP(lowmem_adj_bitmap, LOWMEM_ADJ_BUCKETS);
+
+static inline unsigned long lowmem_adj_bucket(short adj)
+{
+	return adj - OOM_SCORE_ADJ_MIN;
+}
+
+/* Caller holds lowmem_adj_lock */
+static void lowmem_adj_index_add(struct signal_struct *sig)
+{
+	unsigned long bucket = lowmem_adj_bucket(sig->oom_score_adj);
+
+	sig->lmk_adj = sig->oom_score_adj;
+	hlist_add_head_rcu(&sig->lmk_adj_node, &lowmem_adj_buckets[bucket]);
+	set_bit(bucket, lowmem_adj_bitmap);
+}
+
+/* Caller holds lowmem_adj_lock */
+static void lowmem_adj_index_del(struct signal_struct *sig)
+{
+	unsigned long bucket = lowmem_adj_bucket(sig->lmk_adj);
+
+	hlist_del_init_rcu(&sig->lmk_adj_node);
+	if (hlist_empty(&lowmem_adj_buckets[bucket]))
+		clear_bit(bucket, lowmem_adj_bitmap);
+}
+
+static void lowmem_adj_fork(void *ignore, struct task_struct *parent,
+			    struct task_struct *child)
+{
+	unsigned long flags;
+
+	if (!thread_group_leader(child) || (child->flags & PF_KTHREAD))
+		return;
+
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	if (hlist_unhashed(&child->signal->lmk_adj_node))
+		lowmem_adj_index_add(child->signal);
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+}
+
+static void lowmem_adj_exit(void *ignore, struct task_struct *tsk)
+{
+	struct signal_struct *sig = tsk->signal;
+	unsigned long flags;
+
+	/* only the last exiting thread removes the process */
+	if (atomic_read(&sig->live))
+		return;
+
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	if (!hlist_unhashed(&sig->lmk_adj_node))
+		lowmem_adj_index_del(sig);
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+}
+
+/* Called with task_lock() and the sighand lock of @task held */
+static void lowmem_adj_update(void *ignore, struct task_struct *task)
+{
+	struct signal_struct *sig = task->signal;
+	unsigned long flags;
+
+	if (task->flags & PF_KTHREAD)
+		return;
+
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	/* a process past lowmem_adj_exit() must not come back */
+	if (atomic_read(&sig->live)) {
+		if (hlist_unhashed(&sig->lmk_adj_node)) {
+			lowmem_adj_index_add(sig);
+		} else if (sig->lmk_adj != sig->oom_score_adj) {
+			lowmem_adj_index_del(sig);
+			lowmem_adj_index_add(sig);
+		}
+	}
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+}
+
+struct lowmem_adj_iter {
+	unsigned long bucket;		/* bucket of node */
+	unsigned long min_bucket;
+	struct hlist_node *node;
+};
+
+static void lowmem_adj_iter_init(struct lowmem_adj_iter *iter,
+				 short min_score_adj)
+{
+	iter->bucket = LOWMEM_ADJ_BUCKETS;
+	iter->min_bucket = lowmem_adj_bucket(min_score_adj);
+	iter->node = NULL;
+}
+
+/*
+ * Next process, from the highest oom_score_adj bucket down to
+ * min_score_adj. Caller holds rcu_read_lock(). A process whose
+ * oom_score_adj changes during the walk may be missed or seen twice,
+ * which is harmless for victim selection.
+ */
+static struct signal_struct *lowmem_adj_iter_next(struct lowmem_adj_iter *iter)
+{
+	struct hlist_node *node = NULL;
+	unsigned long bucket;
+
+	if (iter->node)
+		node = rcu_dereference(hlist_next_rcu(iter->node));
+
+	while (!node) {
+		bucket = find_last_bit(lowmem_adj_bitmap, iter->bucket);
+		if (bucket >= iter->bucket || bucket < iter->min_bucket)
+			return NULL;
+		iter->bucket = bucket;
+		node = rcu_dereference(hlist_first_rcu(
+					&lowmem_adj_buckets[bucket]));
+	}
+
+	iter->node = node;
+	return hlist_entry(node, struct signal_struct, lmk_adj_node);
+}
+
+/*
+ * Whether a victim, ours or the OOM killer's, is still exiting within
+ * lowmem_deathpending_timeout. The victim walk stops at min_score_adj
+ * and at the selected bucket, so it can not find them on the way; the
+ * whole index is searched instead, which only happens in the window
+ * after one of our own kills.
+ */
+static bool lowmem_death_pending(void)
+{
+	struct lowmem_adj_iter iter;
+	struct signal_struct *sig;
+	struct task_struct *p;
+	bool pending = false;
+
+	if (!time_before_eq(jiffies, lowmem_deathpending_timeout))
+		return false;
+	if (lowmem_victim_dying())
+		return true;
+
+	rcu_read_lock();
+	lowmem_adj_iter_init(&iter, OOM_SCORE_ADJ_MIN);
+	while (!pending && (sig = lowmem_adj_iter_next(&iter))) {
+		p = list_first_or_null_rcu(&sig->thread_head,
+					   struct task_struct, thread_node);
+		if (!p || (p->flags & PF_KTHREAD))
+			continue;
+		p = find_lock_task_mm(p);
+		if (!p)
+			continue;
+		pending = test_tsk_thread_flag(p, TIF_MEMDIE);
+		task_unlock(p);
+	}
+	rcu_read_unlock();
+
+	return pending;
+}
+
 static int test_task_flag(struct task_struct *p, int flag)
 {
 	struct task_struct *t = p;
@@ -154,6 +365,11 @@ static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
 {
 	struct task_struct *tsk;
 	struct task_struct *selected = NULL;
+	struct signal_struct *sig;
+	struct lowmem_adj_iter iter;
+	unsigned long selected_bucket = 0;
+	int nr_scanned = 0;
+	ktime_t start;
 	unsigned long rem = 0;
 	int tasksize;
 	int i;
@@ -202,11 +418,30 @@ static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
 
 	selected_oom_score_adj = min_score_adj;
 
+	start = ktime_get();
+	if (lowmem_death_pending()) {
+		trace_lowmemory_select(min_score_adj, OOM_SCORE_ADJ_MIN - 1,
+				       nr_scanned,
+				       ktime_to_ns(ktime_sub(ktime_get(), start)));
+		return SHRINK_STOP;
+	}
+
 	rcu_read_lock();
-	for_each_process(tsk) {
+	lowmem_adj_iter_init(&iter, min_score_adj);
+	while ((sig = lowmem_adj_iter_next(&iter))) {
 		struct task_struct *p;
 		short oom_score_adj;
 
+		/* nothing in a lower bucket can beat the selected task */
+		if (selected && iter.bucket != selected_bucket)
+			break;
+
+		tsk = list_first_or_null_rcu(&sig->thread_head,
+					     struct task_struct, thread_node);
+		if (!tsk)
+			continue;
+		nr_scanned++;
+
 		if (tsk->flags & PF_KTHREAD)
 			continue;
 
@@ -218,14 +453,9 @@ static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
 		if (!p)
 			continue;
 
+		/* pending deaths were handled by lowmem_death_pending() */
 		if (test_tsk_thread_flag(p, TIF_MEMDIE)) {
 			task_unlock(p);
-
-		    if (time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-				rcu_read_unlock();
-				return SHRINK_STOP;
-			}
-
 			continue;
 		}
 		if (p->state & TASK_UNINTERRUPTIBLE) {
@@ -264,6 +494,7 @@ static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
 				continue;
 		}
 		selected = p;
+		selected_bucket = iter.bucket;
 		selected_tasksize = tasksize;
 #if defined(CONFIG_ZSWAP)
 		selected_swap_rss = swap_rss;
@@ -272,6 +503,11 @@ static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
 		lowmem_print(2, "select '%s' (%d), adj %hd, size %d, to kill\n",
 			     p->comm, p->pid, oom_score_adj, tasksize);
 	}
+	trace_lowmemory_select(min_score_adj,
+			       selected ? selected_oom_score_adj :
+					  OOM_SCORE_ADJ_MIN - 1,
+			       nr_scanned,
+			       ktime_to_ns(ktime_sub(ktime_get(), start)));
 	if (selected) {
 #if defined(CONFIG_ZSWAP)
 		int orig_tasksize = selected_tasksize - selected_swap_rss;
@@ -317,6 +553,7 @@ static unsigned long lowmem_scan(struct shrinker *s, struct shrink_control *sc)
 		show_mem_extra_call_notifiers();
 		show_memory();
 		lowmem_deathpending_timeout = jiffies + HZ;
+		lowmem_set_victim(selected);
 		rem += selected_tasksize;
 		lowmem_lmkcount++;
 		if ((selected_oom_score_adj <= 100) && (__ratelimit(&lmk_rs)))
@@ -339,8 +576,54 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static int __init lowmem_adj_index_init(void)
+{
+	struct task_struct *tsk;
+	unsigned long flags;
+	int ret;
+
+	ret = register_trace_sched_process_fork(lowmem_adj_fork, NULL);
+	if (ret)
+		return ret;
+	ret = register_trace_sched_process_exit(lowmem_adj_exit, NULL);
+	if (ret)
+		goto unregister_fork;
+	ret = register_trace_oom_score_adj_update(lowmem_adj_update, NULL);
+	if (ret)
+		goto unregister_exit;
+
+	/* processes forked from here on are added by lowmem_adj_fork() */
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	rcu_read_lock();
+	for_each_process(tsk) {
+		if ((tsk->flags & PF_KTHREAD) ||
+		    !atomic_read(&tsk->signal->live) ||
+		    !hlist_unhashed(&tsk->signal->lmk_adj_node))
+			continue;
+		lowmem_adj_index_add(tsk->signal);
+	}
+	rcu_read_unlock();
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+
+	return 0;
+
+unregister_exit:
+	unregister_trace_sched_process_exit(lowmem_adj_exit, NULL);
+unregister_fork:
+	unregister_trace_sched_process_fork(lowmem_adj_fork, NULL);
+	return ret;
+}
+
 static int __init lowmem_init(void)
 {
+	int ret;
+
+	ret = lowmem_adj_index_init();
+	if (ret) {
+		pr_err("unable to hook the oom_score_adj index: %d\n", ret);
+		return ret;
+	}
+
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -34,6 +34,30 @@ TRACE_EVENT(lowmemory_kill,
 		__entry->pagecache_limit, __entry->free)
 );
 
+TRACE_EVENT(lowmemory_select,
+	TP_PROTO(short min_adj, short selected_adj, int nr_scanned,
+		 u64 latency_ns),
+
+	TP_ARGS(min_adj, selected_adj, nr_scanned, latency_ns),
+
+	TP_STRUCT__entry(
+			__field(short, min_adj)
+			__field(short, selected_adj)
+			__field(int, nr_scanned)
+			__field(u64, latency_ns)
+	),
+
+	TP_fast_assign(
+			__entry->min_adj = min_adj;
+			__entry->selected_adj = selected_adj;
+			__entry->nr_scanned = nr_scanned;
+			__entry->latency_ns = latency_ns;
+	),
+
+	TP_printk("min_adj %hd, selected adj %hd, scanned %d, %llu ns",
+		__entry->min_adj, __entry->selected_adj,
+		__entry->nr_scanned, __entry->latency_ns)
+);
 
 #endif /* if !defined(_TRACE_LOWMEMORYKILLER_H) || defined(TRACE_HEADER_MULTI_READ) */
 
@@ -25,6 +25,9 @@
 #include <linux/atomic.h>
 #include <linux/types.h>
 #include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/percpu.h>
 
 #include "vnswap.h"
 
@@ -40,21 +43,61 @@ struct page *swap_header_page;
  * vnswap_table [1] = 0, vnswap_table [3] = 1, vnswap_table [6] = 2,
  * vnswap_table [7] = 3,
  * vnswap_table [10] = 4, vnswap_table [Others] = -1
+ *
+ * Entries are protected by VNSWAP_TABLE_LOCK_SHARDS spinlocks picked by
+ * index, so faults on different slots rarely share a lock.
  */
-static DEFINE_SPINLOCK(vnswap_table_lock);
+static struct vnswap_table_lock_shard {
+	spinlock_t lock;
+} ____cacheline_aligned_in_smp vnswap_table_locks[VNSWAP_TABLE_LOCK_SHARDS];
 int *vnswap_table;
 
-/* Backing Storage bitmap information */
+static inline spinlock_t *vnswap_table_lock(u32 index)
+{
+	return &vnswap_table_locks[index &
+		(VNSWAP_TABLE_LOCK_SHARDS - 1)].lock;
+}
+
+/*
+ * Backing Storage bitmap information
+ *  - backing_storage_bitmap_lock protects the allocation cursor and the
+ *    free area search, it nests inside a vnswap_table lock.
+ */
 unsigned long *backing_storage_bitmap;
 unsigned int backing_storage_bitmap_last_allocated_index = -1;
+static DEFINE_SPINLOCK(backing_storage_bitmap_lock);
+
+/*
+ * Cluster allocator
+ *  - A cluster is either owned by one CPU, which allocates from it
+ *    front to back without any shared lock, or on the free cluster list
+ *    when none of its pages is used, or neither while partially used.
+ *  - used is updated atomically, ownership and the free cluster list
+ *    are protected by backing_storage_bitmap_lock.
+ */
+struct vnswap_cluster {
+	atomic_t used;		/* allocated pages in the cluster */
+	unsigned int next;	/* next free cluster on the list */
+	bool owned;		/* a CPU allocates from this cluster */
+};
+
+struct vnswap_percpu_cluster {
+	unsigned int cluster;	/* VNSWAP_CLUSTER_NULL if none */
+	unsigned int next;	/* next page to try inside the cluster */
+};
+
+static struct vnswap_cluster *vnswap_clusters;
+static unsigned int vnswap_nr_clusters;
+static unsigned int vnswap_free_cluster_head = VNSWAP_CLUSTER_NULL;
+static unsigned int vnswap_free_cluster_tail = VNSWAP_CLUSTER_NULL;
+static unsigned int vnswap_nr_free_clusters;
+static DEFINE_PER_CPU(struct vnswap_percpu_cluster, vnswap_percpu_cluster);
 
 /* Backing Storage bmap and bdev information */
 sector_t *backing_storage_bmap;
 struct block_device *backing_storage_bdev;
 struct file *backing_storage_file;
 
-static DEFINE_SPINLOCK(vnswap_original_bio_lock);
-
 void vnswap_init_disksize(u64 disksize)
 {
 	if ((vnswap_device->init_success & VNSWAP_INIT_DISKSIZE_SUCCESS) != 0x0) {
@@ -77,6 +120,57 @@ void vnswap_init_disksize(u64 disksize)
 	vnswap_device->init_success = VNSWAP_INIT_DISKSIZE_SUCCESS;
 }
 
+/* all clusters start free, in ascending order */
+static int vnswap_init_clusters(u64 bs_size)
+{
+	unsigned int i;
+	int cpu;
+
+	vnswap_nr_clusters = bs_size / VNSWAP_CLUSTER_PAGES;
+	if (!vnswap_nr_clusters) {
+		pr_err("%s %d: backing storage is smaller than a cluster\n",
+			__func__, __LINE__);
+		return -EINVAL;
+	}
+
+	vnswap_clusters = vmalloc(vnswap_nr_clusters *
+				sizeof(struct vnswap_cluster));
+	if (vnswap_clusters == NULL) {
+		pr_err("%s %d: alloc vnswap_clusters failed\n",
+			__func__, __LINE__);
+		vnswap_nr_clusters = 0;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < vnswap_nr_clusters; i++) {
+		atomic_set(&vnswap_clusters[i].used, 0);
+		vnswap_clusters[i].owned = false;
+		vnswap_clusters[i].next = i + 1;
+	}
+	vnswap_clusters[vnswap_nr_clusters - 1].next = VNSWAP_CLUSTER_NULL;
+	vnswap_free_cluster_head = 0;
+	vnswap_free_cluster_tail = vnswap_nr_clusters - 1;
+	vnswap_nr_free_clusters = vnswap_nr_clusters;
+
+	for_each_possible_cpu(cpu) {
+		per_cpu_ptr(&vnswap_percpu_cluster, cpu)->cluster =
+			VNSWAP_CLUSTER_NULL;
+		per_cpu_ptr(&vnswap_percpu_cluster, cpu)->next = 0;
+	}
+
+	return 0;
+}
+
+static void vnswap_deinit_clusters(void)
+{
+	vfree(vnswap_clusters);
+	vnswap_clusters = NULL;
+	vnswap_nr_clusters = 0;
+	vnswap_free_cluster_head = VNSWAP_CLUSTER_NULL;
+	vnswap_free_cluster_tail = VNSWAP_CLUSTER_NULL;
+	vnswap_nr_free_clusters = 0;
+}
+
 int vnswap_init_backing_storage(void)
 {
 	struct address_space *mapping;
@@ -195,10 +289,10 @@ int vnswap_init_backing_storage(void)
 				__func__, __LINE__,
 				sizeof(unsigned long) * 8,
 				vnswap_device->bs_size,
-				vnswap_device->bs_size / ((sizeof(unsigned long) * 8) * 
-					(sizeof(unsigned long) * 8)));
-		vnswap_device->bs_size = vnswap_device->bs_size /
-		((sizeof(unsigned long) * 8) * (sizeof(unsigned long) * 8));
+				vnswap_device->bs_size -
+				vnswap_device->bs_size % (sizeof(unsigned long) * 8));
+		vnswap_device->bs_size -=
+			vnswap_device->bs_size % (sizeof(unsigned long) * 8);
 	}
 
 	backing_storage_bitmap = vmalloc(vnswap_device->bs_size / 8);
@@ -218,6 +312,10 @@ int vnswap_init_backing_storage(void)
 		goto free_bitmap;
 	}
 
+	ret = vnswap_init_clusters(vnswap_device->bs_size);
+	if (ret)
+		goto free_bmap;
+
 	for (probe_block = 0; probe_block < last_block; probe_block++) {
 		first_block = bmap(inode, probe_block);
 		if (first_block == 0) {
@@ -299,6 +397,7 @@ int vnswap_init_backing_storage(void)
 	return ret;
 
 free_bmap:
+	vnswap_deinit_clusters();
 	vfree(backing_storage_bmap);
 
 free_bitmap:
@@ -339,11 +438,17 @@ int vnswap_deinit_backing_storage(void)
 			vfree(backing_storage_bmap);
 			backing_storage_bmap = NULL;
 		}
+
+		vnswap_deinit_clusters();
 	}
 	return 0;
 }
 
-/* find free area (nand_offset, page_offset) in backing storage */
+/*
+ * find free area (nand_offset, page_offset) in backing storage and
+ * claim it. Linear search, only used once no free cluster is left.
+ * Caller holds backing_storage_bitmap_lock.
+ */
 int vnswap_find_free_area_in_backing_storage(int *nand_offset)
 {
 	int i, found = 0;
@@ -356,9 +461,10 @@ int vnswap_find_free_area_in_backing_storage(int *nand_offset)
 		return -ENOSPC;
 	}
 
+	/* CPUs own clusters claim pages concurrently, hence test_and_set */
 	for (i = backing_storage_bitmap_last_allocated_index + 1;
 		i < vnswap_device->bs_size; i++)
-		if (!test_bit(i, backing_storage_bitmap)) {
+		if (!test_and_set_bit(i, backing_storage_bitmap)) {
 			found = 1;
 			break;
 		}
@@ -367,7 +473,7 @@ int vnswap_find_free_area_in_backing_storage(int *nand_offset)
 		for (i = 0;
 			i < backing_storage_bitmap_last_allocated_index;
 			i++)
-			if (!test_bit(i, backing_storage_bitmap)) {
+			if (!test_and_set_bit(i, backing_storage_bitmap)) {
 				found = 1;
 				break;
 			}
@@ -383,238 +489,247 @@ int vnswap_find_free_area_in_backing_storage(int *nand_offset)
 	}
 	*nand_offset =
 		backing_storage_bitmap_last_allocated_index = i;
+	if (i < vnswap_nr_clusters * VNSWAP_CLUSTER_PAGES)
+		atomic_inc(&vnswap_clusters[i / VNSWAP_CLUSTER_PAGES].used);
 	return i;
 }
 
-/* refer req_bio_endio() */
-void vnswap_bio_end_read(struct bio *bio)
+/* Caller holds backing_storage_bitmap_lock */
+static void vnswap_add_free_cluster(unsigned int cluster)
 {
-	const int err = bio->bi_error;
-	struct bio *original_bio = (struct bio *) bio->bi_private;
-	unsigned long flags;
+	vnswap_clusters[cluster].next = VNSWAP_CLUSTER_NULL;
+	if (vnswap_free_cluster_tail == VNSWAP_CLUSTER_NULL)
+		vnswap_free_cluster_head = cluster;
+	else
+		vnswap_clusters[vnswap_free_cluster_tail].next = cluster;
+	vnswap_free_cluster_tail = cluster;
+	vnswap_nr_free_clusters++;
+}
 
-	dprintk("%s %d: (uptodate,error,bi_size) = (%d, %d, %d)\n",
-			__func__, __LINE__, uptodate, err, bio->bi_iter.bi_size);
+/* Caller holds backing_storage_bitmap_lock */
+static unsigned int vnswap_take_free_cluster(void)
+{
+	unsigned int cluster = vnswap_free_cluster_head;
 
-	if (err) {
-		atomic_inc(&vnswap_device->stats.vnswap_bio_end_fail_r1_num);
-		pr_err("%s %d: (error, bio->bi_iter.bi_size, original_bio->bi_iter.bi_size," \
-				"bio->bi_vcnt, original_bio->bi_vcnt, " \
-				"bio->bi_iter.bi_idx," \
-				"original_bio->bi_iter.bi_idx, " \
-				"vnswap_bio_end_fail_r1_num ~" \
-				"vnswap_bio_end_fail_r3_num) =" \
-				"(%d, %d, %d, %d, %d, %d, %d, %d, %d, %d)\n",
-				__func__, __LINE__, err, bio->bi_iter.bi_size,
-				original_bio->bi_iter.bi_size,
-				bio->bi_vcnt, original_bio->bi_vcnt,
-				bio->bi_iter.bi_idx,
-				original_bio->bi_iter.bi_idx,
-				vnswap_device->stats.
-					vnswap_bio_end_fail_r1_num.counter,
-				vnswap_device->stats.
-					vnswap_bio_end_fail_r2_num.counter,
-				vnswap_device->stats.
-					vnswap_bio_end_fail_r3_num.counter);
-		bio_io_error(original_bio);
-		goto out_bio_put;
-	} else {
-		/*
-		* There are bytes yet to be transferred.
-		* blk_end_request() -> blk_end_bidi_request() ->
-		* blk_update_bidi_request() ->
-		* blk_update_request() -> req_bio_endio() ->
-		* bio->bi_iter.bi_size -= nbytes;
-		*/
-		spin_lock_irqsave(&vnswap_original_bio_lock, flags);
-		original_bio->bi_iter.bi_size -= (PAGE_SIZE-bio->bi_iter.bi_size);
+	if (cluster == VNSWAP_CLUSTER_NULL)
+		return cluster;
 
-		if (bio->bi_iter.bi_size == PAGE_SIZE) {
-			atomic_inc(&vnswap_device->stats.
-				vnswap_bio_end_fail_r2_num);
-			pr_err("%s %d: (error, bio->bi_iter.bi_size, " \
-					"original_bio->bi_iter.bi_size," \
-					"bio->bi_vcnt," \
-					"original_bio->bi_vcnt, bio->bi_iter.bi_idx, " \
-					"original_bio->bi_iter.bi_idx," \
-					"vnswap_bio_end_fail_r1_num ~ " \
-					"vnswap_bio_end_fail_r3_num) = " \
-					"(%d, %d, %d, %d, %d, %d, %d, %d, %d, %d)\n",
-					__func__, __LINE__, err, bio->bi_iter.bi_size,
-					original_bio->bi_iter.bi_size,
-					bio->bi_vcnt, original_bio->bi_vcnt,
-					bio->bi_iter.bi_idx,
-					original_bio->bi_iter.bi_idx,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_r1_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_r2_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_r3_num.
-						counter);
-			spin_unlock_irqrestore(&vnswap_original_bio_lock,
-				flags);
-			goto out_bio_put;
+	vnswap_free_cluster_head = vnswap_clusters[cluster].next;
+	if (vnswap_free_cluster_head == VNSWAP_CLUSTER_NULL)
+		vnswap_free_cluster_tail = VNSWAP_CLUSTER_NULL;
+	vnswap_nr_free_clusters--;
+	vnswap_clusters[cluster].owned = true;
+	return cluster;
+}
+
+/*
+ * Allocate one backing storage page. The fast path takes the next free
+ * page of this CPU's cluster without any shared lock, so consecutive
+ * writes from one CPU get consecutive blocks. Called with interrupts
+ * disabled, which keeps us on this CPU.
+ */
+static int vnswap_alloc_backing_block(int *nand_offset)
+{
+	struct vnswap_percpu_cluster *pcc =
+		this_cpu_ptr(&vnswap_percpu_cluster);
+	unsigned long base, offset;
+	int ret;
+
+	for (;;) {
+		if (pcc->cluster != VNSWAP_CLUSTER_NULL) {
+			base = (unsigned long)pcc->cluster *
+				VNSWAP_CLUSTER_PAGES;
+			offset = find_next_zero_bit(backing_storage_bitmap,
+					base + VNSWAP_CLUSTER_PAGES,
+					base + pcc->next);
+			if (offset < base + VNSWAP_CLUSTER_PAGES) {
+				pcc->next = offset - base + 1;
+				if (test_and_set_bit(offset,
+						backing_storage_bitmap))
+					continue;
+				atomic_inc(&vnswap_clusters[pcc->cluster].used);
+				*nand_offset = offset;
+				return offset;
+			}
 		}
 
-		if (bio->bi_iter.bi_size || original_bio->bi_iter.bi_size) {
-			atomic_inc(&vnswap_device->stats.
-				vnswap_bio_end_fail_r3_num);
-			pr_err("%s %d: (error, bio->bi_iter.bi_size, " \
-					"original_bio->bi_iter.bi_size," \
-					"bio->bi_vcnt," \
-					"original_bio->bi_vcnt, bio->bi_iter.bi_idx, " \
-					"original_bio->bi_iter.bi_idx," \
-					"vnswap_bio_end_fail_r1_num ~ " \
-					"vnswap_bio_end_fail_r3_num) = " \
-					"(%d, %d, %d, %d, %d, %d, %d, %d, %d, %d)\n",
-					__func__, __LINE__, err, bio->bi_iter.bi_size,
-					original_bio->bi_iter.bi_size,
-					bio->bi_vcnt, original_bio->bi_vcnt,
-					bio->bi_iter.bi_idx, original_bio->bi_iter.bi_idx,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_r1_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_r2_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_r3_num.
-						counter);
-			spin_unlock_irqrestore(&vnswap_original_bio_lock,
-				flags);
-			goto out_bio_put;
+		/* cluster used up, switch to the next free one */
+		spin_lock(&backing_storage_bitmap_lock);
+		if (pcc->cluster != VNSWAP_CLUSTER_NULL) {
+			vnswap_clusters[pcc->cluster].owned = false;
+			if (!atomic_read(&vnswap_clusters[pcc->cluster].used))
+				vnswap_add_free_cluster(pcc->cluster);
 		}
+		pcc->cluster = vnswap_take_free_cluster();
+		pcc->next = 0;
+		if (pcc->cluster == VNSWAP_CLUSTER_NULL)
+			break;
+		spin_unlock(&backing_storage_bitmap_lock);
+	}
+
+	/* no free cluster left, fall back to any free page */
+	atomic_inc(&vnswap_device->stats.vnswap_cluster_fallback_num);
+	ret = vnswap_find_free_area_in_backing_storage(nand_offset);
+	spin_unlock(&backing_storage_bitmap_lock);
+	return ret;
+}
+
+static void vnswap_free_backing_block(int nand_offset)
+{
+	unsigned int cluster = nand_offset / VNSWAP_CLUSTER_PAGES;
+
+	spin_lock(&backing_storage_bitmap_lock);
+	clear_bit(nand_offset, backing_storage_bitmap);
+	if (cluster < vnswap_nr_clusters &&
+		atomic_dec_and_test(&vnswap_clusters[cluster].used) &&
+		!vnswap_clusters[cluster].owned)
+		vnswap_add_free_cluster(cluster);
 
-		original_bio->bi_error = 0;
-		spin_unlock_irqrestore(&vnswap_original_bio_lock, flags);
-		bio_endio(original_bio);
+	/* When Backing Storage is full, set Backing Storage is not full */
+	if (backing_storage_bitmap_last_allocated_index ==
+		vnswap_device->bs_size) {
+		backing_storage_bitmap_last_allocated_index = nand_offset;
 	}
+	spin_unlock(&backing_storage_bitmap_lock);
+}
 
-out_bio_put:
-	bio_put(bio);
+void vnswap_get_frag_info(struct vnswap_frag_info *info)
+{
+	spin_lock_irq(&backing_storage_bitmap_lock);
+	info->free_pages = vnswap_device->bs_size -
+		atomic_read(&vnswap_device->stats.vnswap_used_slot_num);
+	info->free_clusters = vnswap_nr_free_clusters;
+	info->total_clusters = vnswap_nr_clusters;
+	spin_unlock_irq(&backing_storage_bitmap_lock);
 }
 
-/* refer req_bio_endio() */
-void vnswap_bio_end_write(struct bio *bio)
+/*
+ * Completion of a backing storage bio. It carries every original bio
+ * merged into it, chained through bi_next, and each of them owns exactly
+ * one page of it, so they are completed without any shared lock.
+ */
+static void vnswap_bio_end_io(struct bio *bio)
 {
 	const int err = bio->bi_error;
 	struct bio *original_bio = (struct bio *) bio->bi_private;
-	unsigned long flags;
+	struct bio *next;
 
-	dprintk("%s %d: (error, bi_size) = (%d, %d)\n",
-			__func__, __LINE__, err, bio->bi_iter.bi_size);
+	dprintk("%s %d: (rw, error, bi_vcnt) = (%d, %d, %d)\n",
+			__func__, __LINE__, bio_data_dir(bio), err,
+			bio->bi_vcnt);
 
 	if (err) {
-		atomic_inc(&vnswap_device->stats.vnswap_bio_end_fail_w1_num);
-		pr_err("%s %d: (error, bio->bi_iter.bi_size, original_bio->bi_iter.bi_size, " \
-				"bio->bi_vcnt," \
-				"original_bio->bi_vcnt, bio->bi_iter.bi_idx, " \
-				"original_bio->bi_iter.bi_idx," \
-				"vnswap_bio_end_fail_w1_num ~ " \
-				"vnswap_bio_end_fail_w3_num) = " \
-				"(%d, %d, %d, %d, %d, %d, %d, %d, %d, %d)\n",
-				__func__, __LINE__, err, bio->bi_iter.bi_size,
-				original_bio->bi_iter.bi_size,
-				bio->bi_vcnt, original_bio->bi_vcnt,
-				bio->bi_iter.bi_idx,
-				original_bio->bi_iter.bi_idx,
-				vnswap_device->stats.
-					vnswap_bio_end_fail_w1_num.counter,
-				vnswap_device->stats.
-					vnswap_bio_end_fail_w2_num.counter,
-				vnswap_device->stats.
-					vnswap_bio_end_fail_w3_num.counter);
-		bio_io_error(original_bio);
-		goto out_bio_put;
-	} else {
-		/*
-		* There are bytes yet to be transferred.
-		* blk_end_request() -> blk_end_bidi_request() ->
-		* blk_update_bidi_request() ->
-		* blk_update_request() -> req_bio_endio() ->
-		* bio->bi_iter.bi_size -= nbytes;
-		*/
-		spin_lock_irqsave(&vnswap_original_bio_lock, flags);
-		original_bio->bi_iter.bi_size -= (PAGE_SIZE-bio->bi_iter.bi_size);
+		if (bio_data_dir(bio) == READ)
+			atomic_add(bio->bi_vcnt, &vnswap_device->stats.
+				vnswap_bio_end_fail_r1_num);
+		else
+			atomic_add(bio->bi_vcnt, &vnswap_device->stats.
+				vnswap_bio_end_fail_w1_num);
+		pr_err("%s %d: (rw, error, bio->bi_iter.bi_sector, " \
+				"bio->bi_vcnt) = (%d, %d, %llu, %d)\n",
+				__func__, __LINE__, bio_data_dir(bio), err,
+				(unsigned long long) bio->bi_iter.bi_sector,
+				bio->bi_vcnt);
+	}
 
-		if (bio->bi_iter.bi_size == PAGE_SIZE) {
-			atomic_inc(&vnswap_device->stats.
-				vnswap_bio_end_fail_w2_num);
-			pr_err("%s %d: (error, bio->bi_iter.bi_size, " \
-					"original_bio->bi_iter.bi_size, " \
-					"bio->bi_vcnt," \
-					"original_bio->bi_vcnt, bio->bi_iter.bi_idx, " \
-					"original_bio->bi_iter.bi_idx," \
-					"vnswap_bio_end_fail_w1_num ~ " \
-					"vnswap_bio_end_fail_w3_num) = " \
-					"(%d, %d, %d, %d, %d, %d, %d, %d, %d, %d)\n",
-					__func__, __LINE__, err, bio->bi_iter.bi_size,
-					original_bio->bi_iter.bi_size,
-					bio->bi_vcnt, original_bio->bi_vcnt,
-					bio->bi_iter.bi_idx,
-					original_bio->bi_iter.bi_idx,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_w1_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_w2_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_w3_num.
-						counter);
-			spin_unlock_irqrestore(&vnswap_original_bio_lock,
-				flags);
-			goto out_bio_put;
+	while (original_bio) {
+		next = original_bio->bi_next;
+		original_bio->bi_next = NULL;
+		if (err) {
+			bio_io_error(original_bio);
+		} else {
+			original_bio->bi_iter.bi_size = 0;
+			original_bio->bi_error = 0;
+			bio_endio(original_bio);
 		}
+		original_bio = next;
+	}
 
-		if (bio->bi_iter.bi_size || original_bio->bi_iter.bi_size) {
-			atomic_inc(&vnswap_device->stats.
-				vnswap_bio_end_fail_w3_num);
-			pr_err("%s %d: (error, bio->bi_iter.bi_size, " \
-					"original_bio->bi_iter.bi_size, " \
-					"bio->bi_vcnt," \
-					"original_bio->bi_vcnt, bio->bi_iter.bi_idx, " \
-					"original_bio->bi_iter.bi_idx," \
-					"vnswap_bio_end_fail_w1_num ~ " \
-					"vnswap_bio_end_fail_w3_num) = " \
-					"(%d, %d, %d, %d, %d, %d, %d, %d, %d, %d)\n",
-					__func__, __LINE__, err, bio->bi_iter.bi_size,
-					original_bio->bi_iter.bi_size,
-					bio->bi_vcnt, original_bio->bi_vcnt,
-					bio->bi_iter.bi_idx,
-					original_bio->bi_iter.bi_idx,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_w1_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_w2_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_w3_num.
-						counter);
-			spin_unlock_irqrestore(&vnswap_original_bio_lock,
-				flags);
-			goto out_bio_put;
-		}
+	bio_put(bio);
+}
+
+/*
+ * Plug/merge layer. While the submitter holds a blk_plug (reclaim writes
+ * swap out under one, swapin_readahead() reads neighbouring slots under
+ * one), pages whose backing storage blocks are physically contiguous are
+ * gathered into a single bio of up to VNSWAP_BATCH_PAGES pages, which is
+ * submitted when the next page does not fit or the plug is flushed.
+ */
+struct vnswap_plug {
+	struct blk_plug_cb cb;
+	struct work_struct work;
+	struct bio *bio;	/* batch being built, NULL if none */
+	struct bio_list original_bios;
+	sector_t next_sector;	/* sector following the batch */
+	int rw;
+};
+
+static void vnswap_plug_submit(struct vnswap_plug *plug)
+{
+	struct bio *bio = plug->bio;
+
+	if (!bio)
+		return;
 
-		original_bio->bi_error = 0;
-		spin_unlock_irqrestore(&vnswap_original_bio_lock,
-			flags);
-		bio_endio(original_bio);
+	bio->bi_private = bio_list_get(&plug->original_bios);
+	plug->bio = NULL;
+	if (bio->bi_vcnt > 1)
+		atomic_add(bio->bi_vcnt - 1,
+			&vnswap_device->stats.vnswap_bio_merged_num);
+	submit_bio(plug->rw, bio);
+}
+
+static void vnswap_unplug_work(struct work_struct *work)
+{
+	struct vnswap_plug *plug = container_of(work, struct vnswap_plug,
+						work);
+
+	vnswap_plug_submit(plug);
+	kfree(plug);
+}
+
+static void vnswap_unplug(struct blk_plug_cb *cb, bool from_schedule)
+{
+	struct vnswap_plug *plug = container_of(cb, struct vnswap_plug, cb);
+
+	/*
+	 * Flushed on the way into schedule(): submitting there could sleep
+	 * on request allocation and clobber the caller's task state, so
+	 * hand the batch to a worker like md does.
+	 */
+	if (from_schedule) {
+		INIT_WORK(&plug->work, vnswap_unplug_work);
+		schedule_work(&plug->work);
+		return;
 	}
 
-out_bio_put:
-	bio_put(bio);
+	vnswap_plug_submit(plug);
+	kfree(plug);
+}
+
+static struct bio *vnswap_alloc_bio(sector_t sector, int nr_pages)
+{
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, nr_pages);
+	if (!bio) {
+		atomic_inc(&vnswap_device->stats.vnswap_bio_no_mem_num);
+		return NULL;
+	}
+
+	bio->bi_iter.bi_sector = sector;
+	bio->bi_bdev = backing_storage_bdev;
+	bio->bi_end_io = vnswap_bio_end_io;
+	return bio;
 }
 
 /* Insert entry into VNSWAP_IO sub system */
 int vnswap_submit_bio(int rw, int nand_offset,
 	struct page *page, struct bio *original_bio)
 {
+	struct vnswap_plug *plug;
 	struct bio *bio;
+	sector_t sector;
 	int ret = 0;
 
 	if (!rw) {
@@ -622,33 +737,42 @@ int vnswap_submit_bio(int rw, int nand_offset,
 		VM_BUG_ON(PageUptodate(page));
 	}
 
-	bio = bio_alloc(GFP_NOIO, 1);
-
-	if (!bio) {
-		atomic_inc(&vnswap_device->stats.vnswap_bio_no_mem_num);
-		ret = -ENOMEM;
-		goto out;
-	}
-
-	bio->bi_iter.bi_sector = (backing_storage_bmap[nand_offset] <<
-					(PAGE_SHIFT - 9));
-	bio->bi_bdev = backing_storage_bdev;
-	bio->bi_io_vec[0].bv_page = page;
-	bio->bi_io_vec[0].bv_len = PAGE_SIZE;
-	bio->bi_io_vec[0].bv_offset = 0;
-	bio->bi_vcnt = 1;
-	bio->bi_iter.bi_idx = 0;
-	bio->bi_iter.bi_size = PAGE_SIZE;
-	bio->bi_private = (void *) original_bio;
-	if (rw)
-		bio->bi_end_io = vnswap_bio_end_write;
-	else
-		bio->bi_end_io = vnswap_bio_end_read;
+	sector = backing_storage_bmap[nand_offset] << (PAGE_SHIFT - 9);
 
 	dprintk("%s %d: (rw, nand_offset) = (%d,%d)\n",
 			__func__, __LINE__, rw, nand_offset);
 
-	submit_bio(rw, bio);
+	plug = (struct vnswap_plug *) blk_check_plugged(vnswap_unplug,
+				vnswap_device, sizeof(struct vnswap_plug));
+	if (plug) {
+		/* append to the batch if this block directly follows it */
+		if (plug->bio && (plug->rw != rw ||
+				plug->next_sector != sector ||
+				!bio_add_page(plug->bio, page, PAGE_SIZE, 0)))
+			vnswap_plug_submit(plug);
+
+		if (!plug->bio) {
+			plug->bio = vnswap_alloc_bio(sector,
+						VNSWAP_BATCH_PAGES);
+			if (!plug->bio) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			bio_add_page(plug->bio, page, PAGE_SIZE, 0);
+			plug->rw = rw;
+		}
+		plug->next_sector = sector + SECTORS_PER_PAGE;
+		bio_list_add(&plug->original_bios, original_bio);
+	} else {
+		bio = vnswap_alloc_bio(sector, 1);
+		if (!bio) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		bio_add_page(bio, page, PAGE_SIZE, 0);
+		bio->bi_private = (void *) original_bio;
+		submit_bio(rw, bio);
+	}
 
 	if (rw) {
 		atomic_inc(&vnswap_device->stats.
@@ -659,7 +783,6 @@ int vnswap_submit_bio(int rw, int nand_offset,
 		atomic_inc(&vnswap_device->stats.
 			vnswap_read_pages);
 	}
-	/* TODO: check bio->bi_flags */
 
 out:
 	return ret;
@@ -685,7 +808,7 @@ int vnswap_bvec_read(struct vnswap *vnswap, struct bio_vec bvec,
 		return 0;
 	}
 
-	spin_lock_irq(&vnswap_table_lock);
+	spin_lock_irq(vnswap_table_lock(index));
 	nand_offset = vnswap_table[index];
 	if (nand_offset == -1) {
 		pr_err("%s %d: vnswap_table is not mapped. " \
@@ -694,10 +817,10 @@ int vnswap_bvec_read(struct vnswap *vnswap, struct bio_vec bvec,
 				index, nand_offset);
 		ret = -EIO;
 		atomic_inc(&vnswap_device->stats.vnswap_not_mapped_read_pages);
-		spin_unlock_irq(&vnswap_table_lock);
+		spin_unlock_irq(vnswap_table_lock(index));
 		goto out;
 	}
-	spin_unlock_irq(&vnswap_table_lock);
+	spin_unlock_irq(vnswap_table_lock(index));
 
 	dprintk("%s %d: (index, nand_offset) = (%d, %d)\n",
 			__func__, __LINE__, index, nand_offset);
@@ -728,14 +851,14 @@ int vnswap_bvec_write(struct vnswap *vnswap, struct bio_vec bvec,
 		return 0;
 	}
 
-	spin_lock_irq(&vnswap_table_lock);
+	spin_lock_irq(vnswap_table_lock(index));
 	nand_offset = vnswap_table[index];
 
 	/* duplicate write - remove existing mapping */
 	if (nand_offset != -1) {
 		atomic_inc(&vnswap_device->stats.
 			vnswap_double_mapped_slot_num);
-		clear_bit(nand_offset, backing_storage_bitmap);
+		vnswap_free_backing_block(nand_offset);
 		vnswap_table[index] = -1;
 		atomic_dec(&vnswap_device->stats.
 			vnswap_used_slot_num);
@@ -743,25 +866,25 @@ int vnswap_bvec_write(struct vnswap *vnswap, struct bio_vec bvec,
 			vnswap_stored_pages);
 	}
 
-	ret = vnswap_find_free_area_in_backing_storage(&nand_offset);
+	ret = vnswap_alloc_backing_block(&nand_offset);
 	if (ret < 0) {
-		spin_unlock_irq(&vnswap_table_lock);
+		spin_unlock_irq(vnswap_table_lock(index));
 		return ret;
 	}
-	set_bit(nand_offset, backing_storage_bitmap);
 	vnswap_table[index] = nand_offset;
 	atomic_inc(&vnswap_device->stats.vnswap_used_slot_num);
-	spin_unlock_irq(&vnswap_table_lock);
+	spin_unlock_irq(vnswap_table_lock(index));
 
 	dprintk("%s %d: (index, nand_offset) = (%d, %d)\n",
 			__func__, __LINE__, index, nand_offset);
 	ret = vnswap_submit_bio(1, nand_offset, page, bio);
 
 	if (ret) {
-		spin_lock_irq(&vnswap_table_lock);
-		clear_bit(nand_offset, backing_storage_bitmap);
+		spin_lock_irq(vnswap_table_lock(index));
+		vnswap_free_backing_block(nand_offset);
 		vnswap_table[index] = -1;
-		spin_unlock_irq(&vnswap_table_lock);
+		atomic_dec(&vnswap_device->stats.vnswap_used_slot_num);
+		spin_unlock_irq(vnswap_table_lock(index));
 	}
 
 	return ret;
@@ -779,11 +902,15 @@ int vnswap_bvec_rw(struct vnswap *vnswap, struct bio_vec bvec,
 		ret = vnswap_bvec_read(vnswap, bvec, index, bio);
 		up_read(&vnswap->lock);
 	} else {
-		down_write(&vnswap->lock);
+		/*
+		 * vnswap_table and the bitmap have their own locks, so
+		 * writes to different slots need not exclude each other.
+		 */
+		down_read(&vnswap->lock);
 		dprintk("%s %d: (rw,index) = (%d, %d)\n",
 			__func__, __LINE__, rw, index);
 		ret = vnswap_bvec_write(vnswap, bvec, index, bio);
-		up_write(&vnswap->lock);
+		up_read(&vnswap->lock);
 	}
 
 	return ret;
@@ -950,14 +1077,14 @@ void vnswap_slot_free_notify(struct block_device *bdev, unsigned long index)
 
 	vnswap = bdev->bd_disk->private_data;
 
-	spin_lock_irq(&vnswap_table_lock);
+	spin_lock_irq(vnswap_table_lock(index));
 	nand_offset = vnswap_table ? vnswap_table[index] : -1;
 
 	/* This index is not mapped to vnswap and is mapped to zswap */
 	if (nand_offset == -1) {
 		atomic_inc(&vnswap_device->stats.
 			vnswap_not_mapped_slot_free_num);
-		spin_unlock_irq(&vnswap_table_lock);
+		spin_unlock_irq(vnswap_table_lock(index));
 		return;
 	}
 
@@ -967,15 +1094,9 @@ void vnswap_slot_free_notify(struct block_device *bdev, unsigned long index)
 		vnswap_stored_pages);
 	atomic_dec(&vnswap_device->stats.
 		vnswap_used_slot_num);
-	clear_bit(nand_offset, backing_storage_bitmap);
 	vnswap_table[index] = -1;
-
-	/* When Backing Storage is full, set Backing Storage is not full */
-	if (backing_storage_bitmap_last_allocated_index ==
-		vnswap_device->bs_size) {
-		backing_storage_bitmap_last_allocated_index = nand_offset;
-	}
-	spin_unlock_irq(&vnswap_table_lock);
+	vnswap_free_backing_block(nand_offset);
+	spin_unlock_irq(vnswap_table_lock(index));
 
 	/*
 	 * disable blkdev_issue_discard
@@ -1109,7 +1230,10 @@ void destroy_device(struct vnswap *vnswap)
 
 int __init vnswap_init(void)
 {
-	int ret = 0;
+	int ret = 0, i;
+
+	for (i = 0; i < VNSWAP_TABLE_LOCK_SHARDS; i++)
+		spin_lock_init(&vnswap_table_locks[i].lock);
 
 	vnswap_major = register_blkdev(0, "vnswap");
 	if (vnswap_major <= 0) {
@@ -1171,6 +1295,7 @@ void __exit vnswap_exit(void)
 		vfree(backing_storage_bmap);
 	if (backing_storage_bitmap)
 		vfree(backing_storage_bitmap);
+	vnswap_deinit_clusters();
 	if (vnswap_table)
 		vfree(vnswap_table);
 
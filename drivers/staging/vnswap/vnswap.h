@@ -53,6 +53,19 @@
 
 #define MAX_BACKING_STORAGE_FILENAME_LEN	127
 
+/* Max pages merged into one backing storage bio (128KB) */
+#define VNSWAP_BATCH_PAGES	32
+
+/*
+ * Backing storage is handed out in clusters of one bitmap word, each CPU
+ * filling its own cluster so that its writes land on contiguous blocks.
+ */
+#define VNSWAP_CLUSTER_PAGES	BITS_PER_LONG
+#define VNSWAP_CLUSTER_NULL	UINT_MAX
+
+/* Number of vnswap_table lock shards, a power of 2 */
+#define VNSWAP_TABLE_LOCK_SHARDS	64
+
 struct vnswap_stats {
 	u64 vnswap_is_init;	/* vnswap_init success or fail */
 	u64 vnswap_total_slot_num;	/* total  slot number */
@@ -87,6 +100,10 @@ struct vnswap_stats {
 		/* total not-mapped-slot free number */
 	atomic_t vnswap_backing_storage_full_num;
 		/* total write_fail_because_of_backing_storage_full number */
+	atomic_t vnswap_bio_merged_num;
+		/* total pages merged into a preceding backing storage bio */
+	atomic_t vnswap_cluster_fallback_num;
+		/* total allocations done outside of a free cluster */
 	int vnswap_backing_storage_open_fail;
 		/* backing storage file open fail */
 };
@@ -106,7 +123,14 @@ struct vnswap {
 	struct vnswap_stats stats;
 };
 
+struct vnswap_frag_info {
+	unsigned long free_pages;	/* free backing storage pages */
+	unsigned int free_clusters;	/* clusters with no page in use */
+	unsigned int total_clusters;
+};
+
 extern void vnswap_init_disksize(u64 disksize);
+extern void vnswap_get_frag_info(struct vnswap_frag_info *info);
 extern int vnswap_init_backing_storage(void);
 extern int vnswap_deinit_backing_storage(void);
 
@@ -119,7 +119,7 @@ static ssize_t vnswap_swap_info_show(struct device *dev,
 {
 	return sprintf(buf, "(%d, %d, %d) (%llu, %d, %d, %d, %d, %d) " \
 						"(%d, %d, %d, %d, %d, %d, " \
-						"%d, %d, %d, %d, %d, %d)\n",
+						"%d, %d, %d, %d, %d, %d) (%d, %d)\n",
 		vnswap_device->stats.vnswap_stored_pages.counter,
 		vnswap_device->stats.vnswap_write_pages.counter,
 		vnswap_device->stats.vnswap_read_pages.counter,
@@ -140,10 +140,35 @@ static ssize_t vnswap_swap_info_show(struct device *dev,
 		vnswap_device->stats.vnswap_bio_invalid_num.counter,
 		vnswap_device->stats.vnswap_bio_no_mem_num.counter,
 		vnswap_device->stats.vnswap_not_mapped_read_pages.counter,
-		vnswap_device->stats.vnswap_backing_storage_open_fail
+		vnswap_device->stats.vnswap_backing_storage_open_fail,
+		vnswap_device->stats.vnswap_bio_merged_num.counter,
+		vnswap_device->stats.vnswap_cluster_fallback_num.counter
 	);
 }
 
+/*
+ * fragmentation is the percentage of free backing storage pages that
+ * are not in a free cluster, i.e. that can only be handed out one by
+ * one rather than as contiguous runs.
+ */
+static ssize_t vnswap_frag_info_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct vnswap_frag_info info;
+	unsigned long clustered;
+	unsigned int frag = 0;
+
+	vnswap_get_frag_info(&info);
+	clustered = (unsigned long)info.free_clusters * VNSWAP_CLUSTER_PAGES;
+	if (info.free_pages > clustered)
+		frag = (info.free_pages - clustered) * 100 / info.free_pages;
+
+	return sprintf(buf, "(free_pages, free_clusters, total_clusters, " \
+			"fragmentation) = (%lu, %u, %u, %u)\n",
+			info.free_pages, info.free_clusters,
+			info.total_clusters, frag);
+}
+
 static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR, disksize_show,
 	disksize_store);
 static DEVICE_ATTR(swap_filename, S_IRUGO | S_IWUSR, swap_filename_show,
@@ -156,6 +181,8 @@ static DEVICE_ATTR(vnswap_init, S_IRUGO | S_IWUSR,
 	vnswap_init_show, NULL);
 static DEVICE_ATTR(vnswap_swap_info, S_IRUGO | S_IWUSR,
 	vnswap_swap_info_show, NULL);
+static DEVICE_ATTR(vnswap_frag_info, S_IRUGO,
+	vnswap_frag_info_show, NULL);
 
 static struct attribute *vnswap_disk_attrs[] = {
 	&dev_attr_disksize.attr,
@@ -164,6 +191,7 @@ static struct attribute *vnswap_disk_attrs[] = {
 	&dev_attr_deinit_backing_storage.attr,
 	&dev_attr_vnswap_init.attr,
 	&dev_attr_vnswap_swap_info.attr,
+	&dev_attr_vnswap_frag_info.attr,
 	NULL,
 };
 
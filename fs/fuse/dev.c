@@ -334,15 +334,58 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 	return nbytes;
 }
 
-static u64 fuse_get_unique(struct fuse_iqueue *fiq)
+static u64 fuse_get_unique(struct fuse_conn *fc)
 {
-	return ++fiq->reqctr;
+	return atomic64_inc_return(&fc->reqctr);
+}
+
+/*
+ * Lock the input queue a new request should go to: the queue of the
+ * current CPU if a device is bound to it, the connection wide queue
+ * otherwise.
+ */
+static struct fuse_iqueue *lock_new_iqueue(struct fuse_conn *fc)
+{
+	struct fuse_iqueue __percpu *cpu_iq = lockless_dereference(fc->cpu_iq);
+	struct fuse_iqueue *fiq;
+
+	if (cpu_iq) {
+		fiq = raw_cpu_ptr(cpu_iq);
+		if (READ_ONCE(fiq->bound)) {
+			spin_lock(&fiq->waitq.lock);
+			if (fiq->bound)
+				return fiq;
+			spin_unlock(&fiq->waitq.lock);
+		}
+	}
+	fiq = &fc->iq;
+	spin_lock(&fiq->waitq.lock);
+	return fiq;
+}
+
+/*
+ * Lock the input queue a request was queued on.  Requests left on a
+ * per-CPU queue by its last reader are moved to the connection wide
+ * queue, so recheck after taking the lock.
+ */
+static struct fuse_iqueue *lock_req_iqueue(struct fuse_req *req)
+{
+	struct fuse_iqueue *fiq;
+
+	for (;;) {
+		fiq = READ_ONCE(req->fiq);
+		spin_lock(&fiq->waitq.lock);
+		if (likely(fiq == req->fiq))
+			return fiq;
+		spin_unlock(&fiq->waitq.lock);
+	}
 }
 
 static void queue_request(struct fuse_iqueue *fiq, struct fuse_req *req)
 {
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
+	req->fiq = fiq;
 	list_add_tail(&req->list, &fiq->pending);
 	wake_up_locked(&fiq->waitq);
 	kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
@@ -373,13 +416,13 @@ static void flush_bg_queue(struct fuse_conn *fc)
 	while (fc->active_background < fc->max_background &&
 	       !list_empty(&fc->bg_queue)) {
 		struct fuse_req *req;
-		struct fuse_iqueue *fiq = &fc->iq;
+		struct fuse_iqueue *fiq;
 
 		req = list_entry(fc->bg_queue.next, struct fuse_req, list);
 		list_del(&req->list);
 		fc->active_background++;
-		spin_lock(&fiq->waitq.lock);
-		req->in.h.unique = fuse_get_unique(fiq);
+		fiq = lock_new_iqueue(fc);
+		req->in.h.unique = fuse_get_unique(fc);
 		queue_request(fiq, req);
 		spin_unlock(&fiq->waitq.lock);
 	}
@@ -485,7 +528,7 @@ static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 		if (!err)
 			return;
 
-		spin_lock(&fiq->waitq.lock);
+		fiq = lock_req_iqueue(req);
 		/* Request is not yet in userspace, bail out */
 		if (test_bit(FR_PENDING, &req->flags)) {
 			list_del(&req->list);
@@ -508,15 +551,15 @@ static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 
 static void __fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 {
-	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_iqueue *fiq;
 
 	BUG_ON(test_bit(FR_BACKGROUND, &req->flags));
-	spin_lock(&fiq->waitq.lock);
+	fiq = lock_new_iqueue(fc);
 	if (!fiq->connected) {
 		spin_unlock(&fiq->waitq.lock);
 		req->out.h.error = -ENOTCONN;
 	} else {
-		req->in.h.unique = fuse_get_unique(fiq);
+		req->in.h.unique = fuse_get_unique(fc);
 		queue_request(fiq, req);
 		/* acquire extra reference, since request is still needed
 		   after request_end() */
@@ -1106,7 +1149,7 @@ static int request_pending(struct fuse_iqueue *fiq)
  *
  * Called with fiq->waitq.lock held, releases it
  */
-static int fuse_read_interrupt(struct fuse_iqueue *fiq,
+static int fuse_read_interrupt(struct fuse_conn *fc, struct fuse_iqueue *fiq,
 			       struct fuse_copy_state *cs,
 			       size_t nbytes, struct fuse_req *req)
 __releases(fiq->waitq.lock)
@@ -1117,7 +1160,7 @@ __releases(fiq->waitq.lock)
 	int err;
 
 	list_del_init(&req->intr_entry);
-	req->intr_unique = fuse_get_unique(fiq);
+	req->intr_unique = fuse_get_unique(fc);
 	memset(&ih, 0, sizeof(ih));
 	memset(&arg, 0, sizeof(arg));
 	ih.len = reqsize;
@@ -1159,7 +1202,8 @@ static struct fuse_forget_link *dequeue_forget(struct fuse_iqueue *fiq,
 	return head;
 }
 
-static int fuse_read_single_forget(struct fuse_iqueue *fiq,
+static int fuse_read_single_forget(struct fuse_conn *fc,
+				   struct fuse_iqueue *fiq,
 				   struct fuse_copy_state *cs,
 				   size_t nbytes)
 __releases(fiq->waitq.lock)
@@ -1172,7 +1216,7 @@ __releases(fiq->waitq.lock)
 	struct fuse_in_header ih = {
 		.opcode = FUSE_FORGET,
 		.nodeid = forget->forget_one.nodeid,
-		.unique = fuse_get_unique(fiq),
+		.unique = fuse_get_unique(fc),
 		.len = sizeof(ih) + sizeof(arg),
 	};
 
@@ -1192,8 +1236,9 @@ __releases(fiq->waitq.lock)
 	return ih.len;
 }
 
-static int fuse_read_batch_forget(struct fuse_iqueue *fiq,
-				   struct fuse_copy_state *cs, size_t nbytes)
+static int fuse_read_batch_forget(struct fuse_conn *fc,
+				  struct fuse_iqueue *fiq,
+				  struct fuse_copy_state *cs, size_t nbytes)
 __releases(fiq->waitq.lock)
 {
 	int err;
@@ -1203,7 +1248,7 @@ __releases(fiq->waitq.lock)
 	struct fuse_batch_forget_in arg = { .count = 0 };
 	struct fuse_in_header ih = {
 		.opcode = FUSE_BATCH_FORGET,
-		.unique = fuse_get_unique(fiq),
+		.unique = fuse_get_unique(fc),
 		.len = sizeof(ih) + sizeof(arg),
 	};
 
@@ -1247,9 +1292,9 @@ static int fuse_read_forget(struct fuse_conn *fc, struct fuse_iqueue *fiq,
 __releases(fiq->waitq.lock)
 {
 	if (fc->minor < 16 || fiq->forget_list_head.next->next == NULL)
-		return fuse_read_single_forget(fiq, cs, nbytes);
+		return fuse_read_single_forget(fc, fiq, cs, nbytes);
 	else
-		return fuse_read_batch_forget(fiq, cs, nbytes);
+		return fuse_read_batch_forget(fc, fiq, cs, nbytes);
 }
 
 /*
@@ -1260,13 +1305,18 @@ __releases(fiq->waitq.lock)
  * was an error during the copying then it's finished by calling
  * request_end().  Otherwise add it to the processing list, and set
  * the 'sent' flag.
+ *
+ * With 'more' set this appends to a batch: it doesn't wait, only takes
+ * a regular request that fits into nbytes and returns 0 if there is
+ * none.
  */
 static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
-				struct fuse_copy_state *cs, size_t nbytes)
+				struct fuse_copy_state *cs, size_t nbytes,
+				bool more)
 {
 	ssize_t err;
 	struct fuse_conn *fc = fud->fc;
-	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_iqueue *fiq = fud->fiq;
 	struct fuse_pqueue *fpq = &fud->pq;
 	struct fuse_req *req;
 	struct fuse_in *in;
@@ -1274,6 +1324,16 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 
  restart:
 	spin_lock(&fiq->waitq.lock);
+	if (more) {
+		err = 0;
+		if (!fiq->connected || list_empty(&fiq->pending))
+			goto err_unlock;
+		req = list_entry(fiq->pending.next, struct fuse_req, list);
+		if (req->in.h.len > nbytes)
+			goto err_unlock;
+		goto dequeue;
+	}
+
 	err = -EAGAIN;
 	if ((file->f_flags & O_NONBLOCK) && fiq->connected &&
 	    !request_pending(fiq))
@@ -1291,7 +1351,7 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 	if (!list_empty(&fiq->interrupts)) {
 		req = list_entry(fiq->interrupts.next, struct fuse_req,
 				 intr_entry);
-		return fuse_read_interrupt(fiq, cs, nbytes, req);
+		return fuse_read_interrupt(fc, fiq, cs, nbytes, req);
 	}
 
 	if (forget_pending(fiq)) {
@@ -1303,6 +1363,7 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 	}
 
 	req = list_entry(fiq->pending.next, struct fuse_req, list);
+ dequeue:
 	clear_bit(FR_PENDING, &req->flags);
 	list_del_init(&req->list);
 	spin_unlock(&fiq->waitq.lock);
@@ -1348,7 +1409,7 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 	/* matches barrier in request_wait_answer() */
 	smp_mb__after_atomic();
 	if (test_bit(FR_INTERRUPTED, &req->flags))
-		queue_interrupt(fiq, req);
+		queue_interrupt(&fc->iq, req);
 	fuse_put_request(fc, req);
 
 	return reqsize;
@@ -1376,6 +1437,37 @@ static int fuse_dev_open(struct inode *inode, struct file *file)
 	return 0;
 }
 
+/*
+ * Fill the buffer with as many requests as are pending and fit, back to
+ * back, each starting with its fuse_in_header.  Only the first read may
+ * block.
+ *
+ * The copy state advances the iterator a page at a time, so every
+ * request is copied through a private copy of it and the caller's
+ * iterator is moved by the request size afterwards.
+ */
+static ssize_t fuse_dev_read_batch(struct fuse_dev *fud, struct file *file,
+				   struct iov_iter *to)
+{
+	struct fuse_copy_state cs;
+	ssize_t copied = 0;
+	ssize_t ret;
+
+	do {
+		struct iov_iter iter = *to;
+
+		fuse_copy_init(&cs, 1, &iter);
+		ret = fuse_dev_do_read(fud, file, &cs, iov_iter_count(to),
+				       copied != 0);
+		if (ret <= 0)
+			break;
+		iov_iter_advance(to, ret);
+		copied += ret;
+	} while (iov_iter_count(to) > sizeof(struct fuse_in_header));
+
+	return copied ? copied : ret;
+}
+
 static ssize_t fuse_dev_read(struct kiocb *iocb, struct iov_iter *to)
 {
 	struct fuse_copy_state cs;
@@ -1388,9 +1480,12 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, struct iov_iter *to)
 	if (!iter_is_iovec(to))
 		return -EINVAL;
 
+	if (fud->batch)
+		return fuse_dev_read_batch(fud, file, to);
+
 	fuse_copy_init(&cs, 1, to);
 
-	return fuse_dev_do_read(fud, file, &cs, iov_iter_count(to));
+	return fuse_dev_do_read(fud, file, &cs, iov_iter_count(to), false);
 }
 
 static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
@@ -1414,7 +1509,7 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	fuse_copy_init(&cs, 1, NULL);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
-	ret = fuse_dev_do_read(fud, in, &cs, len);
+	ret = fuse_dev_do_read(fud, in, &cs, len, false);
 	if (ret < 0)
 		goto out;
 
@@ -1996,6 +2091,41 @@ static ssize_t fuse_dev_do_write(struct fuse_dev *fud,
 	return err;
 }
 
+/*
+ * Process several replies written back to back, each sized by the len
+ * of its fuse_out_header.  A reply that fails stops the batch; the
+ * return value then only covers the replies before it.
+ */
+static ssize_t fuse_dev_write_batch(struct fuse_dev *fud,
+				    struct iov_iter *from)
+{
+	struct fuse_copy_state cs;
+	ssize_t written = 0;
+	ssize_t ret = 0;
+
+	while (iov_iter_count(from)) {
+		struct fuse_out_header oh;
+		struct iov_iter iter = *from;
+
+		ret = -EINVAL;
+		if (copy_from_iter(&oh, sizeof(oh), &iter) != sizeof(oh))
+			break;
+		if (oh.len < sizeof(oh) || oh.len > iov_iter_count(from))
+			break;
+
+		iter = *from;
+		iov_iter_truncate(&iter, oh.len);
+		fuse_copy_init(&cs, 0, &iter);
+		ret = fuse_dev_do_write(fud, &cs, oh.len);
+		if (ret < 0)
+			break;
+		iov_iter_advance(from, oh.len);
+		written += oh.len;
+	}
+
+	return written ? written : ret;
+}
+
 static ssize_t fuse_dev_write(struct kiocb *iocb, struct iov_iter *from)
 {
 	struct fuse_copy_state cs;
@@ -2007,6 +2137,9 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, struct iov_iter *from)
 	if (!iter_is_iovec(from))
 		return -EINVAL;
 
+	if (fud->batch)
+		return fuse_dev_write_batch(fud, from);
+
 	fuse_copy_init(&cs, 0, from);
 
 	return fuse_dev_do_write(fud, &cs, iov_iter_count(from));
@@ -2106,7 +2239,7 @@ static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 	if (!fud)
 		return POLLERR;
 
-	fiq = &fud->fc->iq;
+	fiq = fud->fiq;
 	poll_wait(file, &fiq->waitq, wait);
 
 	spin_lock(&fiq->waitq.lock);
@@ -2136,6 +2269,22 @@ static void end_requests(struct fuse_conn *fc, struct list_head *head)
 	}
 }
 
+/*
+ * Disconnect an input queue and collect its pending requests
+ *
+ * Called with fiq->waitq.lock held
+ */
+static void abort_iqueue(struct fuse_iqueue *fiq, struct list_head *to_end)
+{
+	struct fuse_req *req;
+
+	fiq->connected = 0;
+	list_for_each_entry(req, &fiq->pending, list)
+		clear_bit(FR_PENDING, &req->flags);
+	list_splice_tail_init(&fiq->pending, to_end);
+	wake_up_all_locked(&fiq->waitq);
+}
+
 static void end_polls(struct fuse_conn *fc)
 {
 	struct rb_node *p;
@@ -2205,14 +2354,23 @@ void fuse_abort_conn(struct fuse_conn *fc)
 		fc->max_background = UINT_MAX;
 		flush_bg_queue(fc);
 
+		if (fc->cpu_iq) {
+			int cpu;
+
+			for_each_possible_cpu(cpu) {
+				struct fuse_iqueue *cfiq;
+
+				cfiq = per_cpu_ptr(fc->cpu_iq, cpu);
+				spin_lock(&cfiq->waitq.lock);
+				abort_iqueue(cfiq, &to_end2);
+				spin_unlock(&cfiq->waitq.lock);
+			}
+		}
+
 		spin_lock(&fiq->waitq.lock);
-		fiq->connected = 0;
-		list_splice_init(&fiq->pending, &to_end2);
-		list_for_each_entry(req, &to_end2, list)
-			clear_bit(FR_PENDING, &req->flags);
+		abort_iqueue(fiq, &to_end2);
 		while (forget_pending(fiq))
 			kfree(dequeue_forget(fiq, 1, NULL));
-		wake_up_all_locked(&fiq->waitq);
 		spin_unlock(&fiq->waitq.lock);
 		kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
 		end_polls(fc);
@@ -2238,6 +2396,33 @@ void fuse_wait_aborted(struct fuse_conn *fc)
 	wait_event(fc->blocked_waitq, atomic_read(&fc->num_waiting) == 0);
 }
 
+/*
+ * Drop the binding of a device to a per-CPU input queue.  Requests
+ * that the last bound device leaves behind would never be read, so hand
+ * them over to the connection wide queue.
+ */
+static void fuse_dev_unbind(struct fuse_dev *fud)
+{
+	struct fuse_iqueue *fiq = fud->fiq;
+	struct fuse_iqueue *main_fiq = &fud->fc->iq;
+	struct fuse_req *req;
+
+	if (fiq == main_fiq)
+		return;
+
+	spin_lock(&fiq->waitq.lock);
+	if (!--fiq->bound && !list_empty(&fiq->pending)) {
+		spin_lock_nested(&main_fiq->waitq.lock, SINGLE_DEPTH_NESTING);
+		list_for_each_entry(req, &fiq->pending, list)
+			req->fiq = main_fiq;
+		list_splice_tail_init(&fiq->pending, &main_fiq->pending);
+		wake_up_all_locked(&main_fiq->waitq);
+		spin_unlock(&main_fiq->waitq.lock);
+	}
+	spin_unlock(&fiq->waitq.lock);
+	fud->fiq = main_fiq;
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
 	struct fuse_dev *fud = fuse_get_dev(file);
@@ -2247,6 +2432,8 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 		struct fuse_pqueue *fpq = &fud->pq;
 		LIST_HEAD(to_end);
 
+		fuse_dev_unbind(fud);
+
 		spin_lock(&fpq->lock);
 		WARN_ON(!list_empty(&fpq->io));
 		list_splice_init(&fpq->processing, &to_end);
@@ -2293,6 +2480,51 @@ static int fuse_device_clone(struct fuse_conn *fc, struct file *new)
 	return 0;
 }
 
+/*
+ * Bind a device to the input queue of a CPU.  From then on requests
+ * issued on that CPU are only read through the devices bound to it and
+ * the device no longer sees requests from other CPUs, interrupts or
+ * forgets.  At least one unbound device must keep reading those.
+ */
+static int fuse_dev_bind_queue(struct fuse_dev *fud, unsigned int cpu)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_iqueue *fiq;
+
+	if (cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return -EINVAL;
+
+	if (fud->fiq != &fc->iq)
+		return -EBUSY;
+
+	if (!fc->cpu_iq) {
+		struct fuse_iqueue __percpu *cpu_iq;
+		int i;
+
+		cpu_iq = alloc_percpu(struct fuse_iqueue);
+		if (!cpu_iq)
+			return -ENOMEM;
+
+		for_each_possible_cpu(i)
+			fuse_iqueue_init(per_cpu_ptr(cpu_iq, i));
+
+		/* Serialized against fuse_abort_conn() */
+		spin_lock(&fc->lock);
+		for_each_possible_cpu(i)
+			per_cpu_ptr(cpu_iq, i)->connected = fc->connected;
+		smp_store_release(&fc->cpu_iq, cpu_iq);
+		spin_unlock(&fc->lock);
+	}
+
+	fiq = per_cpu_ptr(fc->cpu_iq, cpu);
+	spin_lock(&fiq->waitq.lock);
+	fiq->bound++;
+	spin_unlock(&fiq->waitq.lock);
+	fud->fiq = fiq;
+
+	return 0;
+}
+
 static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
 			   unsigned long arg)
 {
@@ -2325,6 +2557,44 @@ static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
 				fput(old);
 			}
 		}
+	} else if (cmd == FUSE_DEV_IOC_PASSTHROUGH_OPEN) {
+		int lower_fd;
+
+		err = -EFAULT;
+		if (!get_user(lower_fd, (__u32 __user *) arg)) {
+			struct fuse_dev *fud = fuse_get_dev(file);
+
+			err = -EINVAL;
+			if (fud)
+				err = fuse_passthrough_open(fud->fc, lower_fd);
+		}
+	} else if (cmd == FUSE_DEV_IOC_BIND_QUEUE) {
+		__u32 cpu;
+
+		err = -EFAULT;
+		if (!get_user(cpu, (__u32 __user *) arg)) {
+			struct fuse_dev *fud = fuse_get_dev(file);
+
+			err = -EINVAL;
+			if (fud) {
+				mutex_lock(&fuse_mutex);
+				err = fuse_dev_bind_queue(fud, cpu);
+				mutex_unlock(&fuse_mutex);
+			}
+		}
+	} else if (cmd == FUSE_DEV_IOC_BATCH) {
+		__u32 batch;
+
+		err = -EFAULT;
+		if (!get_user(batch, (__u32 __user *) arg)) {
+			struct fuse_dev *fud = fuse_get_dev(file);
+
+			err = -EINVAL;
+			if (fud) {
+				fud->batch = batch != 0;
+				err = 0;
+			}
+		}
 	}
 	return err;
 }
@@ -14,6 +14,9 @@
 #include <linux/namei.h>
 #include <linux/slab.h>
 
+/** Largest READDIR/READDIRPLUS reply asked for a big directory */
+#define FUSE_READDIR_MAX_SIZE (FUSE_MAX_PAGES_PER_REQ * PAGE_SIZE)
+
 static bool fuse_use_readdirplus(struct inode *dir, struct dir_context *ctx)
 {
 	struct fuse_conn *fc = get_fuse_conn(dir);
@@ -492,6 +495,7 @@ static int fuse_create_open(struct inode *dir, struct dentry *entry,
 	ff->fh = outopen.fh;
 	ff->nodeid = outentry.nodeid;
 	ff->open_flags = outopen.open_flags;
+	fuse_passthrough_setup(fc, ff, &outopen);
 	inode = fuse_iget(dir->i_sb, outentry.nodeid, outentry.generation,
 			  &outentry.attr, entry_attr_timeout(&outentry), 0);
 	if (!inode) {
@@ -1188,29 +1192,47 @@ static int fuse_permission(struct inode *inode, int mask)
 	return err;
 }
 
-static int parse_dirfile(char *buf, size_t nbytes, struct file *file,
-			 struct dir_context *ctx)
+/*
+ * Emit the entries of a READDIR reply, or of a READDIRPLUS reply that
+ * has already been linked.  Returns the number of bytes consumed, which
+ * is less than nbytes if the caller's buffer filled up.
+ */
+static int parse_dirfile(char *buf, size_t nbytes, struct dir_context *ctx,
+			 bool plus)
 {
-	while (nbytes >= FUSE_NAME_OFFSET) {
-		struct fuse_dirent *dirent = (struct fuse_dirent *) buf;
-		size_t reclen = FUSE_DIRENT_SIZE(dirent);
+	size_t offset = 0;
+
+	while (nbytes - offset >= (plus ? FUSE_NAME_OFFSET_DIRENTPLUS :
+					  FUSE_NAME_OFFSET)) {
+		struct fuse_dirent *dirent;
+		size_t reclen;
+
+		if (plus) {
+			struct fuse_direntplus *direntplus;
+
+			direntplus = (struct fuse_direntplus *) (buf + offset);
+			dirent = &direntplus->dirent;
+			reclen = FUSE_DIRENTPLUS_SIZE(direntplus);
+		} else {
+			dirent = (struct fuse_dirent *) (buf + offset);
+			reclen = FUSE_DIRENT_SIZE(dirent);
+		}
 		if (!dirent->namelen || dirent->namelen > FUSE_NAME_MAX)
 			return -EIO;
-		if (reclen > nbytes)
+		if (reclen > nbytes - offset)
 			break;
 		if (memchr(dirent->name, '/', dirent->namelen) != NULL)
 			return -EIO;
 
 		if (!dir_emit(ctx, dirent->name, dirent->namelen,
 			       dirent->ino, dirent->type))
-			break;
+			return offset;
 
-		buf += reclen;
-		nbytes -= reclen;
+		offset += reclen;
 		ctx->pos = dirent->off;
 	}
 
-	return 0;
+	return nbytes;
 }
 
 static int fuse_direntplus_link(struct file *file,
@@ -1320,12 +1342,19 @@ out:
 	return err;
 }
 
+/*
+ * Like parse_dirfile(), but also links every entry of the reply, so the
+ * entries that did not fit into the caller's buffer are already linked
+ * when they are emitted later.
+ */
 static int parse_dirplusfile(char *buf, size_t nbytes, struct file *file,
 			     struct dir_context *ctx, u64 attr_version)
 {
 	struct fuse_direntplus *direntplus;
 	struct fuse_dirent *dirent;
 	size_t reclen;
+	size_t total = nbytes;
+	size_t consumed = nbytes;
 	int over = 0;
 	int ret;
 
@@ -1352,6 +1381,8 @@ static int parse_dirplusfile(char *buf, size_t nbytes, struct file *file,
 				       dirent->ino, dirent->type);
 			if (!over)
 				ctx->pos = dirent->off;
+			else
+				consumed = total - nbytes;
 		}
 
 		buf += reclen;
@@ -1362,63 +1393,130 @@ static int parse_dirplusfile(char *buf, size_t nbytes, struct file *file,
 			fuse_force_forget(file, direntplus->entry_out.nodeid);
 	}
 
-	return 0;
+	return consumed;
+}
+
+/*
+ * Make room for a larger reply once a directory turns out to fill the
+ * buffer, so that big directories are read in a few large requests
+ * while small ones only ever use a page.
+ */
+static void fuse_readdir_grow(struct fuse_file *ff, size_t nbytes)
+{
+	size_t size = ff->readdir.size;
+	void *buf;
+
+	if (nbytes <= size / 2 || size >= FUSE_READDIR_MAX_SIZE)
+		return;
+
+	buf = krealloc(ff->readdir.buf, size * 2, GFP_KERNEL | __GFP_NOWARN);
+	if (buf) {
+		ff->readdir.buf = buf;
+		ff->readdir.size = size * 2;
+	}
 }
 
+/*
+ * Return entries left over from the previous reply.  Returns 1 if the
+ * next entries have to be requested, 0 if the caller's buffer filled up
+ * or a negative error.
+ */
+static int fuse_readdir_cached(struct fuse_file *ff, struct dir_context *ctx)
+{
+	int consumed;
+
+	if (ff->readdir.start == ff->readdir.end)
+		return 1;
+
+	/* Seeked or rewound: the leftovers are of no use */
+	if (!ctx->pos || ctx->pos != ff->readdir.pos) {
+		ff->readdir.start = ff->readdir.end = 0;
+		return 1;
+	}
+
+	consumed = parse_dirfile(ff->readdir.buf + ff->readdir.start,
+				 ff->readdir.end - ff->readdir.start, ctx,
+				 ff->readdir.plus);
+	if (consumed < 0) {
+		ff->readdir.start = ff->readdir.end = 0;
+		return consumed;
+	}
+
+	ff->readdir.start += consumed;
+	ff->readdir.pos = ctx->pos;
+	return ff->readdir.start == ff->readdir.end;
+}
+
+/*
+ * The reply is read into a buffer kept with the open directory.  What
+ * does not fit into the caller's buffer is returned by the following
+ * calls without asking the filesystem again.
+ */
 static int fuse_readdir(struct file *file, struct dir_context *ctx)
 {
 	int plus, err;
 	size_t nbytes;
-	struct page *page;
 	struct inode *inode = file_inode(file);
 	struct fuse_conn *fc = get_fuse_conn(inode);
+	struct fuse_file *ff = file->private_data;
 	struct fuse_req *req;
 	u64 attr_version = 0;
+	int consumed;
 
 	if (is_bad_inode(inode))
 		return -EIO;
 
-	req = fuse_get_req(fc, 1);
-	if (IS_ERR(req))
-		return PTR_ERR(req);
+	err = fuse_readdir_cached(ff, ctx);
+	if (err <= 0)
+		goto out;
 
-	page = alloc_page(GFP_KERNEL);
-	if (!page) {
-		fuse_put_request(fc, req);
-		return -ENOMEM;
+	if (!ff->readdir.buf) {
+		ff->readdir.buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!ff->readdir.buf)
+			return -ENOMEM;
+		ff->readdir.size = PAGE_SIZE;
 	}
 
+	req = fuse_get_req(fc, 0);
+	if (IS_ERR(req))
+		return PTR_ERR(req);
+
 	plus = fuse_use_readdirplus(inode, ctx);
-	req->out.argpages = 1;
-	req->num_pages = 1;
-	req->pages[0] = page;
-	req->page_descs[0].length = PAGE_SIZE;
 	if (plus) {
 		attr_version = fuse_get_attr_version(fc);
-		fuse_read_fill(req, file, ctx->pos, PAGE_SIZE,
+		fuse_read_fill(req, file, ctx->pos, ff->readdir.size,
 			       FUSE_READDIRPLUS);
 	} else {
-		fuse_read_fill(req, file, ctx->pos, PAGE_SIZE,
+		fuse_read_fill(req, file, ctx->pos, ff->readdir.size,
 			       FUSE_READDIR);
 	}
+	req->out.args[0].value = ff->readdir.buf;
 	fuse_request_send(fc, req);
 	nbytes = req->out.args[0].size;
 	err = req->out.h.error;
 	fuse_put_request(fc, req);
-	if (!err) {
-		if (plus) {
-			err = parse_dirplusfile(page_address(page), nbytes,
-						file, ctx,
-						attr_version);
-		} else {
-			err = parse_dirfile(page_address(page), nbytes, file,
-					    ctx);
-		}
+	if (err)
+		goto out;
+
+	if (plus) {
+		consumed = parse_dirplusfile(ff->readdir.buf, nbytes, file,
+					     ctx, attr_version);
+	} else {
+		consumed = parse_dirfile(ff->readdir.buf, nbytes, ctx, false);
+	}
+	if (consumed < 0) {
+		err = consumed;
+		goto out;
 	}
 
-	__free_page(page);
+	ff->readdir.start = consumed;
+	ff->readdir.end = nbytes;
+	ff->readdir.pos = ctx->pos;
+	ff->readdir.plus = plus;
+	fuse_readdir_grow(ff, nbytes);
+out:
 	fuse_invalidate_atime(inode);
-	return err;
+	return err < 0 ? err : 0;
 }
 
 static const char *fuse_follow_link(struct dentry *dentry, void **cookie)
@@ -23,6 +23,8 @@
 #include <linux/poll.h>
 #include <linux/workqueue.h>
 #include <linux/kref.h>
+#include <linux/idr.h>
+#include <linux/percpu.h>
 
 /** Max number of pages that can be used in a single read request */
 #define FUSE_MAX_PAGES_PER_REQ 32
@@ -64,6 +66,15 @@ struct fuse_forget_link {
 	struct fuse_forget_link *next;
 };
 
+/** Lower file a passthrough fuse_file forwards its I/O to */
+struct fuse_passthrough {
+	/** File on the lower filesystem, opened by the daemon */
+	struct file *filp;
+
+	/** Credentials of the daemon at registration time */
+	const struct cred *cred;
+};
+
 /** FUSE inode */
 struct fuse_inode {
 	/** Inode data */
@@ -158,6 +169,28 @@ struct fuse_file {
 
 	/** Has flock been performed on this file? */
 	bool flock:1;
+
+	/** Lower file for read/write passthrough, if any */
+	struct fuse_passthrough passthrough;
+
+	/** Directory reply kept across getdents calls */
+	struct {
+		/** Reply buffer, grown for large directories */
+		void *buf;
+
+		/** Size of the buffer */
+		size_t size;
+
+		/** Entries not yet returned to the caller: [start, end) */
+		size_t start;
+		size_t end;
+
+		/** Directory position of the entry at start */
+		loff_t pos;
+
+		/** Entries are in READDIRPLUS format */
+		bool plus;
+	} readdir;
 };
 
 /** One input argument of a request */
@@ -387,6 +420,9 @@ struct fuse_req {
 
 	/** Request is stolen from fuse_file->reserved_req */
 	struct file *stolen_file;
+
+	/** Input queue the request is pending on */
+	struct fuse_iqueue *fiq;
 };
 
 struct fuse_iqueue {
@@ -396,8 +432,8 @@ struct fuse_iqueue {
 	/** Readers of the connection are waiting on this */
 	wait_queue_head_t waitq;
 
-	/** The next unique request id */
-	u64 reqctr;
+	/** Number of devices bound to this per-CPU queue */
+	unsigned bound;
 
 	/** The list of pending requests */
 	struct list_head pending;
@@ -440,6 +476,12 @@ struct fuse_dev {
 	/** Processing queue */
 	struct fuse_pqueue pq;
 
+	/** Input queue this device reads from */
+	struct fuse_iqueue *fiq;
+
+	/** Read and write several requests per system call */
+	bool batch;
+
 	/** list entry on fc->devices */
 	struct list_head entry;
 };
@@ -481,6 +523,12 @@ struct fuse_conn {
 	/** Input queue */
 	struct fuse_iqueue iq;
 
+	/** Per-CPU input queues, allocated when a device binds to one */
+	struct fuse_iqueue __percpu *cpu_iq;
+
+	/** The next unique request id */
+	atomic64_t reqctr;
+
 	/** The next unique kernel file handle */
 	u64 khctr;
 
@@ -618,6 +666,9 @@ struct fuse_conn {
 	/** Does the filesystem support asynchronous direct-IO submission? */
 	unsigned async_dio:1;
 
+	/** Can reads and writes be passed through to a lower file? */
+	unsigned passthrough:1;
+
 	/** The number of requests waiting for completion */
 	atomic_t num_waiting;
 
@@ -659,6 +710,10 @@ struct fuse_conn {
 
 	/** List of device instances belonging to this connection */
 	struct list_head devices;
+
+	/** Lower files registered for passthrough, not yet claimed by
+	    an open reply.  Protected by the lock */
+	struct idr passthrough_req;
 };
 
 static inline struct fuse_conn *get_fuse_conn_super(struct super_block *sb)
@@ -960,4 +1015,16 @@ int fuse_do_setattr(struct inode *inode, struct iattr *attr,
 
 void fuse_set_initialized(struct fuse_conn *fc);
 
+void fuse_iqueue_init(struct fuse_iqueue *fiq);
+
+/* passthrough.c */
+int fuse_passthrough_open(struct fuse_conn *fc, int lower_fd);
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			    struct fuse_open_out *openarg);
+void fuse_passthrough_release(struct fuse_passthrough *passthrough);
+void fuse_passthrough_free_all(struct fuse_conn *fc);
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
 #endif /* _FS_FUSE_I_H */
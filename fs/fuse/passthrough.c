@@ -0,0 +1,215 @@
+/*
+  FUSE: Filesystem in Userspace
+  Read/write passthrough to a lower file
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#include "fuse_i.h"
+
+#include <linux/cred.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/idr.h>
+#include <linux/slab.h>
+#include <linux/uio.h>
+
+/*
+ * The daemon registers a file it opened on the lower filesystem with
+ * FUSE_DEV_IOC_PASSTHROUGH_OPEN and hands the returned id back in the
+ * passthrough_fh field of the OPEN/CREATE reply.  From then on reads,
+ * writes and mmap of the FUSE file are served by the lower file with
+ * the credentials of the daemon, without a round trip to userspace.
+ */
+
+static void fuse_copyattr(struct file *dst_file, struct file *src_file)
+{
+	struct inode *dst = file_inode(dst_file);
+	struct inode *src = file_inode(src_file);
+	struct fuse_conn *fc = get_fuse_conn(dst);
+	struct fuse_inode *fi = get_fuse_inode(dst);
+
+	spin_lock(&fc->lock);
+	fi->attr_version = ++fc->attr_version;
+	i_size_write(dst, i_size_read(src));
+	dst->i_mtime = src->i_mtime;
+	dst->i_ctime = src->i_ctime;
+	spin_unlock(&fc->lock);
+}
+
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct fuse_file *ff = iocb->ki_filp->private_data;
+	struct file *passthrough_filp = ff->passthrough.filp;
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	if (!(passthrough_filp->f_mode & FMODE_READ))
+		return -EBADF;
+	if (!iov_iter_count(to))
+		return 0;
+
+	old_cred = override_creds(ff->passthrough.cred);
+	ret = vfs_iter_read(passthrough_filp, to, &iocb->ki_pos);
+	revert_creds(old_cred);
+
+	return ret;
+}
+
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *fuse_filp = iocb->ki_filp;
+	struct fuse_file *ff = fuse_filp->private_data;
+	struct file *passthrough_filp = ff->passthrough.filp;
+	struct inode *inode = file_inode(fuse_filp);
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	if (!(passthrough_filp->f_mode & FMODE_WRITE))
+		return -EBADF;
+	if (!iov_iter_count(from))
+		return 0;
+
+	mutex_lock(&inode->i_mutex);
+	if (iocb->ki_flags & IOCB_APPEND)
+		iocb->ki_pos = i_size_read(file_inode(passthrough_filp));
+
+	old_cred = override_creds(ff->passthrough.cred);
+	file_start_write(passthrough_filp);
+	ret = vfs_iter_write(passthrough_filp, from, &iocb->ki_pos);
+	file_end_write(passthrough_filp);
+	revert_creds(old_cred);
+
+	if (ret > 0)
+		fuse_copyattr(fuse_filp, passthrough_filp);
+	mutex_unlock(&inode->i_mutex);
+
+	return ret;
+}
+
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *passthrough_filp = ff->passthrough.filp;
+	const struct cred *old_cred;
+	int ret;
+
+	if (WARN_ON(file != vma->vm_file))
+		return -EIO;
+	if (!passthrough_filp->f_op->mmap)
+		return -ENODEV;
+
+	/* The mapping is owned by the lower file from now on */
+	vma->vm_file = get_file(passthrough_filp);
+
+	old_cred = override_creds(ff->passthrough.cred);
+	ret = passthrough_filp->f_op->mmap(passthrough_filp, vma);
+	revert_creds(old_cred);
+
+	if (ret) {
+		vma->vm_file = file;
+		fput(passthrough_filp);
+	} else {
+		fput(file);
+		file_accessed(file);
+	}
+
+	return ret;
+}
+
+int fuse_passthrough_open(struct fuse_conn *fc, int lower_fd)
+{
+	struct fuse_passthrough *passthrough;
+	struct file *passthrough_filp;
+	struct super_block *passthrough_sb;
+	int res;
+
+	if (!fc->passthrough)
+		return -EPERM;
+
+	passthrough_filp = fget(lower_fd);
+	if (!passthrough_filp)
+		return -EBADF;
+
+	res = -EINVAL;
+	if (!passthrough_filp->f_op->read_iter ||
+	    !passthrough_filp->f_op->write_iter)
+		goto out_fput;
+
+	/* Refuse a lower file that is itself on a passthrough FUSE mount */
+	passthrough_sb = file_inode(passthrough_filp)->i_sb;
+	if (passthrough_sb->s_stack_depth >= FILESYSTEM_MAX_STACK_DEPTH)
+		goto out_fput;
+
+	res = -ENOMEM;
+	passthrough = kmalloc(sizeof(*passthrough), GFP_KERNEL);
+	if (!passthrough)
+		goto out_fput;
+
+	passthrough->filp = passthrough_filp;
+	passthrough->cred = get_current_cred();
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&fc->lock);
+	res = idr_alloc(&fc->passthrough_req, passthrough, 1, 0, GFP_ATOMIC);
+	spin_unlock(&fc->lock);
+	idr_preload_end();
+
+	if (res > 0)
+		return res;
+
+	put_cred(passthrough->cred);
+	kfree(passthrough);
+out_fput:
+	fput(passthrough_filp);
+	return res;
+}
+
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			    struct fuse_open_out *openarg)
+{
+	struct fuse_passthrough *passthrough;
+	int passthrough_fh = openarg->passthrough_fh;
+
+	if (!fc->passthrough || passthrough_fh <= 0)
+		return;
+
+	spin_lock(&fc->lock);
+	passthrough = idr_find(&fc->passthrough_req, passthrough_fh);
+	if (passthrough)
+		idr_remove(&fc->passthrough_req, passthrough_fh);
+	spin_unlock(&fc->lock);
+
+	/* An unknown id leaves the file on the regular request path */
+	if (!passthrough)
+		return;
+
+	ff->passthrough = *passthrough;
+	kfree(passthrough);
+}
+
+void fuse_passthrough_release(struct fuse_passthrough *passthrough)
+{
+	if (passthrough->filp) {
+		fput(passthrough->filp);
+		passthrough->filp = NULL;
+	}
+	if (passthrough->cred) {
+		put_cred(passthrough->cred);
+		passthrough->cred = NULL;
+	}
+}
+
+static int fuse_passthrough_free(int id, void *p, void *data)
+{
+	fuse_passthrough_release(p);
+	kfree(p);
+	return 0;
+}
+
+void fuse_passthrough_free_all(struct fuse_conn *fc)
+{
+	idr_for_each(&fc->passthrough_req, fuse_passthrough_free, NULL);
+	idr_destroy(&fc->passthrough_req);
+}
@@ -108,6 +108,9 @@ static int sdcardfs_d_revalidate(struct dentry *dentry, unsigned int flags)
 	if (!err)
 		goto out;
 
+	/* The package list may have changed since we were derived */
+	refresh_derived_permission(dentry);
+
 	/* If our top's inode is gone, we may be out of date */
 	inode = igrab(d_inode(dentry));
 	if (inode) {
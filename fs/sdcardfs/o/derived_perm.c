@@ -64,6 +64,7 @@ void get_derived_permission_new(struct dentry *parent, struct dentry *dentry,
 	struct sdcardfs_inode_info *info = SDCARDFS_I(d_inode(dentry));
 	struct sdcardfs_inode_data *parent_data =
 			SDCARDFS_I(d_inode(parent))->data;
+	unsigned int generation = get_package_generation();
 	appid_t appid;
 	unsigned long user_num;
 	int err;
@@ -86,6 +87,7 @@ void get_derived_permission_new(struct dentry *parent, struct dentry *dentry,
 	 */
 
 	inherit_derived_state(d_inode(parent), d_inode(dentry));
+	info->data->generation = generation;
 
 	/* Files don't get special labels */
 	if (!S_ISDIR(d_inode(dentry)->i_mode))
@@ -312,67 +314,72 @@ retry_deleg:
 	sdcardfs_put_lower_path(dentry, &path);
 }
 
-static int descendant_may_need_fixup(struct sdcardfs_inode_data *data,
-		struct limit_search *limit)
+/* Package directories take their owner from the package list */
+static bool derived_from_package_list(struct sdcardfs_inode_data *data)
 {
-	if (data->perm == PERM_ROOT)
-		return (limit->flags & BY_USERID) ?
-				data->userid == limit->userid : 1;
-	if (data->perm == PERM_PRE_ROOT || data->perm == PERM_ANDROID)
-		return 1;
-	return 0;
+	return data->perm == PERM_ANDROID_PACKAGE ||
+		data->perm == PERM_KNOX_ANDROID_PACKAGE;
 }
 
-static int needs_fixup(perm_t perm)
+static bool package_data_stale(struct sdcardfs_inode_data *top)
 {
-	if (perm == PERM_ANDROID_DATA || perm == PERM_ANDROID_OBB
-			|| perm == PERM_ANDROID_MEDIA)
-		return 1;
-	return 0;
+	return derived_from_package_list(top) && !top->abandoned &&
+		top->generation != get_package_generation();
 }
 
-static void __fixup_perms_recursive(struct dentry *dentry, struct limit_search *limit, int depth)
+/*
+ * Whether the owner @inode takes from its top_data may have changed with
+ * the package list since it was derived.
+ */
+bool derived_permission_stale(struct inode *inode)
 {
-	struct dentry *child;
-	struct sdcardfs_inode_info *info;
+	struct sdcardfs_inode_data *top = top_data_get(SDCARDFS_I(inode));
+	bool stale;
+
+	if (!top)
+		return false;
+	stale = package_data_stale(top);
+	data_put(top);
+	return stale;
+}
 
-	/*
-	 * All paths will terminate their recursion on hitting PERM_ANDROID_OBB,
-	 * PERM_ANDROID_MEDIA, or PERM_ANDROID_DATA. This happens at a depth of
-	 * at most 3.
-	 */
-	WARN(depth > 3, "%s: Max expected depth exceeded!\n", __func__);
-	spin_lock_nested(&dentry->d_lock, depth);
-	if (!d_inode(dentry)) {
-		spin_unlock(&dentry->d_lock);
+/*
+ * Rederive the package directory that @dentry takes its owner from, if
+ * the package list changed since it was derived. Everything below the
+ * package directory reads the owner from top_data, so the directory
+ * itself is all there is to do; it is found by walking up from @dentry,
+ * which may be anywhere below it.
+ */
+void refresh_derived_permission(struct dentry *dentry)
+{
+	struct inode *inode = d_inode(dentry);
+	struct sdcardfs_inode_data *top;
+	struct dentry *parent;
+
+	if (!inode)
 		return;
-	}
-	info = SDCARDFS_I(d_inode(dentry));
+	top = top_data_get(SDCARDFS_I(inode));
+	if (!top)
+		return;
+	if (!package_data_stale(top))
+		goto out;
 
-	if (needs_fixup(info->data->perm)) {
-		list_for_each_entry(child, &dentry->d_subdirs, d_child) {
-			spin_lock_nested(&child->d_lock, depth + 1);
-			if (!(limit->flags & BY_NAME) || qstr_case_eq(&child->d_name, &limit->name)) {
-				if (d_inode(child)) {
-					get_derived_permission(dentry, child);
-					fixup_tmp_permissions(d_inode(child));
-					spin_unlock(&child->d_lock);
-					break;
-				}
-			}
-			spin_unlock(&child->d_lock);
-		}
-	} else if (descendant_may_need_fixup(info->data, limit)) {
-		list_for_each_entry(child, &dentry->d_subdirs, d_child) {
-			__fixup_perms_recursive(child, limit, depth + 1);
-		}
+	dentry = dget(dentry);
+	while (!IS_ROOT(dentry) && SDCARDFS_I(d_inode(dentry))->data != top) {
+		parent = dget_parent(dentry);
+		dput(dentry);
+		dentry = parent;
 	}
-	spin_unlock(&dentry->d_lock);
-}
 
-void fixup_perms_recursive(struct dentry *dentry, struct limit_search *limit)
-{
-	__fixup_perms_recursive(dentry, limit, 0);
+	if (!IS_ROOT(dentry)) {
+		parent = dget_parent(dentry);
+		get_derived_permission(parent, dentry);
+		fixup_tmp_permissions(d_inode(dentry));
+		dput(parent);
+	}
+	dput(dentry);
+out:
+	data_put(top);
 }
 
 /* main function for updating derived permission */
@@ -195,6 +195,9 @@ struct sdcardfs_inode_data {
 	bool under_obb;
 
 	bool under_knox;
+
+	/* package list generation the state was derived at */
+	unsigned int generation;
 };
 
 /* sdcardfs inode data in memory */
@@ -521,24 +524,19 @@ extern appid_t get_appid(const char *app_name);
 extern appid_t get_ext_gid(const char *app_name);
 extern appid_t is_excluded(const char *app_name, userid_t userid);
 extern int check_caller_access_to_name(struct inode *parent_node, const struct qstr *name);
+extern unsigned int get_package_generation(void);
 extern int packagelist_init(void);
 extern void packagelist_exit(void);
 
 /* for derived_perm.c */
-#define BY_NAME		(1 << 0)
-#define BY_USERID	(1 << 1)
-struct limit_search {
-	unsigned int flags;
-	struct qstr name;
-	userid_t userid;
-};
 
 extern void setup_derived_state(struct inode *inode, perm_t perm,
 		userid_t userid, uid_t uid, bool under_android,
 		struct sdcardfs_inode_data *top);
 extern void get_derived_permission(struct dentry *parent, struct dentry *dentry);
 extern void get_derived_permission_new(struct dentry *parent, struct dentry *dentry, const struct qstr *name);
-extern void fixup_perms_recursive(struct dentry *dentry, struct limit_search *limit);
+extern bool derived_permission_stale(struct inode *inode);
+extern void refresh_derived_permission(struct dentry *dentry);
 
 extern void update_derived_permission_lock(struct dentry *dentry);
 void fixup_lower_ownership(struct dentry *dentry, const char *name);
@@ -547,8 +547,25 @@ static int sdcardfs_permission(struct vfsmount *mnt, struct inode *inode, int ma
 {
 	int err;
 	struct inode tmp;
-	struct sdcardfs_inode_data *top = top_data_get(SDCARDFS_I(inode));
+	struct sdcardfs_inode_data *top;
+
+	/*
+	 * Walks relative to a cwd or dirfd below a package directory never
+	 * revalidate it, so catch up with the package list here.
+	 */
+	if (derived_permission_stale(inode)) {
+		struct dentry *dentry;
+
+		if (mask & MAY_NOT_BLOCK)
+			return -ECHILD;
+		dentry = d_find_alias(inode);
+		if (dentry) {
+			refresh_derived_permission(dentry);
+			dput(dentry);
+		}
+	}
 
+	top = top_data_get(SDCARDFS_I(inode));
 	if (!top)
 		return -EINVAL;
 		
@@ -762,6 +779,8 @@ static int sdcardfs_getattr(struct vfsmount *mnt, struct dentry *dentry,
 	}
 	dput(parent);
 
+	refresh_derived_permission(dentry);
+
 	sdcardfs_get_lower_path(dentry, &lower_path);
 	err = vfs_getattr(&lower_path, &lower_stat);
 	if (err)
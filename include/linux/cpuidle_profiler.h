@@ -35,6 +35,10 @@
 struct cpuidle_profile_state_usage {
 	unsigned int entry_count;
 	unsigned int early_wakeup_count;
+	/* entries ended before the target residency of the state */
+	unsigned int too_deep_count;
+	/* entries that lasted for the target residency of a deeper state */
+	unsigned int too_shallow_count;
 	unsigned long long time;
 };
 
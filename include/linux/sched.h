@@ -64,6 +64,22 @@ struct sched_param {
 #include <asm/processor.h>
 
 #define SCHED_ATTR_SIZE_VER0	48	/* sizeof first published struct */
+#define SCHED_ATTR_SIZE_VER1	56	/* add: util_{min,max} */
+
+/*
+ * Extended sched_setattr() flags, after SCHED_FLAG_RESET_ON_FORK (0x01).
+ * Values match the upstream ABI.
+ */
+#define SCHED_FLAG_KEEP_POLICY		0x08
+#define SCHED_FLAG_KEEP_PARAMS		0x10
+#define SCHED_FLAG_UTIL_CLAMP_MIN	0x20
+#define SCHED_FLAG_UTIL_CLAMP_MAX	0x40
+
+#define SCHED_FLAG_KEEP_ALL	(SCHED_FLAG_KEEP_POLICY | \
+				 SCHED_FLAG_KEEP_PARAMS)
+
+#define SCHED_FLAG_UTIL_CLAMP	(SCHED_FLAG_UTIL_CLAMP_MIN | \
+				 SCHED_FLAG_UTIL_CLAMP_MAX)
 
 /*
  * Extended scheduling parameters data structure.
@@ -100,6 +116,8 @@ struct sched_param {
  *  @sched_deadline	representative of the task's deadline
  *  @sched_runtime	representative of the task's runtime
  *  @sched_period	representative of the task's period
+ *  @sched_util_min	minimum utilization requested (SCHED_FLAG_UTIL_CLAMP_MIN)
+ *  @sched_util_max	maximum utilization allowed (SCHED_FLAG_UTIL_CLAMP_MAX)
  *
  * Given this task model, there are a multiplicity of scheduling algorithms
  * and policies, that can be used to ensure all the tasks will make their
@@ -125,6 +143,10 @@ struct sched_attr {
 	u64 sched_runtime;
 	u64 sched_deadline;
 	u64 sched_period;
+
+	/* Utilization hints, in [0..SCHED_CAPACITY_SCALE] */
+	u32 sched_util_min;
+	u32 sched_util_max;
 };
 
 struct futex_pi_state;
@@ -165,6 +187,11 @@ extern void get_avenrun(unsigned long *loads, unsigned long offset, int shift);
 	load += n*(FIXED_1-exp); \
 	load >>= FSHIFT;
 
+extern unsigned long calc_load(unsigned long load, unsigned long exp,
+			       unsigned long active);
+extern unsigned long calc_load_n(unsigned long load, unsigned long exp,
+				 unsigned long active, unsigned int n);
+
 extern unsigned long total_forks;
 extern int nr_threads;
 DECLARE_PER_CPU(unsigned long, process_counts);
@@ -798,6 +825,11 @@ struct signal_struct {
 	short oom_score_adj;		/* OOM kill score adjustment */
 	short oom_score_adj_min;	/* OOM kill score adjustment min value.
 					 * Only settable by CAP_SYS_RESOURCE. */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	/* lowmemorykiller index of live processes by oom_score_adj */
+	struct hlist_node lmk_adj_node;
+	short lmk_adj;			/* oom_score_adj bucket of the node */
+#endif
 
 	struct mutex cred_guard_mutex;	/* guard against foreign influences on
 					 * credential calculations
@@ -1407,6 +1439,32 @@ struct sched_statistics {
 };
 #endif
 
+#ifdef CONFIG_SCHED_PRED_DEMAND
+#define PRED_HIST_SIZE		5
+#define NUM_BUSY_BUCKETS	10
+
+/*
+ * Busy time prediction of a task, see fair.c.
+ *
+ * 'busy' is the capacity-invariant busy time of the current activation
+ * (wakeup to sleep), capped to the prediction window.
+ *
+ * 'pred' is the busy time predicted for the current activation, and
+ * 'contrib' the utilization the task adds to rq->pred_util while queued.
+ *
+ * 'hist' keeps the busy time of the last PRED_HIST_SIZE activations, most
+ * recent first, and 'buckets' how often recent activations landed in each
+ * tenth of the window.
+ */
+struct pred_demand {
+	u32 busy;
+	u32 pred;
+	u32 contrib;
+	u32 hist[PRED_HIST_SIZE];
+	u8 buckets[NUM_BUSY_BUCKETS];
+};
+#endif
+
 #ifdef CONFIG_SCHED_WALT
 #define RAVG_HIST_SIZE_MAX  5
 
@@ -1544,6 +1602,40 @@ struct sched_dl_entity {
 	struct hrtimer dl_timer;
 };
 
+#ifdef CONFIG_UCLAMP_TASK
+/* Number of utilization clamp buckets (shorter alias) */
+#define UCLAMP_BUCKETS CONFIG_UCLAMP_BUCKETS_COUNT
+
+enum uclamp_id {
+	UCLAMP_MIN = 0,	/* Minimum utilization */
+	UCLAMP_MAX,	/* Maximum utilization */
+	UCLAMP_CNT
+};
+
+/*
+ * Utilization clamp for a task
+ * @value:		clamp value "assigned" to the task
+ * @bucket_id:		bucket index corresponding to the "assigned" value
+ * @active:		the task's clamp is refcounted in its rq's buckets
+ * @user_defined:	the requested clamp value comes from user-space
+ *
+ * The bucket_id is the index of the clamp bucket matching the clamp value
+ * which is pre-computed and stored to avoid expensive integer divisions
+ * from the fast path.
+ *
+ * The active bit is set whenever a task has got an "effective" value
+ * assigned, which can be different from the clamp value "requested" from
+ * user-space. This allows to know a task is refcounted in the rq's bucket
+ * corresponding to the "effective" bucket_id.
+ */
+struct uclamp_se {
+	unsigned int value		: SCHED_CAPACITY_SHIFT + 1;
+	unsigned int bucket_id		: 5;
+	unsigned int active		: 1;
+	unsigned int user_defined	: 1;
+};
+#endif /* CONFIG_UCLAMP_TASK */
+
 union rcu_special {
 	struct {
 		u8 blocked;
@@ -1626,6 +1718,17 @@ struct task_struct {
 #endif
 	struct sched_dl_entity dl;
 
+#ifdef CONFIG_UCLAMP_TASK
+	/* Clamp values requested for this task via sched_setattr() */
+	struct uclamp_se uclamp_req[UCLAMP_CNT];
+	/* Effective clamp values, after schedtune group restrictions */
+	struct uclamp_se uclamp[UCLAMP_CNT];
+#endif
+
+#ifdef CONFIG_SCHED_PRED_DEMAND
+	struct pred_demand pred;
+#endif
+
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	/* list of struct preempt_notifier: */
 	struct hlist_head preempt_notifiers;
@@ -1678,15 +1781,26 @@ struct task_struct {
 	/* Used for emulating ABI behavior of previous Linux versions */
 	unsigned int personality;
 
+#ifdef CONFIG_PSI
+	/* Pressure stall state */
+	unsigned int psi_flags;
+#endif
+
 	/* scheduler bits, serialized by scheduler locks */
 	unsigned sched_reset_on_fork:1;
 	unsigned sched_contributes_to_load:1;
 	unsigned sched_migrated:1;
+#ifdef CONFIG_PSI
+	unsigned sched_psi_wake_requeue:1;
+#endif
 	unsigned :0; /* force alignment to the next boundary */
 
 	/* unserialized, strictly 'current' */
 	unsigned in_execve:1; /* bit to tell LSMs we're in execve */
 	unsigned in_iowait:1;
+#ifdef CONFIG_PSI
+	unsigned in_memstall:1;
+#endif
 #ifdef CONFIG_MEMCG
 	unsigned memcg_may_oom:1;
 #endif
@@ -35,10 +35,32 @@ extern struct sched_group_energy *sge_array[NR_CPUS][NR_SD_LEVELS];
 
 void init_sched_energy_costs(void);
 
+/*
+ * Energy model registered by the cpufreq driver, one entry per OPP of a
+ * frequency domain. @freq is in kHz, @volt in uV and @coeff is the dynamic
+ * power coefficient in uW/MHz/V^2.
+ */
+int sched_energy_add_domain(const struct cpumask *cpus, int nr_states,
+			    const unsigned long *freq, const unsigned int *volt,
+			    unsigned int coeff);
+void sched_energy_set_freq_limits(const struct cpumask *cpus,
+				  unsigned long min_freq, unsigned long max_freq);
+bool sched_energy_enabled(void);
+unsigned long sched_energy_busy_power(int cpu, unsigned long util);
+
 #else
 
 #define init_sched_energy_costs() do { } while (0)
 
+static inline int sched_energy_add_domain(const struct cpumask *cpus,
+		int nr_states, const unsigned long *freq,
+		const unsigned int *volt, unsigned int coeff)
+{
+	return 0;
+}
+static inline void sched_energy_set_freq_limits(const struct cpumask *cpus,
+		unsigned long min_freq, unsigned long max_freq) { }
+
 #endif /* CONFIG_SMP */
 
 #endif
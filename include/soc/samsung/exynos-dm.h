@@ -139,6 +139,7 @@ int unregister_exynos_dm_freq_scaler(enum exynos_dm_type dm_type);
 int policy_update_call_to_DM(enum exynos_dm_type dm_type, u32 min_freq, u32 max_freq);
 int DM_CALL(enum exynos_dm_type dm_type, unsigned long *target_freq);
 int policy_update_with_DM_CALL(enum exynos_dm_type dm_type, u32 min_freq, u32 max_freq, unsigned long *target_freq);
+void exynos_dm_update_cur_freq(enum exynos_dm_type dm_type, u32 freq);
 #else
 static inline
 int exynos_dm_data_init(enum exynos_dm_type dm_type,
@@ -184,6 +185,10 @@ int policy_update_with_DM_CALL(enum exynos_dm_type dm_type, u32 min_freq, u32 ma
 {
 	return 0;
 }
+static inline
+void exynos_dm_update_cur_freq(enum exynos_dm_type dm_type, u32 freq)
+{
+}
 #endif
 
 #endif /* __EXYNOS_DM_H */
@@ -1212,6 +1212,62 @@ TRACE_EVENT(sched_freq_commit,
 			__entry->next_f)
 );
 
+/*
+ * Tracepoint for the thermal pressure reported for a cpu, as a fraction
+ * of its capacity out of SCHED_CAPACITY_SCALE.
+ */
+TRACE_EVENT(sched_thermal_pressure,
+
+	TP_PROTO(int cpu, unsigned long th_pressure),
+
+	TP_ARGS(cpu, th_pressure),
+
+	TP_STRUCT__entry(
+		__field( int,		cpu			)
+		__field( unsigned long,	th_pressure		)
+	),
+
+	TP_fast_assign(
+		__entry->cpu		= cpu;
+		__entry->th_pressure	= th_pressure;
+	),
+
+	TP_printk("cpu=%d th_pressure=%lu",
+		  __entry->cpu,
+		  __entry->th_pressure)
+);
+
+/*
+ * Tracepoint for the capacity left to CFS tasks on a cpu.
+ */
+TRACE_EVENT(sched_cpu_capacity,
+
+	TP_PROTO(int cpu, unsigned long capacity, unsigned long capacity_orig,
+		 unsigned long th_pressure),
+
+	TP_ARGS(cpu, capacity, capacity_orig, th_pressure),
+
+	TP_STRUCT__entry(
+		__field( int,		cpu			)
+		__field( unsigned long,	capacity		)
+		__field( unsigned long,	capacity_orig		)
+		__field( unsigned long,	th_pressure		)
+	),
+
+	TP_fast_assign(
+		__entry->cpu		= cpu;
+		__entry->capacity	= capacity;
+		__entry->capacity_orig	= capacity_orig;
+		__entry->th_pressure	= th_pressure;
+	),
+
+	TP_printk("cpu=%d capacity=%lu capacity_orig=%lu th_pressure=%lu",
+		  __entry->cpu,
+		  __entry->capacity,
+		  __entry->capacity_orig,
+		  __entry->th_pressure)
+);
+
 #endif /* _TRACE_SCHED_H */
 
 /* This part must be outside protection */
@@ -253,6 +253,32 @@ struct binder_node_debug_info {
 	__u32            has_weak_ref;
 };
 
+/*
+ * Use with BINDER_FREEZE. While a process is frozen, synchronous
+ * transactions to it fail with BR_FROZEN_REPLY and one-way transactions
+ * are queued until it is unfrozen. When enabling, the driver waits up to
+ * timeout_ms for transactions already in flight to the process to drain
+ * and fails with EAGAIN if some are still pending.
+ */
+struct binder_freeze_info {
+	__u32            pid;
+	__u32            enable;
+	__u32            timeout_ms;
+};
+
+/*
+ * Use with BINDER_GET_FROZEN_INFO, driver reads pid, writes the other
+ * fields. Bit 0 of sync_recv is set if a synchronous transaction was
+ * rejected since the process was frozen, bit 1 if the process still has
+ * transactions pending. async_recv is set if one-way transactions were
+ * queued while frozen.
+ */
+struct binder_frozen_status_info {
+	__u32            pid;
+	__u32            sync_recv;
+	__u32            async_recv;
+};
+
 #define BINDER_WRITE_READ		_IOWR('b', 1, struct binder_write_read)
 #define BINDER_SET_IDLE_TIMEOUT		_IOW('b', 3, __s64)
 #define BINDER_SET_MAX_THREADS		_IOW('b', 5, __u32)
@@ -262,6 +288,8 @@ struct binder_node_debug_info {
 #define BINDER_VERSION			_IOWR('b', 9, struct binder_version)
 #define BINDER_GET_NODE_DEBUG_INFO	_IOWR('b', 11, struct binder_node_debug_info)
 #define BINDER_SET_CONTEXT_MGR_EXT	_IOW('b', 13, struct flat_binder_object)
+#define BINDER_FREEZE			_IOW('b', 14, struct binder_freeze_info)
+#define BINDER_GET_FROZEN_INFO		_IOWR('b', 15, struct binder_frozen_status_info)
 /*
  * NOTE: Two special error codes you should check for when calling
  * in to the driver are:
@@ -440,6 +468,12 @@ enum binder_driver_return_protocol {
 	 * The the last transaction (either a bcTRANSACTION or
 	 * a bcATTEMPT_ACQUIRE) failed (e.g. out of memory).  No parameters.
 	 */
+
+	BR_FROZEN_REPLY = _IO('r', 18),
+	/*
+	 * The target of the last transaction (either a bcTRANSACTION or
+	 * a bcATTEMPT_ACQUIRE) is frozen.  No parameters.
+	 */
 };
 
 enum binder_driver_command_protocol {
@@ -119,10 +119,18 @@ static int sugov_select_scaling_cpu(void)
 static void sugov_update_commit(struct sugov_policy *sg_policy, u64 time,
 				unsigned int next_freq)
 {
+	struct cpufreq_policy *policy = sg_policy->policy;
+
 	sg_policy->last_freq_update_time = time;
 
 	if (sg_policy->next_freq != next_freq) {
 		sg_policy->next_freq = next_freq;
+
+		/* The driver may refuse, then the work item does the switch */
+		if (policy->fast_switch_enabled &&
+		    cpufreq_driver_fast_switch(policy, next_freq))
+			return;
+
 		sg_policy->work_in_progress = true;
 		irq_work_queue_on(&sg_policy->irq_work,
 			sugov_select_scaling_cpu());
@@ -156,6 +164,19 @@ static unsigned int get_next_freq(struct cpufreq_policy *policy,
 	return (freq + (freq >> 2)) * util / max;
 }
 
+/*
+ * Apply the utilization clamps of the tasks RUNNABLE on this CPU. The
+ * update hooks always run on the CPU whose utilization changed.
+ */
+static unsigned long sugov_clamp_util(unsigned long util, unsigned long max)
+{
+	/* ULONG_MAX asks for the maximum frequency, e.g. for RT tasks */
+	if (util == ULONG_MAX)
+		return util;
+
+	return min(uclamp_rq_util_with(this_rq(), util, NULL), max);
+}
+
 static void sugov_update_single(struct update_util_data *hook, u64 time,
 				unsigned long util, unsigned long max)
 {
@@ -167,6 +188,7 @@ static void sugov_update_single(struct update_util_data *hook, u64 time,
 	if (!sugov_should_update_freq(sg_policy, time))
 		return;
 
+	util = sugov_clamp_util(util, max);
 	next_f = util == ULONG_MAX ? policy->cpuinfo.max_freq :
 			get_next_freq(policy, util, max);
 
@@ -233,6 +255,8 @@ static void sugov_update_shared(struct update_util_data *hook, u64 time,
 	struct sugov_policy *sg_policy = sg_cpu->sg_policy;
 	unsigned int next_f;
 
+	util = sugov_clamp_util(util, max);
+
 	raw_spin_lock(&sg_policy->update_lock);
 
 	sg_cpu->util = util;
@@ -478,6 +502,7 @@ static int sugov_init(struct cpufreq_policy *policy)
 		}
 		policy->governor_data = sg_policy;
 		sg_policy->tunables = global_tunables;
+		cpufreq_enable_fast_switch(policy);
 
 		gov_attr_set_get(&global_tunables->attr_set, &sg_policy->tunables_hook);
 		goto out;
@@ -500,6 +525,8 @@ static int sugov_init(struct cpufreq_policy *policy)
 	policy->governor_data = sg_policy;
 	sg_policy->tunables = tunables;
 
+	cpufreq_enable_fast_switch(policy);
+
 	ret = kobject_init_and_add(&tunables->attr_set.kobj, &sugov_tunables_ktype,
 				   get_governor_parent_kobj(policy), "%s",
 				   schedutil_gov.name);
@@ -512,6 +539,7 @@ static int sugov_init(struct cpufreq_policy *policy)
 	return 0;
 
  fail:
+	cpufreq_disable_fast_switch(policy);
 	policy->governor_data = NULL;
 	schedtune_freqvar_boost_exit(policy, &tunables->freqvar_boost);
 	sugov_tunables_free(tunables);
@@ -534,6 +562,7 @@ static int sugov_exit(struct cpufreq_policy *policy)
 
 	count = gov_attr_set_put(&tunables->attr_set, &sg_policy->tunables_hook);
 	policy->governor_data = NULL;
+	cpufreq_disable_fast_switch(policy);
 	if (!count) {
 		schedtune_freqvar_boost_exit(policy, &tunables->freqvar_boost);
 		sugov_tunables_free(tunables);
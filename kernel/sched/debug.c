@@ -658,6 +658,11 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 	P(se.avg.load_avg);
 	P(se.avg.util_avg);
 	P(se.avg.last_update_time);
+#endif
+#ifdef CONFIG_SCHED_PRED_DEMAND
+	P(pred.busy);
+	P(pred.pred);
+	P(pred.contrib);
 #endif
 	P(policy);
 	P(prio);
@@ -1,6 +1,6 @@
 /*
- * Obtain energy cost data from DT and populate relevant scheduler data
- * structures.
+ * Obtain energy cost data from DT, or from the OPPs registered by the
+ * cpufreq driver, and populate relevant scheduler data structures.
  *
  * Copyright (C) 2015 ARM Ltd.
  *
@@ -20,15 +20,40 @@
 
 #define DEBUG
 
+#include <linux/cpumask.h>
 #include <linux/gfp.h>
 #include <linux/of.h>
 #include <linux/printk.h>
 #include <linux/sched.h>
 #include <linux/sched_energy.h>
+#include <linux/sort.h>
 #include <linux/stddef.h>
 
+#include "sched.h"
+
 struct sched_group_energy *sge_array[NR_CPUS][NR_SD_LEVELS];
 
+/*
+ * Per frequency domain energy model, registered by the cpufreq driver from
+ * the OPPs actually available on the part (see exynos-acme.c).
+ *
+ * 'states' is sorted by ascending frequency. 'min_idx' and 'max_idx' bound
+ * the states allowed by the current cpufreq policy limits; they are
+ * updated locklessly and read from the wakeup path.
+ */
+struct energy_domain {
+	struct cpumask cpus;
+	int nr_states;
+	unsigned long *freq;
+	struct capacity_state *states;
+	int min_idx;
+	int max_idx;
+};
+
+static struct energy_domain *energy_domain[NR_CPUS];
+static struct cpumask energy_cpus;
+static bool energy_complete;
+
 static void free_resources(void)
 {
 	int cpu, sd_level;
@@ -122,3 +147,157 @@ void init_sched_energy_costs(void)
 out:
 	free_resources();
 }
+
+struct energy_opp {
+	unsigned long freq;
+	unsigned long power;
+};
+
+static int cmp_energy_opp(const void *a, const void *b)
+{
+	const struct energy_opp *oa = a, *ob = b;
+
+	if (oa->freq == ob->freq)
+		return 0;
+
+	return oa->freq < ob->freq ? -1 : 1;
+}
+
+int sched_energy_add_domain(const struct cpumask *cpus, int nr_states,
+			    const unsigned long *freq, const unsigned int *volt,
+			    unsigned int coeff)
+{
+	struct energy_domain *ed;
+	struct energy_opp *opps;
+	unsigned long max_cap, max_freq;
+	int cpu, i;
+
+	if (!nr_states || !coeff || cpumask_empty(cpus))
+		return -EINVAL;
+
+	if (cpumask_intersects(&energy_cpus, cpus))
+		return -EEXIST;
+
+	opps = kcalloc(nr_states, sizeof(*opps), GFP_KERNEL);
+	ed = kzalloc(sizeof(*ed), GFP_KERNEL);
+	if (!opps || !ed)
+		goto nomem;
+
+	ed->freq = kcalloc(nr_states, sizeof(*ed->freq), GFP_KERNEL);
+	ed->states = kcalloc(nr_states, sizeof(*ed->states), GFP_KERNEL);
+	if (!ed->freq || !ed->states)
+		goto nomem;
+
+	/* P = C * V^2 * f, in mW as for the cpufreq cooling power table */
+	for (i = 0; i < nr_states; i++) {
+		u64 mv = volt[i] / 1000;
+		u64 power = (u64)coeff * (freq[i] / 1000) * mv * mv;
+
+		do_div(power, 1000000000);
+		opps[i].freq = freq[i];
+		opps[i].power = power;
+	}
+	sort(opps, nr_states, sizeof(*opps), cmp_energy_opp, NULL);
+
+	cpu = cpumask_first(cpus);
+	max_cap = arch_scale_cpu_capacity(NULL, cpu);
+	max_freq = opps[nr_states - 1].freq;
+
+	for (i = 0; i < nr_states; i++) {
+		ed->freq[i] = opps[i].freq;
+		ed->states[i].cap = max_cap * opps[i].freq / max_freq;
+		ed->states[i].power = opps[i].power;
+		pr_debug("cpus=%*pbl %lukHz cap=%lu power=%lu\n",
+			 cpumask_pr_args(cpus), ed->freq[i],
+			 ed->states[i].cap, ed->states[i].power);
+	}
+	kfree(opps);
+
+	cpumask_copy(&ed->cpus, cpus);
+	ed->nr_states = nr_states;
+	ed->min_idx = 0;
+	ed->max_idx = nr_states - 1;
+
+	for_each_cpu(cpu, cpus)
+		energy_domain[cpu] = ed;
+	cpumask_or(&energy_cpus, &energy_cpus, cpus);
+
+	/* Costs of different domains only compare once all are known */
+	WRITE_ONCE(energy_complete,
+		   cpumask_subset(cpu_possible_mask, &energy_cpus));
+
+	pr_info("cpus=%*pbl: %d states, %lu-%lumW\n", cpumask_pr_args(cpus),
+		nr_states, ed->states[0].power,
+		ed->states[nr_states - 1].power);
+
+	return 0;
+
+nomem:
+	if (ed) {
+		kfree(ed->freq);
+		kfree(ed->states);
+	}
+	kfree(ed);
+	kfree(opps);
+
+	return -ENOMEM;
+}
+
+/*
+ * Called by the cpufreq driver when the policy limits of a domain change,
+ * so that only the OPPs the domain can actually reach are costed.
+ */
+void sched_energy_set_freq_limits(const struct cpumask *cpus,
+				  unsigned long min_freq, unsigned long max_freq)
+{
+	struct energy_domain *ed = energy_domain[cpumask_first(cpus)];
+	int i, min_idx = 0, max_idx = 0;
+
+	if (!ed)
+		return;
+
+	for (i = 0; i < ed->nr_states; i++) {
+		if (ed->freq[i] <= min_freq)
+			min_idx = i;
+		if (ed->freq[i] <= max_freq)
+			max_idx = i;
+	}
+	min_idx = min(min_idx, max_idx);
+
+	WRITE_ONCE(ed->min_idx, min_idx);
+	WRITE_ONCE(ed->max_idx, max_idx);
+}
+
+bool sched_energy_enabled(void)
+{
+	return READ_ONCE(energy_complete);
+}
+
+/*
+ * Power drawn by @cpu to serve @util: the lowest allowed OPP whose capacity
+ * covers @util is selected, and its power is scaled by the fraction of the
+ * time the CPU is busy at that OPP.
+ */
+unsigned long sched_energy_busy_power(int cpu, unsigned long util)
+{
+	struct energy_domain *ed = energy_domain[cpu];
+	const struct capacity_state *cs;
+	int i, min_idx, max_idx;
+
+	if (!ed)
+		return 0;
+
+	min_idx = READ_ONCE(ed->min_idx);
+	max_idx = READ_ONCE(ed->max_idx);
+
+	for (i = min_idx; i < max_idx; i++) {
+		if (ed->states[i].cap >= util)
+			break;
+	}
+	cs = &ed->states[i];
+
+	if (!cs->cap)
+		return 0;
+
+	return cs->power * min(util, cs->cap) / cs->cap;
+}
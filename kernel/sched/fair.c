@@ -31,6 +31,7 @@
 #include <linux/migrate.h>
 #include <linux/task_work.h>
 #include <linux/of.h>
+#include <linux/sched_energy.h>
 #ifdef CONFIG_SCHED_HMP_SELECTIVE_BOOST_WITH_NITP
 #include <linux/cpuset.h>
 #endif
@@ -724,6 +725,219 @@ void init_entity_runnable_average(struct sched_entity *se)
 }
 #endif
 
+#ifdef CONFIG_SCHED_PRED_DEMAND
+/*
+ * Busy time prediction.
+ *
+ * PELT needs several periods to catch up with a task which wakes up for a
+ * burst of work after a quiet phase, so schedutil only picks the frequency
+ * for the burst when most of it is already over. To ramp up earlier, the
+ * capacity-invariant busy time of every activation (wakeup to sleep) of a
+ * task is recorded in a short history and sorted in NUM_BUSY_BUCKETS
+ * buckets covering the prediction window. When the task sleeps, the busy
+ * time of its next activation is predicted from the buckets; while it is
+ * queued that prediction is accounted in rq->pred_util, which is reported
+ * to schedutil together with the PELT utilization.
+ *
+ * This follows the busy bucket prediction of WALT, applied to activations
+ * instead of WALT windows.
+ */
+static unsigned int __read_mostly sched_pred_window = 16000000;
+
+#define PRED_INC_STEP		8
+#define PRED_INC_STEP_BIG	16
+#define PRED_DEC_STEP		2
+#define PRED_CONSISTENT_THRES	16
+
+static int __init set_sched_pred_window(char *str)
+{
+	unsigned int window = 0;
+
+	get_option(&str, &window);
+
+	if (window < NSEC_PER_MSEC || window > NSEC_PER_SEC) {
+		pr_warn("sched: invalid prediction window %u, using %u\n",
+			window, sched_pred_window);
+		return 0;
+	}
+
+	sched_pred_window = window;
+
+	return 0;
+}
+early_param("sched_pred_window", set_sched_pred_window);
+
+static inline int busy_to_bucket(u32 busy)
+{
+	int bidx = div_u64((u64)busy * NUM_BUSY_BUCKETS, sched_pred_window);
+
+	return min(bidx, NUM_BUSY_BUCKETS - 1);
+}
+
+static inline u32 bucket_to_busy(int bidx)
+{
+	return div_u64((u64)bidx * sched_pred_window, NUM_BUSY_BUCKETS);
+}
+
+static inline u32 pred_to_util(u32 pred)
+{
+	return div_u64((u64)pred << SCHED_CAPACITY_SHIFT, sched_pred_window);
+}
+
+/*
+ * Buckets hit by recent activations are incremented, faster once they are
+ * hit consistently, while all the others decay.
+ */
+static void update_busy_buckets(struct pred_demand *pd, int bidx)
+{
+	u8 *buckets = pd->buckets;
+	int i;
+
+	for (i = 0; i < NUM_BUSY_BUCKETS; i++) {
+		if (i == bidx) {
+			int inc = buckets[i] > PRED_CONSISTENT_THRES ?
+				  PRED_INC_STEP_BIG : PRED_INC_STEP;
+
+			buckets[i] = min_t(int, buckets[i] + inc, U8_MAX);
+		} else {
+			buckets[i] = buckets[i] > PRED_DEC_STEP ?
+				     buckets[i] - PRED_DEC_STEP : 0;
+		}
+	}
+}
+
+/*
+ * Predict the busy time of an activation which has already been busy for
+ * @busy: pick the first non-empty bucket from @start on, and return the most
+ * recent busy time of the history falling into it, or the middle of the
+ * bucket if none does. The prediction is never lower than @busy.
+ */
+static u32 get_pred_busy(struct pred_demand *pd, int start, u32 busy)
+{
+	u32 dmin, dmax, ret = 0;
+	int i, first = -1;
+
+	for (i = start; i < NUM_BUSY_BUCKETS; i++) {
+		if (pd->buckets[i]) {
+			first = i;
+			break;
+		}
+	}
+
+	/* No higher activation seen recently */
+	if (first < 0)
+		return busy;
+
+	/* The two lowest buckets are merged */
+	if (first < 2) {
+		dmin = 0;
+		first = 1;
+	} else {
+		dmin = bucket_to_busy(first);
+	}
+	dmax = bucket_to_busy(first + 1);
+
+	for (i = 0; i < PRED_HIST_SIZE; i++) {
+		if (pd->hist[i] >= dmin && pd->hist[i] < dmax) {
+			ret = pd->hist[i];
+			break;
+		}
+	}
+
+	if (!ret)
+		ret = (dmin + dmax) / 2;
+
+	return max(busy, ret);
+}
+
+/* Account @delta ns of execution of @p on @cpu to its current activation */
+static inline void pred_demand_account(struct task_struct *p, u64 delta,
+				       int cpu)
+{
+	struct pred_demand *pd = &p->pred;
+
+	delta = delta * arch_scale_freq_capacity(NULL, cpu) >>
+		SCHED_CAPACITY_SHIFT;
+	delta = delta * arch_scale_cpu_capacity(NULL, cpu) >>
+		SCHED_CAPACITY_SHIFT;
+
+	pd->busy = min_t(u64, pd->busy + delta, sched_pred_window);
+}
+
+static inline void pred_demand_enqueue(struct rq *rq, struct task_struct *p)
+{
+	struct pred_demand *pd = &p->pred;
+
+	pd->contrib = sched_feat(PRED_DEMAND) ? pred_to_util(pd->pred) : 0;
+	rq->pred_util += pd->contrib;
+}
+
+static inline void pred_demand_dequeue(struct rq *rq, struct task_struct *p,
+				       int flags)
+{
+	struct pred_demand *pd = &p->pred;
+	int i, bidx;
+
+	rq->pred_util -= pd->contrib;
+	pd->contrib = 0;
+
+	if (!(flags & DEQUEUE_SLEEP) || !pd->busy)
+		return;
+
+	/* The activation is over: record it and predict the next one */
+	for (i = PRED_HIST_SIZE - 1; i > 0; i--)
+		pd->hist[i] = pd->hist[i - 1];
+	pd->hist[0] = pd->busy;
+
+	bidx = busy_to_bucket(pd->busy);
+	update_busy_buckets(pd, bidx);
+	pd->pred = get_pred_busy(pd, bidx, 0);
+	pd->busy = 0;
+}
+
+/*
+ * The running task outgrew its prediction: move it to the next bucket seen
+ * recently. Returns true if rq->pred_util changed.
+ */
+static inline bool pred_demand_tick(struct rq *rq, struct task_struct *p)
+{
+	struct pred_demand *pd = &p->pred;
+	u32 contrib;
+
+	if (pd->busy <= pd->pred)
+		return false;
+
+	pd->pred = get_pred_busy(pd, busy_to_bucket(pd->busy), pd->busy);
+	if (!sched_feat(PRED_DEMAND))
+		return false;
+
+	contrib = pred_to_util(pd->pred);
+	rq->pred_util -= pd->contrib;
+	rq->pred_util += contrib;
+	pd->contrib = contrib;
+
+	return true;
+}
+
+static inline unsigned long pred_cpu_util(struct rq *rq, unsigned long util)
+{
+	if (!sched_feat(PRED_DEMAND))
+		return util;
+
+	return max(util, rq->pred_util);
+}
+#else
+static inline void pred_demand_account(struct task_struct *p, u64 delta,
+				       int cpu) { }
+static inline void pred_demand_enqueue(struct rq *rq, struct task_struct *p) { }
+static inline void pred_demand_dequeue(struct rq *rq, struct task_struct *p,
+				       int flags) { }
+static inline unsigned long pred_cpu_util(struct rq *rq, unsigned long util)
+{
+	return util;
+}
+#endif /* CONFIG_SCHED_PRED_DEMAND */
+
 /*
  * Update the current task's runtime statistics.
  */
@@ -757,6 +971,8 @@ static void update_curr(struct cfs_rq *cfs_rq)
 		trace_sched_stat_runtime(curtask, delta_exec, curr->vruntime);
 		cpuacct_charge(curtask, delta_exec);
 		account_group_exec_runtime(curtask, delta_exec);
+		pred_demand_account(curtask, delta_exec,
+				    cpu_of(rq_of(cfs_rq)));
 	}
 
 	account_cfs_rq_runtime(cfs_rq, delta_exec);
@@ -2875,7 +3091,7 @@ boosted_task_util(struct task_struct *task)
 	unsigned long util = task_util(task);
 	unsigned long margin = schedtune_task_margin(task);
 
-	return util + margin;
+	return uclamp_task_util(task, util + margin);
 }
 
 /*
@@ -3162,7 +3378,8 @@ static inline void cfs_rq_util_change(struct cfs_rq *cfs_rq)
 
 	if (cpu == smp_processor_id() && &rq->cfs == cfs_rq) {
 		unsigned long max = rq->cpu_capacity_orig;
-		unsigned long req_cap = boosted_cpu_util(cfs_rq->avg.util_avg, cpu);
+		unsigned long util = pred_cpu_util(rq, cfs_rq->avg.util_avg);
+		unsigned long req_cap = boosted_cpu_util(util, cpu);
 
 		/*
 		 * There are a few boundary cases this might miss but it should
@@ -4785,6 +5002,9 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &p->se;
 
+	/* Before enqueue_entity() so that the frequency update sees it */
+	pred_demand_enqueue(rq, p);
+
 	for_each_sched_entity(se) {
 		if (se->on_rq)
 			break;
@@ -4836,6 +5056,8 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 	struct sched_entity *se = &p->se;
 	int task_sleep = flags & DEQUEUE_SLEEP;
 
+	pred_demand_dequeue(rq, p, flags);
+
 	for_each_sched_entity(se) {
 		cfs_rq = cfs_rq_of(se);
 		dequeue_entity(cfs_rq, se, flags);
@@ -5120,6 +5342,13 @@ static unsigned long capacity_orig_of(int cpu)
 }
 #endif
 
+/* Capacity of the cpu at its current frequency */
+unsigned long capacity_curr_of(int cpu)
+{
+	return capacity_orig_of(cpu) * arch_scale_freq_capacity(NULL, cpu)
+	       >> SCHED_CAPACITY_SHIFT;
+}
+
 static unsigned long cpu_avg_load_per_task(int cpu)
 {
 	struct rq *rq = cpu_rq(cpu);
@@ -5407,6 +5636,26 @@ static inline bool task_fits_spare(struct task_struct *p, int cpu)
 {
 	return __task_fits(p, cpu, cpu_util(cpu));
 }
+
+/*
+ * Cost of placing @p on @cpu: the increase of the CPU busy power estimated
+ * from the energy model when it is available, its capacity otherwise.
+ * ECT tables are not guaranteed to be monotonic, so a higher OPP may come
+ * out cheaper; count that as no cost rather than letting it wrap.
+ */
+static unsigned long task_fit_cost(struct task_struct *p, int cpu)
+{
+	unsigned long util, power, new_power;
+
+	if (!sched_feat(ENERGY_AWARE) || !sched_energy_enabled())
+		return capacity_of(cpu);
+
+	util = cpu_util(cpu);
+	power = sched_energy_busy_power(cpu, util);
+	new_power = sched_energy_busy_power(cpu, util + boosted_task_util(p));
+
+	return new_power > power ? new_power - power : 0;
+}
 #endif
 
 /*
@@ -5423,7 +5672,7 @@ find_idlest_group(struct sched_domain *sd, struct task_struct *p,
 	int imbalance = 100 + (sd->imbalance_pct-100)/2;
 #ifdef CONFIG_CPU_FREQ_GOV_SCHEDUTIL
 	struct sched_group *fit_group = NULL;
-	unsigned long fit_capacity = ULONG_MAX;
+	unsigned long fit_cost = ULONG_MAX;
 #endif
 
 	if (sd_flag & SD_BALANCE_WAKE)
@@ -5458,9 +5707,13 @@ find_idlest_group(struct sched_domain *sd, struct task_struct *p,
 			 * Look for most energy-efficient group that can fit
 			 * that can fit the task.
 			 */
-			if (capacity_of(i) < fit_capacity && task_fits_spare(p, i)) {
-				fit_capacity = capacity_of(i);
-				fit_group = group;
+			if (task_fits_spare(p, i)) {
+				unsigned long cost = task_fit_cost(p, i);
+
+				if (cost < fit_cost) {
+					fit_cost = cost;
+					fit_group = group;
+				}
 			}
 #endif
 		}
@@ -8295,16 +8548,23 @@ static unsigned long scale_rt_capacity(int cpu)
 static void update_cpu_capacity(struct sched_domain *sd, int cpu)
 {
 	unsigned long capacity = arch_scale_cpu_capacity(sd, cpu);
+	unsigned long th_pressure = arch_scale_thermal_pressure(cpu);
 	struct sched_group *sdg = sd->groups;
 
 	cpu_rq(cpu)->cpu_capacity_orig = capacity;
 
+	/* Don't count capacity the cpu can't reach while it is throttled */
+	capacity = capacity > th_pressure ? capacity - th_pressure : 0;
+
 	capacity *= scale_rt_capacity(cpu);
 	capacity >>= SCHED_CAPACITY_SHIFT;
 
 	if (!capacity)
 		capacity = 1;
 
+	trace_sched_cpu_capacity(cpu, capacity, cpu_rq(cpu)->cpu_capacity_orig,
+				 th_pressure);
+
 	cpu_rq(cpu)->cpu_capacity = capacity;
 	sdg->sgc->capacity = capacity;
 }
@@ -10805,6 +11065,11 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		entity_tick(cfs_rq, se, queued);
 	}
 
+#ifdef CONFIG_SCHED_PRED_DEMAND
+	if (pred_demand_tick(rq, curr))
+		cfs_rq_util_change(&rq->cfs);
+#endif
+
 	if (static_branch_unlikely(&sched_numa_balancing))
 		task_tick_numa(rq, curr);
 
@@ -11254,6 +11519,9 @@ const struct sched_class fair_sched_class = {
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	.task_move_group	= task_move_group_fair,
 #endif
+#ifdef CONFIG_UCLAMP_TASK
+	.uclamp_enabled		= 1,
+#endif
 };
 
 #ifdef CONFIG_SCHED_DEBUG
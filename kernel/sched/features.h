@@ -78,3 +78,10 @@ SCHED_FEAT(ENERGY_AWARE, true)
 #else
 SCHED_FEAT(ENERGY_AWARE, false)
 #endif
+
+#ifdef CONFIG_SCHED_PRED_DEMAND
+/*
+ * Report the predicted busy time of the RUNNABLE tasks to schedutil.
+ */
+SCHED_FEAT(PRED_DEMAND, true)
+#endif
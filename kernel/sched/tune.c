@@ -1,5 +1,6 @@
 #include <linux/cgroup.h>
 #include <linux/err.h>
+#include <linux/mutex.h>
 #include <linux/percpu.h>
 #include <linux/printk.h>
 #include <linux/rcupdate.h>
@@ -27,6 +28,11 @@ struct schedtune {
 	/* Boost value for tasks on that SchedTune CGroup */
 	int boost;
 
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	/* Utilization clamps for tasks on that SchedTune CGroup */
+	unsigned int util_min;
+	unsigned int util_max;
+#endif
 };
 
 static inline struct schedtune *css_st(struct cgroup_subsys_state *css)
@@ -56,6 +62,10 @@ static inline struct schedtune *parent_st(struct schedtune *st)
 static struct schedtune
 root_schedtune = {
 	.boost	= 0,
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	.util_min = 0,
+	.util_max = SCHED_CAPACITY_SCALE,
+#endif
 };
 
 /*
@@ -305,12 +315,115 @@ boost_write(struct cgroup_subsys_state *css, struct cftype *cft,
 	return 0;
 }
 
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+/* Serializes util_min/util_max updates so that util_min <= util_max holds */
+static DEFINE_MUTEX(uclamp_mutex);
+
+unsigned int schedtune_uclamp(struct task_struct *p, enum uclamp_id clamp_id)
+{
+	struct schedtune *st;
+	unsigned int value;
+
+	rcu_read_lock();
+	st = task_schedtune(p);
+	if (clamp_id == UCLAMP_MIN)
+		value = READ_ONCE(st->util_min);
+	else
+		value = READ_ONCE(st->util_max);
+	rcu_read_unlock();
+
+	return value;
+}
+
+/* Refresh the effective clamps of the RUNNABLE tasks of a group */
+static void schedtune_uclamp_update(struct schedtune *st)
+{
+	struct css_task_iter it;
+	struct task_struct *p;
+
+	css_task_iter_start(&st->css, &it);
+	while ((p = css_task_iter_next(&it)))
+		uclamp_update_active(p);
+	css_task_iter_end(&it);
+}
+
+static u64
+util_min_read(struct cgroup_subsys_state *css, struct cftype *cft)
+{
+	return css_st(css)->util_min;
+}
+
+static int
+util_min_write(struct cgroup_subsys_state *css, struct cftype *cft,
+	       u64 util_min)
+{
+	struct schedtune *st = css_st(css);
+
+	mutex_lock(&uclamp_mutex);
+	if (util_min > st->util_max) {
+		mutex_unlock(&uclamp_mutex);
+		return -EINVAL;
+	}
+	WRITE_ONCE(st->util_min, util_min);
+	schedtune_uclamp_update(st);
+	mutex_unlock(&uclamp_mutex);
+
+	return 0;
+}
+
+static u64
+util_max_read(struct cgroup_subsys_state *css, struct cftype *cft)
+{
+	return css_st(css)->util_max;
+}
+
+static int
+util_max_write(struct cgroup_subsys_state *css, struct cftype *cft,
+	       u64 util_max)
+{
+	struct schedtune *st = css_st(css);
+
+	mutex_lock(&uclamp_mutex);
+	if (util_max > SCHED_CAPACITY_SCALE || util_max < st->util_min) {
+		mutex_unlock(&uclamp_mutex);
+		return -EINVAL;
+	}
+	WRITE_ONCE(st->util_max, util_max);
+	schedtune_uclamp_update(st);
+	mutex_unlock(&uclamp_mutex);
+
+	return 0;
+}
+
+static void
+schedtune_attach(struct cgroup_taskset *tset)
+{
+	struct task_struct *task;
+	struct cgroup_subsys_state *css;
+
+	cgroup_taskset_for_each(task, css, tset)
+		uclamp_update_active(task);
+}
+#endif /* CONFIG_UCLAMP_TASK_GROUP */
+
 static struct cftype files[] = {
 	{
 		.name = "boost",
 		.read_u64 = boost_read,
 		.write_u64 = boost_write,
 	},
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	{
+		.name = "util_min",
+		.read_u64 = util_min_read,
+		.write_u64 = util_min_write,
+	},
+	{
+		.name = "util_max",
+		.read_u64 = util_max_read,
+		.write_u64 = util_max_write,
+	},
+#endif
 	{ }	/* terminate */
 };
 
@@ -383,6 +496,9 @@ schedtune_css_alloc(struct cgroup_subsys_state *parent_css)
 
 	/* Initialize per CPUs boost group support */
 	st->idx = idx;
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	st->util_max = SCHED_CAPACITY_SCALE;
+#endif
 	if (schedtune_boostgroup_init(st))
 		goto release;
 
@@ -416,6 +532,9 @@ schedtune_css_free(struct cgroup_subsys_state *css)
 struct cgroup_subsys schedtune_cgrp_subsys = {
 	.css_alloc	= schedtune_css_alloc,
 	.css_free	= schedtune_css_free,
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	.attach		= schedtune_attach,
+#endif
 	.legacy_cftypes	= files,
 	.early_init	= 1,
 };
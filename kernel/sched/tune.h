@@ -59,6 +59,10 @@ void schedtune_exit_task(struct task_struct *tsk);
 void schedtune_enqueue_task(struct task_struct *p, int cpu);
 void schedtune_dequeue_task(struct task_struct *p, int cpu);
 
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+unsigned int schedtune_uclamp(struct task_struct *p, enum uclamp_id clamp_id);
+#endif
+
 #else /* CONFIG_CGROUP_SCHEDTUNE */
 
 #define schedtune_cpu_boost(cpu)  get_sysctl_sched_cfs_boost()
@@ -0,0 +1,114 @@
+/*
+ * sched_setattr() utilization clamp ABI checks.
+ *
+ * The clamp values were added to struct sched_attr with
+ * SCHED_ATTR_SIZE_VER1; a caller passing the original VER0 sized
+ * struct must not be able to set SCHED_FLAG_UTIL_CLAMP_* and have the
+ * missing values read as zero.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define SCHED_ATTR_SIZE_VER0		48
+#define SCHED_ATTR_SIZE_VER1		56
+
+#define SCHED_FLAG_KEEP_POLICY		0x08
+#define SCHED_FLAG_KEEP_PARAMS		0x10
+#define SCHED_FLAG_UTIL_CLAMP_MIN	0x20
+#define SCHED_FLAG_UTIL_CLAMP_MAX	0x40
+
+#define SCHED_FLAG_KEEP_ALL	(SCHED_FLAG_KEEP_POLICY | \
+				 SCHED_FLAG_KEEP_PARAMS)
+
+struct sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+	uint32_t sched_util_min;
+	uint32_t sched_util_max;
+};
+
+#define err(fmt, ...)						\
+		fprintf(stderr,					\
+			"Error (%s:%d): " fmt,			\
+			__FILE__, __LINE__, ##__VA_ARGS__)
+
+static int sys_sched_setattr(pid_t pid, struct sched_attr *attr,
+			     unsigned int flags)
+{
+	return syscall(__NR_sched_setattr, pid, attr, flags);
+}
+
+static int sys_sched_getattr(pid_t pid, struct sched_attr *attr,
+			     unsigned int size, unsigned int flags)
+{
+	return syscall(__NR_sched_getattr, pid, attr, size, flags);
+}
+
+static int get_util_max(uint32_t *util_max)
+{
+	struct sched_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	if (sys_sched_getattr(0, &attr, sizeof(attr), 0)) {
+		err("sched_getattr() failed: %m\n");
+		return -1;
+	}
+	*util_max = attr.sched_util_max;
+	return 0;
+}
+
+int main(void)
+{
+	struct sched_attr attr;
+	uint32_t before, after;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = SCHED_ATTR_SIZE_VER1;
+	attr.sched_flags = SCHED_FLAG_KEEP_ALL | SCHED_FLAG_UTIL_CLAMP_MAX;
+	attr.sched_util_max = 512;
+	if (sys_sched_setattr(0, &attr, 0)) {
+		if (errno == EOPNOTSUPP || errno == EINVAL) {
+			printf("utilization clamping not supported, skipping\n");
+			return 0;
+		}
+		err("sched_setattr() with a VER1 attr failed: %m\n");
+		return 1;
+	}
+
+	if (get_util_max(&before))
+		return 1;
+	if (before != 512) {
+		err("util_max is %u, expected 512\n", before);
+		return 1;
+	}
+
+	/* A VER0 attr has no room for the clamps */
+	memset(&attr, 0, sizeof(attr));
+	attr.size = SCHED_ATTR_SIZE_VER0;
+	attr.sched_flags = SCHED_FLAG_KEEP_ALL | SCHED_FLAG_UTIL_CLAMP_MAX;
+	if (sys_sched_setattr(0, &attr, 0) != -1 || errno != EINVAL) {
+		err("VER0 attr with SCHED_FLAG_UTIL_CLAMP_MAX was not rejected\n");
+		return 1;
+	}
+
+	if (get_util_max(&after))
+		return 1;
+	if (after != before) {
+		err("util_max changed from %u to %u\n", before, after);
+		return 1;
+	}
+
+	printf("uclamp_attr: ok\n");
+	return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * zram_bench - random 4K read/write throughput of a zram device
+ *
+ * Runs the same O_DIRECT random pread()/pwrite() load with 1, 2, 4 and
+ * 8 threads (up to -t) against an initialized zram device, so that
+ * contention on the I/O path shows up as lack of scaling.
+ *
+ * Usage: zram_bench [-d /dev/zram0] [-t max_threads] [-s seconds]
+ *                   [-r read_percent]
+ *
+ * The device content is destroyed.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#define BLK_SIZE	4096
+
+static const char *dev = "/dev/zram0";
+static int max_threads = 8;
+static int seconds = 5;
+static int read_pct = 70;
+static uint64_t nr_blocks;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	unsigned int seed;
+	uint64_t ops;
+	uint64_t errors;
+};
+
+static uint64_t rand64(unsigned int *seed)
+{
+	return ((uint64_t)rand_r(seed) << 31) ^ rand_r(seed);
+}
+
+static void fill_block(char *buf, unsigned int *seed)
+{
+	int i;
+
+	/* half random, half zero: compressible like anonymous memory */
+	for (i = 0; i < BLK_SIZE / 2; i += sizeof(int))
+		*(int *)(buf + i) = rand_r(seed);
+	memset(buf + BLK_SIZE / 2, 0, BLK_SIZE / 2);
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char *buf;
+	int fd;
+
+	fd = open(dev, O_RDWR | O_DIRECT);
+	if (fd < 0) {
+		perror(dev);
+		w->errors++;
+		return NULL;
+	}
+	if (posix_memalign((void **)&buf, BLK_SIZE, BLK_SIZE)) {
+		close(fd);
+		w->errors++;
+		return NULL;
+	}
+
+	while (!stop) {
+		off_t off = (rand64(&w->seed) % nr_blocks) * BLK_SIZE;
+		ssize_t ret;
+
+		if ((int)(rand_r(&w->seed) % 100) < read_pct) {
+			ret = pread(fd, buf, BLK_SIZE, off);
+		} else {
+			fill_block(buf, &w->seed);
+			ret = pwrite(fd, buf, BLK_SIZE, off);
+		}
+		if (ret != BLK_SIZE)
+			w->errors++;
+		else
+			w->ops++;
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static int prefill(void)
+{
+	unsigned int seed = 1;
+	uint64_t blk;
+	char *buf;
+	int fd;
+
+	fd = open(dev, O_RDWR | O_DIRECT);
+	if (fd < 0) {
+		perror(dev);
+		return -1;
+	}
+	if (posix_memalign((void **)&buf, BLK_SIZE, BLK_SIZE)) {
+		close(fd);
+		return -1;
+	}
+	for (blk = 0; blk < nr_blocks; blk++) {
+		fill_block(buf, &seed);
+		if (pwrite(fd, buf, BLK_SIZE, blk * BLK_SIZE) != BLK_SIZE) {
+			perror("prefill");
+			break;
+		}
+	}
+	free(buf);
+	close(fd);
+	return blk == nr_blocks ? 0 : -1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(int nr_threads)
+{
+	struct worker *workers;
+	uint64_t ops = 0, errors = 0;
+	double start, elapsed;
+	int i;
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		return -1;
+
+	stop = 0;
+	start = now();
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].seed = i + 1;
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+					&workers[i])) {
+			perror("pthread_create");
+			stop = 1;
+			nr_threads = i;
+			break;
+		}
+	}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ops += workers[i].ops;
+		errors += workers[i].errors;
+	}
+	elapsed = now() - start;
+	free(workers);
+
+	printf("%7d %12.0f %10.1f %8llu\n", nr_threads, ops / elapsed,
+		ops * (double)BLK_SIZE / elapsed / (1 << 20),
+		(unsigned long long)errors);
+	return errors ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t size;
+	int opt, fd, nr, ret = 0;
+
+	while ((opt = getopt(argc, argv, "d:t:s:r:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'r':
+			read_pct = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d dev] [-t threads] [-s seconds] [-r read%%]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	fd = open(dev, O_RDONLY);
+	if (fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &size) < 0) {
+		perror("BLKGETSIZE64");
+		close(fd);
+		return 1;
+	}
+	close(fd);
+
+	nr_blocks = size / BLK_SIZE;
+	if (!nr_blocks) {
+		fprintf(stderr, "%s: device not initialized (disksize 0)\n",
+			dev);
+		return 1;
+	}
+
+	if (prefill())
+		return 1;
+
+	printf("%s: %llu MiB, %d%% reads, %ds per run\n", dev,
+		(unsigned long long)(size >> 20), read_pct, seconds);
+	printf("%7s %12s %10s %8s\n", "threads", "IOPS", "MB/s", "errors");
+	for (nr = 1; nr <= max_threads; nr *= 2)
+		if (run(nr))
+			ret = 1;
+
+	return ret;
+}